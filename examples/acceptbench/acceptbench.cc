@@ -0,0 +1,110 @@
+//
+// Created by li on 2022/6/10.
+//
+
+// Cost of accepting connections, one at a time against batches.
+// usage: acceptbench [connections] [client threads]
+// Client threads connect to a TcpServer on loopback and reset each
+// connection at once. Prints the accepts per second and the CPU time the
+// server thread spent per accepted connection, with an accept batch of 1
+// and of 64. The wall clock rate is usually bound by the clients, the CPU
+// per connection is what the batch changes.
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "tohka/ioloop.h"
+#include "tohka/tcpserver.h"
+#include "tohka/util/log.h"
+
+using namespace tohka;
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+double GetThreadCpuUs() {
+  timespec ts{};
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return (double)ts.tv_sec * 1e6 + (double)ts.tv_nsec / 1e3;
+}
+
+void ConnectAndReset(uint16_t port, int connections) {
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  linger reset{1, 0};
+  for (int i = 0; i < connections; ++i) {
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    if (::connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+      perror("connect");
+      exit(1);
+    }
+    ::setsockopt(fd, SOL_SOCKET, SO_LINGER, &reset, sizeof(reset));
+    ::close(fd);
+  }
+}
+
+void Run(int accept_batch, uint16_t port, int connections, int threads) {
+  std::atomic<bool> listening{false};
+  double cpu_us = 0;
+  std::thread server_thread([&] {
+    IoLoop loop;
+    // every reset connection logs a read error
+    log_set_level(LOG_FATAL);
+    TcpServer server(&loop, NetAddress(port));
+    server.SetAcceptBatch(accept_batch);
+    int accepted = 0;
+    int open = 0;
+    server.SetOnConnection([&](const TcpEventPrt_t& conn) {
+      if (conn->Connected()) {
+        ++accepted;
+        ++open;
+      } else if (--open == 0 && accepted == connections) {
+        loop.Quit();
+      }
+    });
+    server.Run();
+    listening = true;
+    double start = GetThreadCpuUs();
+    loop.RunForever();
+    cpu_us = GetThreadCpuUs() - start;
+  });
+  while (!listening) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  auto start = Clock::now();
+  std::vector<std::thread> clients;
+  for (int i = 0; i < threads; ++i) {
+    int count = connections / threads + (i < connections % threads ? 1 : 0);
+    clients.emplace_back(ConnectAndReset, port, count);
+  }
+  for (auto& client : clients) {
+    client.join();
+  }
+  server_thread.join();
+  std::chrono::duration<double> elapsed = Clock::now() - start;
+  fprintf(stdout, "batch %-3d %.0f accepts/s %.1f us cpu/conn\n",
+          accept_batch, connections / elapsed.count(), cpu_us / connections);
+}
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  int connections = argc > 1 ? atoi(argv[1]) : 30000;
+  int threads = argc > 2 ? atoi(argv[2]) : 8;
+  fprintf(stdout, "%d connect+reset from %d client threads\n", connections,
+          threads);
+  Run(1, 23482, connections, threads);
+  Run(64, 23483, connections, threads);
+  return 0;
+}
@@ -0,0 +1,105 @@
+//
+// Created by li on 2022/7/6.
+//
+
+// Print a file written by BinLog in binary mode as log lines.
+// usage: binlogdump [file]
+
+#include <cstdio>
+#include <string>
+#include <unordered_map>
+
+#include "tohka/util/binlog.h"
+
+using namespace tohka;
+
+namespace {
+struct SiteInfo {
+  int level;
+  int line;
+  std::string file;
+  std::string fmt;
+  std::string types;
+};
+
+bool ReadFrame(FILE* fp, uint8_t* kind, std::string* payload) {
+  uint32_t len;
+  if (fread(kind, 1, 1, fp) != 1 || fread(&len, sizeof(len), 1, fp) != 1) {
+    return false;
+  }
+  payload->resize(len);
+  return len == 0 || fread(&(*payload)[0], 1, len, fp) == len;
+}
+
+// next NUL terminated string of the payload
+std::string NextString(const std::string& payload, size_t* offset) {
+  if (*offset >= payload.size()) {
+    return "";
+  }
+  size_t end = payload.find('\0', *offset);
+  if (end == std::string::npos) {
+    end = payload.size();
+  }
+  std::string s = payload.substr(*offset, end - *offset);
+  *offset = end + 1;
+  return s;
+}
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  FILE* fp = argc > 1 ? fopen(argv[1], "rb") : stdin;
+  if (fp == nullptr) {
+    perror("fopen");
+    return 1;
+  }
+  std::unordered_map<uint32_t, SiteInfo> sites;
+  uint8_t kind;
+  std::string payload;
+  std::string line;
+  size_t records = 0;
+  while (ReadFrame(fp, &kind, &payload)) {
+    uint32_t id;
+    if (payload.size() < sizeof(id)) {
+      continue;
+    }
+    memcpy(&id, payload.data(), sizeof(id));
+    if (kind == BinLog::kSiteFrame) {
+      SiteInfo site;
+      int32_t value;
+      size_t offset = sizeof(id);
+      if (payload.size() < offset + 2 * sizeof(value)) {
+        fprintf(stderr, "bad site %u\n", id);
+        continue;
+      }
+      memcpy(&value, payload.data() + offset, sizeof(value));
+      site.level = value;
+      offset += sizeof(value);
+      memcpy(&value, payload.data() + offset, sizeof(value));
+      site.line = value;
+      offset += sizeof(value);
+      site.file = NextString(payload, &offset);
+      site.fmt = NextString(payload, &offset);
+      site.types = NextString(payload, &offset);
+      sites[id] = std::move(site);
+    } else if (kind == BinLog::kRecordFrame) {
+      auto it = sites.find(id);
+      int64_t time;
+      size_t header = sizeof(id) + sizeof(time);
+      if (it == sites.end() || payload.size() < header) {
+        fprintf(stderr, "bad record of site %u\n", id);
+        continue;
+      }
+      memcpy(&time, payload.data() + sizeof(id), sizeof(time));
+      const SiteInfo& site = it->second;
+      line.clear();
+      BinLog::FormatRecord(site.level, site.file.c_str(), site.line,
+                           site.fmt.c_str(), site.types.c_str(), time,
+                           payload.data() + header, payload.size() - header,
+                           line);
+      fwrite(line.data(), 1, line.size(), stdout);
+      ++records;
+    }
+  }
+  fprintf(stderr, "%zu records of %zu sites\n", records, sites.size());
+  return 0;
+}
@@ -0,0 +1,137 @@
+//
+// Created by li on 2022/6/6.
+//
+
+// Auto-cork against plain Send on loopback.
+// usage: corkbench [requests] [sends per reply]
+// A client sends requests one after another, the server answers each with
+// several small Sends. Prints the write syscalls the server thread made per
+// request (from /proc, syscw) and the request latency percentiles, once
+// with auto-cork off and once with it on.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "tohka/ioloop.h"
+#include "tohka/tcpserver.h"
+#include "tohka/util/log.h"
+
+using namespace tohka;
+
+namespace {
+using Clock = std::chrono::steady_clock;
+constexpr size_t kRequestSize = 16;
+constexpr size_t kPartSize = 100;
+
+// write syscalls made by a thread so far
+long GetWriteSyscalls(pid_t tid) {
+  std::ifstream io("/proc/self/task/" + std::to_string(tid) + "/io");
+  std::string key;
+  long value = 0;
+  while (io >> key >> value) {
+    if (key == "syscw:") {
+      return value;
+    }
+  }
+  return -1;
+}
+
+bool ReadFull(int fd, char* buf, size_t len) {
+  while (len > 0) {
+    ssize_t n = ::read(fd, buf, len);
+    if (n <= 0) {
+      return false;
+    }
+    buf += n;
+    len -= (size_t)n;
+  }
+  return true;
+}
+
+void Run(bool auto_cork, uint16_t port, int requests, int parts) {
+  std::atomic<pid_t> server_tid{0};
+  std::thread server_thread([&] {
+    IoLoop loop;
+    log_set_level(LOG_WARN);
+    TcpServer server(&loop, NetAddress(port));
+    server.SetAutoCork(auto_cork);
+    std::string part(kPartSize, 'x');
+    server.SetOnMessage([&](const TcpEventPrt_t& conn, IoBuf* buf) {
+      while (buf->GetReadableSize() >= kRequestSize) {
+        buf->Retrieve(kRequestSize);
+        for (int i = 0; i < parts; ++i) {
+          conn->Send(part);
+        }
+      }
+    });
+    server.SetOnConnection([&](const TcpEventPrt_t& conn) {
+      if (!conn->Connected()) {
+        loop.Quit();
+      }
+    });
+    server.Run();
+    server_tid = (pid_t)syscall(SYS_gettid);
+    loop.RunForever();
+  });
+  while (server_tid == 0) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (::connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0) {
+    perror("connect");
+    exit(1);
+  }
+  char request[kRequestSize] = {};
+  std::vector<char> reply(kPartSize * parts);
+  std::vector<double> latencies;
+  latencies.reserve(requests);
+  long writes_before = GetWriteSyscalls(server_tid);
+  for (int i = 0; i < requests; ++i) {
+    auto start = Clock::now();
+    if (::write(fd, request, sizeof(request)) != (ssize_t)sizeof(request) ||
+        !ReadFull(fd, reply.data(), reply.size())) {
+      perror("request");
+      exit(1);
+    }
+    std::chrono::duration<double, std::micro> elapsed = Clock::now() - start;
+    latencies.push_back(elapsed.count());
+  }
+  long writes = GetWriteSyscalls(server_tid) - writes_before;
+  ::close(fd);
+  server_thread.join();
+
+  std::sort(latencies.begin(), latencies.end());
+  fprintf(stdout,
+          "%-8s %.2f write syscalls/request p50 %.1fus p99 %.1fus\n",
+          auto_cork ? "cork" : "default", (double)writes / requests,
+          latencies[latencies.size() / 2],
+          latencies[latencies.size() * 99 / 100]);
+}
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  int requests = argc > 1 ? atoi(argv[1]) : 1000;
+  int parts = argc > 2 ? atoi(argv[2]) : 3;
+  fprintf(stdout, "%d sequential requests, %d sends of %zu bytes per reply\n",
+          requests, parts, kPartSize);
+  Run(false, 23480, requests, parts);
+  Run(true, 23481, requests, parts);
+  return 0;
+}
@@ -0,0 +1,87 @@
+#!/usr/bin/env bash
+# Checks the USDT probes (tohka/util/probes.h) on loopback: runs
+# simple_echo and pingpong_client under bpftrace, then a bulk client that
+# sends 16MB before reading so the server has to buffer its output. The
+# server must fire accept, read, write, send, close, loop_start and
+# loop_end, the client read, send, timer_fire, loop_start and loop_end.
+# simple_echo sets no timer, its timer_fire is not checked. Needs root,
+# bpftrace, python3 and a build that found sys/sdt.h.
+#
+#   sudo examples/echo/trace_probes.sh [build dir]
+set -euo pipefail
+
+BIN_DIR="$(cd "${1:-build}" && pwd)/bin"
+SERVER="$BIN_DIR/simple_echo"
+CLIENT="$BIN_DIR/pingpong_client"
+OUT="$(mktemp -d)"
+SERVER_PID=""
+TRACER_PID=""
+cleanup() {
+  [ -n "$TRACER_PID" ] && kill "$TRACER_PID" 2>/dev/null || true
+  [ -n "$SERVER_PID" ] && kill "$SERVER_PID" 2>/dev/null || true
+  rm -rf "$OUT"
+}
+trap cleanup EXIT
+
+if ! readelf -n "$SERVER" | grep -q "Provider: tohka"; then
+  echo "no tohka probes in $SERVER, was sys/sdt.h found?" >&2
+  exit 1
+fi
+
+# counts every probe, and the distributions of the durations, which are
+# only measured while traced by pid
+program() {
+  cat <<EOF
+usdt:$1:tohka:* { @probes[probe] = count(); }
+usdt:$1:tohka:read /arg1 > 0/ { @read_bytes = hist(arg1); @on_message_us = hist(arg2); }
+usdt:$1:tohka:send { @send_queued_bytes = sum(arg1 - arg2); }
+usdt:$1:tohka:loop_end { @iteration_us = hist(arg2); }
+usdt:$1:tohka:timer_fire { @timer_lag_us = hist(arg1); @timer_callback_us = hist(arg2); }
+EOF
+}
+
+"$SERVER" >/dev/null 2>&1 &
+SERVER_PID=$!
+bpftrace -p "$SERVER_PID" -e "$(program "$SERVER")" >"$OUT/server" &
+TRACER_PID=$!
+sleep 2
+# runs for 10 seconds with 100 connections
+bpftrace -c "$CLIENT" -e "$(program "$CLIENT")" >"$OUT/client"
+# pingpong never fills a socket buffer, the server only writes from its
+# output buffer (the write probe) when the peer reads slower than it sends.
+# The echo is buffered by the server while this client is not reading.
+python3 - <<'PY'
+import socket
+
+SIZE = 16 * 1024 * 1024
+sock = socket.create_connection(("127.0.0.1", 6666))
+sock.sendall(b"x" * SIZE)
+received = 0
+while received < SIZE:
+    data = sock.recv(1 << 20)
+    if not data:
+        break
+    received += len(data)
+sock.close()
+PY
+sleep 1
+kill -INT "$TRACER_PID"
+wait "$TRACER_PID" || true
+TRACER_PID=""
+
+cat "$OUT/server" "$OUT/client"
+status=0
+check() {
+  if ! grep -q "tohka:$2\]" "$OUT/$1"; then
+    echo "FAIL: $2 did not fire in the $1" >&2
+    status=1
+  fi
+}
+for probe in accept read write send close loop_start loop_end; do
+  check server "$probe"
+done
+for probe in read send timer_fire loop_start loop_end; do
+  check client "$probe"
+done
+[ "$status" -eq 0 ] && echo "all probes fired"
+exit "$status"
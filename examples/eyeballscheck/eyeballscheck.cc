@@ -0,0 +1,137 @@
+//
+// Created by li on 2022/6/21.
+//
+
+// Checks MultiConnector against local listeners that never answer.
+// usage: eyeballscheck
+// A listener whose backlog is full drops SYNs, so a connect to it hangs
+// like one to a dead host. Each case connects to a list of such listeners,
+// a refused port and a listener that answers, and checks which candidate
+// wins and that the attempts were staggered by the attempt delay. Exits 1
+// if a case fails.
+
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "tohka/ioloop.h"
+#include "tohka/multiconnector.h"
+#include "tohka/socketutil.h"
+#include "tohka/util/log.h"
+
+using namespace tohka;
+
+namespace {
+constexpr uint16_t kAnswerPort = 23500;
+constexpr uint16_t kRefusedPort = 23501;
+constexpr uint16_t kSilentPort = 23502;
+
+int Listen(uint16_t port, int backlog) {
+  int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+  int on = 1;
+  ::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (::bind(fd, (sockaddr*)&addr, sizeof(addr)) < 0 ||
+      ::listen(fd, backlog) < 0) {
+    perror("listen");
+    exit(1);
+  }
+  return fd;
+}
+
+// a listener that never accepts, its backlog filled by connections that
+// are never closed, so later SYNs are dropped
+void ListenSilent(uint16_t port) {
+  Listen(port, 0);
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  for (int i = 0; i < 4; ++i) {
+    int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    ::connect(fd, (sockaddr*)&addr, sizeof(addr));
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+}
+
+NetAddress Local(uint16_t port) { return NetAddress("127.0.0.1", port); }
+
+struct Case {
+  const char* name;
+  std::vector<NetAddress> candidates;
+  int attempt_delay_ms;
+  // 0 if every candidate should fail
+  uint16_t winner_port;
+  // the time to the result should be in [min_ms, max_ms)
+  int min_ms;
+  int max_ms;
+};
+
+bool Run(IoLoop* loop, const Case& c) {
+  MultiConnector connector(loop, c.candidates);
+  connector.SetAttemptDelay(c.attempt_delay_ms);
+  connector.SetRetry(false);
+  connector.EnableConnectTimeout(true);
+  connector.SetConnectTimeout(1000);
+  uint16_t winner_port = 0;
+  connector.SetOnConnect([&](int sock_fd) {
+    winner_port = connector.GetPeerAddress().GetPort();
+    SockUtil::Close_(sock_fd);
+    loop->Quit();
+  });
+  connector.SetOnConnectFailed([loop] { loop->Quit(); });
+  auto start = std::chrono::steady_clock::now();
+  connector.Start();
+  loop->RunForever();
+  int elapsed = (int)std::chrono::duration_cast<std::chrono::milliseconds>(
+                    std::chrono::steady_clock::now() - start)
+                    .count();
+  connector.Stop();
+  bool pass = winner_port == c.winner_port && elapsed >= c.min_ms &&
+              elapsed < c.max_ms;
+  fprintf(stdout, "%-4s %-40s winner %-5d in %4d ms, expected %d in [%d, %d)\n",
+          pass ? "ok" : "FAIL", c.name, winner_port, elapsed, c.winner_port,
+          c.min_ms, c.max_ms);
+  return pass;
+}
+}  // namespace
+
+int main() {
+  Listen(kAnswerPort, 128);
+  for (int i = 0; i < 3; ++i) {
+    ListenSilent(kSilentPort + i);
+  }
+  IoLoop loop;
+  // refused and timed out connects log errors
+  log_set_level(LOG_FATAL);
+  std::vector<Case> cases = {
+      {"answering first, no stagger",
+       {Local(kAnswerPort), Local(kSilentPort)}, 250, kAnswerPort, 0, 100},
+      {"silent then answering, one delay",
+       {Local(kSilentPort), Local(kAnswerPort)}, 250, kAnswerPort, 250, 400},
+      {"two silent then answering, two delays",
+       {Local(kSilentPort), Local(kSilentPort + 1), Local(kAnswerPort)},
+       150, kAnswerPort, 300, 450},
+      {"refused then answering, no wait",
+       {Local(kRefusedPort), Local(kAnswerPort)}, 1000, kAnswerPort, 0, 100},
+      // the last attempt starts after two delays and times out after 1s
+      {"all silent, fails after the last timeout",
+       {Local(kSilentPort), Local(kSilentPort + 1), Local(kSilentPort + 2)},
+       200, 0, 1400, 1600},
+  };
+  bool pass = true;
+  for (const auto& c : cases) {
+    pass &= Run(&loop, c);
+  }
+  return pass ? 0 : 1;
+}
@@ -0,0 +1,131 @@
+//
+// Created by li on 2022/6/8.
+//
+
+// Connect-to-first-byte with and without TCP fast open on loopback.
+// usage: fastopenbench [connections]
+// A client opens connections one after another to an echo TcpServer, sends
+// one byte on each and waits for the echo. Prints the percentiles of the
+// time from connect to the echoed byte, and the TcpExt fast open counters
+// of /proc/net/netstat to show the data rode on the SYN. Needs client and
+// server fast open enabled, net.ipv4.tcp_fastopen = 3.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "tohka/ioloop.h"
+#include "tohka/tcpserver.h"
+#include "tohka/util/log.h"
+
+using namespace tohka;
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+// a TcpExt counter of /proc/net/netstat, a line of names then one of values
+long GetTcpExtCounter(const std::string& name) {
+  std::ifstream netstat("/proc/net/netstat");
+  std::string names;
+  std::string values;
+  while (std::getline(netstat, names) && std::getline(netstat, values)) {
+    if (names.compare(0, 7, "TcpExt:") != 0) {
+      continue;
+    }
+    std::istringstream name_stream(names);
+    std::istringstream value_stream(values);
+    std::string key;
+    std::string value;
+    while (name_stream >> key && value_stream >> value) {
+      if (key == name) {
+        return atol(value.c_str());
+      }
+    }
+  }
+  return -1;
+}
+
+void Run(bool fast_open, uint16_t port, int connections) {
+  std::atomic<bool> listening{false};
+  std::thread server_thread([&] {
+    IoLoop loop;
+    log_set_level(LOG_WARN);
+    TcpServer server(&loop, NetAddress(port));
+    if (fast_open) {
+      server.SetTcpFastOpen(128);
+    }
+    server.SetOnMessage([](const TcpEventPrt_t& conn, IoBuf* buf) {
+      conn->Send(buf);
+    });
+    int closed = 0;
+    server.SetOnConnection([&](const TcpEventPrt_t& conn) {
+      if (!conn->Connected() && ++closed == connections) {
+        loop.Quit();
+      }
+    });
+    server.Run();
+    listening = true;
+    loop.RunForever();
+  });
+  while (!listening) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+  }
+
+  sockaddr_in addr{};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  long active_before = GetTcpExtCounter("TCPFastOpenActive");
+  long passive_before = GetTcpExtCounter("TCPFastOpenPassive");
+  std::vector<double> latencies;
+  latencies.reserve(connections);
+  for (int i = 0; i < connections; ++i) {
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    auto start = Clock::now();
+    if (fast_open) {
+      // the first write goes out with the SYN once a cookie is cached
+      int on = 1;
+      ::setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, &on, sizeof(on));
+    }
+    char byte = 'x';
+    if (::connect(fd, (sockaddr*)&addr, sizeof(addr)) < 0 ||
+        ::write(fd, &byte, 1) != 1 || ::read(fd, &byte, 1) != 1) {
+      perror("request");
+      exit(1);
+    }
+    std::chrono::duration<double, std::micro> elapsed = Clock::now() - start;
+    latencies.push_back(elapsed.count());
+    ::close(fd);
+  }
+  server_thread.join();
+
+  std::sort(latencies.begin(), latencies.end());
+  fprintf(stdout,
+          "%-9s connect-to-first-byte p50 %.1fus p99 %.1fus, fast open "
+          "active %ld passive %ld\n",
+          fast_open ? "fast open" : "plain", latencies[latencies.size() / 2],
+          latencies[latencies.size() * 99 / 100],
+          GetTcpExtCounter("TCPFastOpenActive") - active_before,
+          GetTcpExtCounter("TCPFastOpenPassive") - passive_before);
+}
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  int connections = argc > 1 ? atoi(argv[1]) : 2000;
+  fprintf(stdout, "%d sequential connect+send+echo\n", connections);
+  Run(false, 23484, connections);
+  Run(true, 23485, connections);
+  return 0;
+}
@@ -0,0 +1,172 @@
+//
+// Created by li on 2022/7/4.
+//
+
+// Throughput of the logging paths.
+// usage: logbench [file] [lines per thread] [threads]
+// Logs typical accept lines to file (/dev/null by default) once through the
+// synchronous path and once through the asynchronous one, and prints the
+// lines per second of each. Then times a hot path with a trace statement
+// that is disabled at runtime, against the same path without it and with
+// the statement calling log_log unconditionally as it used to. Last the
+// cost of one binary record against one asynchronous text line.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <time.h>
+#include <unistd.h>
+
+#include "tohka/util/binlog.h"
+#include "tohka/util/log.h"
+
+using namespace tohka;
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+void LogLines(int lines) {
+  for (int i = 0; i < lines; ++i) {
+    log_info("[Acceptor::OnAccept]->accept a new connection from %s:%d fd=%d",
+             "192.168.1.100", 40000 + (i & 0x3fff), i & 0xffff);
+  }
+}
+
+double Run(int lines, int threads) {
+  auto start = Clock::now();
+  std::vector<std::thread> workers;
+  for (int i = 0; i < threads; ++i) {
+    workers.emplace_back(LogLines, lines);
+  }
+  for (auto& worker : workers) {
+    worker.join();
+  }
+  std::chrono::duration<double> elapsed = Clock::now() - start;
+  return elapsed.count();
+}
+
+volatile int g_sink;
+
+// stands in for IoEvent::ExecuteEvent
+enum TraceMode { kNoTrace, kTrace, kAlwaysCall };
+template <TraceMode mode>
+__attribute__((noinline)) void HotPath(int fd, int events, int revents) {
+  if (mode == kTrace) {
+    log_trace("fd = %d IoEvent::ExecuteEvent() events=0x%x revents=0x%x", fd,
+              events, revents);
+  } else if (mode == kAlwaysCall) {
+    log_log(LOG_TRACE, __FILE__, __LINE__,
+            "fd = %d IoEvent::ExecuteEvent() events=0x%x revents=0x%x", fd,
+            events, revents);
+  }
+  g_sink = g_sink + (events & revents);
+}
+
+template <TraceMode mode>
+double RunHotPath(int iterations) {
+  auto start = Clock::now();
+  for (int i = 0; i < iterations; ++i) {
+    HotPath<mode>(i & 0xffff, 1, i & 3);
+  }
+  std::chrono::duration<double, std::nano> elapsed = Clock::now() - start;
+  return elapsed.count() / iterations;
+}
+
+// cpu time of the calling thread, the writer may share its core
+double GetThreadCpuNs() {
+  timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+double RunBinLog(int iterations) {
+  double start = GetThreadCpuNs();
+  for (int i = 0; i < iterations; ++i) {
+    binlog_trace("fd = %d IoEvent::ExecuteEvent() events=0x%x revents=0x%x",
+                 i & 0xffff, 1, i & 3);
+  }
+  return (GetThreadCpuNs() - start) / iterations;
+}
+
+double RunAsyncLog(int iterations) {
+  double start = GetThreadCpuNs();
+  for (int i = 0; i < iterations; ++i) {
+    log_info("fd = %d IoEvent::ExecuteEvent() events=0x%x revents=0x%x",
+             i & 0xffff, 1, i & 3);
+  }
+  return (GetThreadCpuNs() - start) / iterations;
+}
+
+void Report(const char* name, int lines, int threads, double seconds) {
+  fprintf(stdout, "%-12s threads=%d lines=%d %.3fs %.0f lines/s\n", name,
+          threads, lines * threads, seconds, lines * threads / seconds);
+}
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  const char* path = argc > 1 ? argv[1] : "/dev/null";
+  int lines = argc > 2 ? atoi(argv[2]) : 1000000;
+  int threads = argc > 3 ? atoi(argv[3]) : 1;
+
+  FILE* fp = fopen(path, "w");
+  if (fp == nullptr) {
+    perror("fopen");
+    return 1;
+  }
+
+  // the synchronous path writes to stderr
+  FILE* saved = fdopen(dup(fileno(stderr)), "w");
+  freopen(path, "w", stderr);
+  log_set_lock(
+      [](bool lock, void* udata) {
+        static std::mutex mutex;
+        lock ? mutex.lock() : mutex.unlock();
+      },
+      nullptr);
+  double sync_seconds = Run(lines, threads);
+
+  log_start_async(fp, 1 << 20, LOG_FULL_BLOCK);
+  double async_seconds = Run(lines, threads);
+  log_stop_async();
+
+  log_start_async(fp, 1 << 20, LOG_FULL_DROP);
+  double drop_seconds = Run(lines, threads);
+  log_stop_async();
+
+  dup2(fileno(saved), fileno(stderr));
+  Report("sync", lines, threads, sync_seconds);
+  Report("async block", lines, threads, async_seconds);
+  Report("async drop", lines, threads, drop_seconds);
+  fprintf(stdout, "dropped %llu\n", log_get_dropped());
+
+  log_set_level(LOG_INFO);
+  int iterations = lines * 10;
+  fprintf(stdout, "hot path, trace disabled at runtime (LOG_LEVEL_MIN=%d)\n",
+          LOG_LEVEL_MIN);
+  fprintf(stdout, "%-12s %.2f ns\n", "no trace",
+          RunHotPath<kNoTrace>(iterations));
+  fprintf(stdout, "%-12s %.2f ns\n", "log_trace",
+          RunHotPath<kTrace>(iterations));
+  fprintf(stdout, "%-12s %.2f ns\n", "log_log",
+          RunHotPath<kAlwaysCall>(iterations));
+
+  // cpu time of the call site, not of the writer
+  fprintf(stdout, "per record\n");
+  log_start_async(fp, 16 << 20, LOG_FULL_DROP);
+  RunAsyncLog(1);
+  fprintf(stdout, "%-12s %.2f ns\n", "async text", RunAsyncLog(lines));
+  log_stop_async();
+  BinLog::Start(fp, 16 << 20, false);
+  // the first record sets up the ring of the thread
+  RunBinLog(1);
+  fprintf(stdout, "%-12s %.2f ns\n", "binary", RunBinLog(lines));
+  BinLog::Stop();
+  fprintf(stdout, "dropped %llu %llu\n", log_get_dropped(),
+          (unsigned long long)BinLog::GetDropped());
+  fclose(fp);
+  return 0;
+}
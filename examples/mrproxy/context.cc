@@ -4,3 +4,27 @@
 
 #include "context.h"
 
+void InHandler::LoadLimit(const nlohmann::json& j) {
+  if (!j.contains("limit")) {
+    return;
+  }
+  const auto& limit = j["limit"];
+  rate_ = limit.value("rate", 0.0);
+  burst_ = limit.value("burst", rate_);
+  double total_rate = limit.value("total_rate", 0.0);
+  if (total_rate > 0) {
+    double total_burst = limit.value("total_burst", total_rate);
+    total_read_ = make_shared<RateLimiter>(total_rate, total_burst);
+    total_write_ = make_shared<RateLimiter>(total_rate, total_burst);
+  }
+}
+void InHandler::ApplyLimit(const TcpEventPrt_t& conn) {
+  if (rate_ > 0) {
+    conn->SetReadLimiter(make_shared<RateLimiter>(rate_, burst_, total_read_));
+    conn->SetWriteLimiter(
+        make_shared<RateLimiter>(rate_, burst_, total_write_));
+  } else if (total_read_) {
+    conn->SetReadLimiter(total_read_);
+    conn->SetWriteLimiter(total_write_);
+  }
+}
@@ -4,8 +4,10 @@
 
 #ifndef TOHKA_EXAMPLES_MRPROXY_CONTEXT_H
 #define TOHKA_EXAMPLES_MRPROXY_CONTEXT_H
+#include "json.hpp"
 #include "map"
 #include "tohka/iobuf.h"
+#include "tohka/ratelimiter.h"
 #include "tohka/tcpevent.h"
 using namespace std;
 using namespace tohka;
@@ -23,6 +25,19 @@ class InHandler {
   virtual ~InHandler() = default;
   virtual void StartServer() = 0;
   virtual void Process(const ContextPtr_t& ctx) = 0;
+
+ protected:
+  // "limit": {"rate": bytes/s, "burst": bytes} of each connection, and
+  // "total_rate" of all connections of this handler, per direction
+  void LoadLimit(const nlohmann::json& j);
+  // apply the limits to an accepted connection
+  void ApplyLimit(const TcpEventPrt_t& conn);
+
+ private:
+  double rate_ = 0;
+  double burst_ = 0;
+  RateLimiterPtr_t total_read_;
+  RateLimiterPtr_t total_write_;
 };
 
 class OutHandler {
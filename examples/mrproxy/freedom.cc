@@ -16,6 +16,9 @@ void FreeDom::on_connection(const TcpEventPrt_t& conn) {
     //    ctx_->out_handler = shared_from_this();
 
     if (ctx_->in) {
+      // 两个方向做流控
+      Pipe(ctx_->in, conn);
+      Pipe(conn, ctx_->in);
       // in结点开启读事件
       ctx_->in->StartReading();
       if (ctx_->in->GetInputBuf()->GetReadableSize() > 0) {
@@ -4,15 +4,24 @@
 
 #include "run_in.h"
 
-#include "netdb.h"
 #include "tohka/ioloop.h"
+#include "tohka/resolver.h"
 RunIn::RunIn(const json& j) {
   std::string listen_addr = j["listen"];
   int port = j["port"];
   server_ =
       make_unique<TcpServer>(IoLoop::GetLoop(), NetAddress(listen_addr, port));
   log_info("listen on %s:%d", listen_addr.c_str(), port);
+  if (j.value("fast_open", false)) {
+    server_->SetTcpFastOpen(128);
+  }
+  // seconds a connection may wait for its first data before it is accepted
+  int defer_accept = j.value("defer_accept", 0);
+  if (defer_accept > 0) {
+    server_->SetDeferAccept(defer_accept);
+  }
 
+  LoadLimit(j);
   server_->SetOnConnection(
       [this](const TcpEventPrt_t& conn) { on_connection(conn); });
   server_->SetOnMessage(
@@ -24,6 +33,7 @@ void RunIn::on_connection(const TcpEventPrt_t& conn) {
     auto ctx = std::make_shared<Context>();
     ctx->in = conn;
     ctx->in_handler = this;
+    ApplyLimit(conn);
 
     auto name = conn->GetName();
     ctx_map_.emplace(name, ctx);
@@ -59,48 +69,79 @@ void RunIn::on_recv(const TcpEventPrt_t& conn, IoBuf* buf) {
       sockaddr_in client{};
       memset(&client, 0, sizeof(client));
       // 解析cmd
-      if (buffer[0] == 0x01) {
+      // cmd atyp, then the address and the port in the last two bytes
+      if (len >= 2 && buffer[0] == 0x01) {
+        uint16_t port = 0;
         switch (buffer[1]) {
           case 0x01:
             log_info("ipv4");
+            if (len < 8) {
+              conn->ShutDown();
+              return;
+            }
             client.sin_family = AF_INET;
             memcpy(&client.sin_addr.s_addr, buffer + 2, 4);
+            // parse port
+            port = ((uint16_t)buffer[len - 2]) << 8 | buffer[len - 1];
             break;
           case 0x03: {
             log_info("domain");
-            int domain_size = (int)buffer[4];
             char domain[64] = {0};
+            size_t domain_size = len < 5 ? 0 : buffer[4];
+            if (domain_size == 0 || domain_size >= sizeof(domain) ||
+                len < 5 + domain_size + 2) {
+              conn->ShutDown();
+              return;
+            }
             memcpy(domain, buffer + 5, domain_size);
-            // TODO async dns
-            auto host = gethostbyname(domain);
-            client.sin_family = AF_INET;
-            assert(host->h_addrtype == AF_INET);
-            memcpy(&client.sin_addr.s_addr, host->h_addr_list[0],
-                   host->h_length);
-          } break;
+            // parse port
+            port = ((uint16_t)buffer[len - 2]) << 8 | buffer[len - 1];
+            if (port == 0) {
+              conn->ShutDown();
+              return;
+            }
+            // data the client sends meanwhile stays in the input buffer
+            conn->SetContext(kResolving);
+            std::weak_ptr<TcpEvent> weak_conn(conn);
+            IoLoop::GetLoop()->GetResolver()->Resolve(
+                domain, [this, weak_conn, port](
+                            const std::vector<NetAddress>& addresses) {
+                  auto conn = weak_conn.lock();
+                  if (!conn || !conn->Connected()) {
+                    return;
+                  }
+                  if (addresses.empty()) {
+                    conn->ShutDown();
+                    return;
+                  }
+                  // not every host running mrproxy has an IPv6 route
+                  auto it = std::find_if(addresses.begin(), addresses.end(),
+                                         [](const NetAddress& a) {
+                                           return a.GetFamily() == AF_INET;
+                                         });
+                  NetAddress addr =
+                      it != addresses.end() ? *it : addresses[0];
+                  addr.SetPort(port);
+                  start_out(conn, addr);
+                });
+            return;
+          }
           case 0x04:
             log_warn("not support ipv6");
             conn->ShutDown();
             return;
-            break;
+          default:
+            conn->ShutDown();
+            return;
+        }
+        if (port == 0) {
+          conn->ShutDown();
+          return;
         }
 
         char ip[16];
         inet_ntop(AF_INET, &client.sin_addr, ip, 16);
-        // parse port
-        uint16_t port = ((uint16_t)buffer[len - 2]) << 8 | buffer[len - 1];
-        assert(port > 0);
-        log_info("runin get ip = %s port = %d", ip, port);
-        auto ctx = ctx_map_[conn->GetName()];
-        ctx->addr = NetAddress(ip, port);
-
-        // 根据配置创建不同的对象
-        auto out_handler = OutCreate(ctx);
-        ctx->out_handler = out_handler;
-
-        out_handler->StartClient();
-
-        conn->SetContext(kTransfer);
+        start_out(conn, NetAddress(ip, port));
       } else if (buffer[0] == 0x03) {
         // udp
         log_warn("no support udp now");
@@ -113,6 +154,8 @@ void RunIn::on_recv(const TcpEventPrt_t& conn, IoBuf* buf) {
       return;
     }
 
+  } else if (state_ == kResolving) {
+    log_debug("resolving, keep data in buffer fd = %d", conn->GetFd());
   } else if (state_ == kTransfer) {
     assert(ctx_map_.find(conn->GetName()) != ctx_map_.end());
     auto& ctx = ctx_map_[conn->GetName()];
@@ -125,6 +168,19 @@ void RunIn::on_recv(const TcpEventPrt_t& conn, IoBuf* buf) {
   }
   // 连接目标地址
 }
+void RunIn::start_out(const TcpEventPrt_t& conn, const NetAddress& addr) {
+  log_info("runin get addr = %s", addr.GetIpAndPort().c_str());
+  auto ctx = ctx_map_[conn->GetName()];
+  ctx->addr = addr;
+
+  // 根据配置创建不同的对象
+  auto out_handler = OutCreate(ctx);
+  ctx->out_handler = out_handler;
+
+  out_handler->StartClient();
+
+  conn->SetContext(kTransfer);
+}
 void RunIn::StartServer() {
   server_->Run();
   IoLoop::GetLoop()->RunForever();
@@ -14,6 +14,9 @@ void RunOut::on_connection(const TcpEventPrt_t& conn) {
     // 注册conn到ctx中
     ctx_->out = conn;
     if (ctx_->in) {
+      // 两个方向做流控
+      Pipe(ctx_->in, conn);
+      Pipe(conn, ctx_->in);
       // in结点开启读事件
       ctx_->in->StartReading();
       if (ctx_->in->GetInputBuf()->GetReadableSize() > 0) {
@@ -97,6 +100,8 @@ RunOut::RunOut(const ContextPtr_t& ctx, const json& j) {
 
   NetAddress addr{address,port};
   client_ = std::make_unique<TcpClient>(IoLoop::GetLoop(), addr, "None");
+  // 请求头和第一块数据随SYN一起发送
+  client_->EnableFastOpen(j.value("fast_open", false));
 }
 void RunOut::DisConnected() {
   if (ctx_) {
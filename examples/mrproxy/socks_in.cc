@@ -4,13 +4,14 @@
 
 #include "socks_in.h"
 #include "point.h"
-#include "netdb.h"
 #include "tohka/ioloop.h"
+#include "tohka/resolver.h"
 SocksIn::SocksIn(const json& j) {
   std::string listen_addr = j["listen"];
   int port = j["port"];
   server_ = make_unique<TcpServer>(IoLoop::GetLoop(), NetAddress(listen_addr,port));
   log_info("listen on %s:%d",listen_addr.c_str(),port);
+  LoadLimit(j);
   server_->SetOnConnection(
       [this](const TcpEventPrt_t& conn) { on_connection(conn); });
   server_->SetOnMessage(
@@ -22,6 +23,7 @@ void SocksIn::on_connection(const TcpEventPrt_t& conn) {
     auto ctx = std::make_shared<Context>();
     ctx->in = conn;
     ctx->in_handler = this;
+    ApplyLimit(conn);
 
     auto name = conn->GetName();
     ctx_map_.emplace(name, ctx);
@@ -62,69 +64,98 @@ void SocksIn::on_recv(const TcpEventPrt_t& conn, IoBuf* buf) {
     memset(&client, 0, sizeof(client));
     unsigned char buffer[64] = {0};
     size_t len = buf->Read(buffer, 64);
-    if (buffer[0] == 0x05) {
-      // parse cmd
-      switch (buffer[1]) {
-        case 0x01:
-          log_info("connected");
-          break;
-        case 0x02:
-          log_info("Bind");
-          break;
-        case 0x03:
-          log_info("UDP");
-          break;
+    // ver cmd rsv atyp, then the address and the port
+    if (len < 4 || buffer[0] != 0x05) {
+      conn->ShutDown();
+      return;
+    }
+    // parse cmd
+    switch (buffer[1]) {
+      case 0x01:
+        log_info("connected");
+        break;
+      case 0x02:
+        log_info("Bind");
+        break;
+      case 0x03:
+        log_info("UDP");
+        break;
+    }
+    // parse atyp
+    switch (buffer[3]) {
+      case 0x01: {
+        log_info("ipv4");
+        if (len < 10) {
+          conn->ShutDown();
+          return;
+        }
+        client.sin_family = AF_INET;
+        memcpy(&client.sin_addr.s_addr, buffer + 4, 4);
+        // parse port
+        uint16_t port = ((uint16_t)buffer[8]) << 8 | buffer[9];
+        if (port == 0) {
+          conn->ShutDown();
+          return;
+        }
+        char ip[16];
+        inet_ntop(AF_INET, &client.sin_addr, ip, 16);
+        start_out(conn, NetAddress(ip, port));
+        return;
       }
-      // parse atyp
-      switch (buffer[3]) {
-        case 0x01:
-          log_info("ipv4");
-          client.sin_family = AF_INET;
-          memcpy(&client.sin_addr.s_addr, buffer + 4, 4);
-          break;
-        case 0x03: {
-          log_info("domain");
-          int domain_size = (int)buffer[4];
-          char domain[64] = {0};
-          memcpy(domain, buffer + 5, domain_size);
-          // TODO async dns
-          auto host = gethostbyname(domain);
-          client.sin_family = AF_INET;
-          assert(host->h_addrtype == AF_INET);
-          memcpy(&client.sin_addr.s_addr, host->h_addr_list[0], host->h_length);
-        } break;
-        case 0x04:
-          log_warn("not support ipv6");
+      case 0x03: {
+        log_info("domain");
+        size_t domain_size = len < 5 ? 0 : buffer[4];
+        if (domain_size == 0 || len < 5 + domain_size + 2) {
+          conn->ShutDown();
+          return;
+        }
+        char domain[64] = {0};
+        memcpy(domain, buffer + 5, domain_size);
+        // parse port
+        uint16_t port = ((uint16_t)buffer[5 + domain_size]) << 8 |
+                        buffer[5 + domain_size + 1];
+        if (port == 0) {
           conn->ShutDown();
           return;
-          break;
+        }
+        // data the client sends meanwhile stays in the input buffer
+        conn->SetContext(kResolving);
+        std::weak_ptr<TcpEvent> weak_conn(conn);
+        IoLoop::GetLoop()->GetResolver()->Resolve(
+            domain, [this, weak_conn, port](
+                        const std::vector<NetAddress>& addresses) {
+              auto conn = weak_conn.lock();
+              if (!conn || !conn->Connected()) {
+                return;
+              }
+              if (addresses.empty()) {
+                // host unreachable
+                char resp[] = {0x05, 0x04, 0x00, 0x01, 0x00,
+                               0x00, 0x00, 0x00, 0x00, 0x00};
+                conn->Send(resp, 10);
+                conn->ShutDown();
+                return;
+              }
+              // not every host running mrproxy has an IPv6 route
+              auto it = std::find_if(
+                  addresses.begin(), addresses.end(),
+                  [](const NetAddress& a) { return a.GetFamily() == AF_INET; });
+              NetAddress addr = it != addresses.end() ? *it : addresses[0];
+              addr.SetPort(port);
+              start_out(conn, addr);
+            });
+        return;
       }
+      case 0x04:
+        log_warn("not support ipv6");
+        conn->ShutDown();
+        return;
+      default:
+        conn->ShutDown();
+        return;
     }
-    char ip[16];
-    inet_ntop(AF_INET, &client.sin_addr, ip, 16);
-    // parse port
-    uint16_t port = ((uint16_t)buffer[len - 2]) << 8 | buffer[len - 1];
-    assert(port > 0);
-    log_info("socks5 get ip = %s port = %d", ip, port);
-    //    addr = {ip, port};
-    char resp[] = {0x05, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
-    conn->Send(resp, 10);
-
-    // conn->StopReading();
-    auto ctx = ctx_map_[conn->GetName()];
-    // 注入地址
-    ctx->addr = NetAddress(ip, port);
-    // ctx->addr = NetAddress("8.8.8.8", 443);
-    // ctx->addr = NetAddress("127.0.0.1", 6666);
-    //     ctx->addr = NetAddress("127.0.0.1", 6667);
-    //     ctx->addr = NetAddress("220.181.38.149", 80);
-    // 根据配置创建不同的对象
-    auto out_handler = OutCreate(ctx);
-    ctx->out_handler = out_handler;
-
-    out_handler->StartClient();
-
-    conn->SetContext(kTransfer);
+  } else if (state_ == kResolving) {
+    log_debug("resolving, keep data in buffer fd = %d", conn->GetFd());
   } else if (state_ == kTransfer) {
     assert(ctx_map_.find(conn->GetName()) != ctx_map_.end());
     auto& ctx = ctx_map_[conn->GetName()];
@@ -136,6 +167,23 @@ void SocksIn::on_recv(const TcpEventPrt_t& conn, IoBuf* buf) {
     }
   }
 }
+void SocksIn::start_out(const TcpEventPrt_t& conn, const NetAddress& addr) {
+  log_info("socks5 get addr = %s", addr.GetIpAndPort().c_str());
+  char resp[] = {0x05, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+  conn->Send(resp, 10);
+
+  // conn->StopReading();
+  auto ctx = ctx_map_[conn->GetName()];
+  // 注入地址
+  ctx->addr = addr;
+  // 根据配置创建不同的对象
+  auto out_handler = OutCreate(ctx);
+  ctx->out_handler = out_handler;
+
+  out_handler->StartClient();
+
+  conn->SetContext(kTransfer);
+}
 void SocksIn::StartServer() {
   server_->Run();
   log_info("listen at 7777");
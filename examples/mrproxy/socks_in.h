@@ -22,10 +22,12 @@ class SocksIn : public InHandler {
  private:
   void on_connection(const TcpEventPrt_t& conn);
   void on_recv(const TcpEventPrt_t& conn, IoBuf* buf);
+  // reply success and connect the out side
+  void start_out(const TcpEventPrt_t& conn, const NetAddress& addr);
   using TcpServerPrt_t = std::unique_ptr<TcpServer>;
   TcpServerPrt_t server_;
   std::map<string, ContextPtr_t> ctx_map_;
-  enum State { kClientAuth, KClientConnected, kTransfer };
+  enum State { kClientAuth, KClientConnected, kResolving, kTransfer };
 };
 
 #endif  // TOHKA_EXAMPLES_MRPROXY_SOCKS_IN_H
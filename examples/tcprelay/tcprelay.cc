@@ -2,28 +2,34 @@
 // Created by li on 2022/3/21.
 //
 
+#include <fstream>
 #include <iostream>
 #include <memory>
 
 #include "tohka/ioloop.h"
+#include "tohka/metricsserver.h"
 #include "tohka/netaddress.h"
 #include "tohka/tcpclient.h"
 #include "tohka/tcpserver.h"
+#include "examples/mrproxy/json.hpp"
+#include "tohka/upstreamgroup.h"
 #include "tohka/util/log.h"
 #include "tunnel.h"
 using namespace tohka;
 using namespace std;
 using namespace std::placeholders;
+using json = nlohmann::json;
 
-NetAddress* g_server_addr;
+UpstreamGroup* g_upstreams;
+// null when not mirroring
+MirrorOptions* g_mirror;
 std::map<string, TunnelPtr> g_tunnels;
 
 void onServerConnection(const TcpEventPrt_t& conn) {
   log_debug(conn->Connected() ? "client UP" : "client DOWN");
   if (conn->Connected()) {
     conn->StopReading();
-    TunnelPtr tunnel(new Tunnel(IoLoop::GetLoop(), *g_server_addr, conn));
-    tunnel->setup();
+    TunnelPtr tunnel(new Tunnel(IoLoop::GetLoop(), g_upstreams, conn, g_mirror));
     tunnel->connect();
     g_tunnels[conn->GetName()] = tunnel;
   } else {
@@ -37,24 +43,100 @@ void onServerConnection(const TcpEventPrt_t& conn) {
 void onServerMessage(const TcpEventPrt_t& conn, IoBuf* buf) {
   log_debug("onServerMessage %d", buf->GetReadableSize());
   if (conn->GetContext().has_value()) {
-    const auto& clientConn =
-        std::any_cast<const TcpEventPrt_t&>(conn->GetContext());
-    clientConn->Send(buf);
+    const auto& tunnel = std::any_cast<const TunnelPtr&>(conn->GetContext());
+    tunnel->onServerMessage(buf);
   }
 }
 
-int main() {
+UpstreamGroup::Policy parsePolicy(const string& name) {
+  if (name == "least_connections") {
+    return UpstreamGroup::kLeastConnections;
+  }
+  if (name == "maglev") {
+    return UpstreamGroup::kMaglev;
+  }
+  return UpstreamGroup::kRoundRobin;
+}
+
+// tcprelay [config.json], see tcprelay.json. Without a config it relays
+// port 2000 to 127.0.0.1:8080.
+int main(int argc, char* argv[]) {
+  json conf = json::object();
+  if (argc >= 2) {
+    std::ifstream i(argv[1]);
+    if (!i) {
+      fprintf(stderr, "no such file %s!\n", argv[1]);
+      return 1;
+    }
+    i >> conf;
+  }
+  if (conf.contains("log")) {
+    const auto& log_conf = conf["log"];
+    string path = log_conf["file"].get<string>();
+    if (log_start_async_file(
+            path.c_str(), log_conf.value("max_size", 64 * 1024 * 1024),
+            log_conf.value("rotate_interval", 0),
+            log_conf.value("max_files", 5), 1024 * 1024, LOG_FULL_DROP) < 0) {
+      fprintf(stderr, "can not open log file %s!\n", path.c_str());
+      return 1;
+    }
+  }
   IoLoop* loop = IoLoop::GetLoop();
-  NetAddress serverAddr("127.0.0.1", 8080);
-  g_server_addr = &serverAddr;
-  NetAddress listen_addr(2000);
+  UpstreamGroup upstreams(loop,
+                          parsePolicy(conf.value("policy", "round_robin")));
+  g_upstreams = &upstreams;
+  if (conf.contains("upstreams")) {
+    for (const auto& upstream : conf["upstreams"]) {
+      upstreams.AddUpstream(NetAddress(upstream["ip"].get<string>(),
+                                       upstream["port"].get<uint16_t>()));
+    }
+  } else {
+    upstreams.AddUpstream(NetAddress("127.0.0.1", 8080));
+  }
+  if (conf.contains("outlier")) {
+    const auto& outlier = conf["outlier"];
+    upstreams.SetOutlierDetection(outlier.value("consecutive_failures", 5),
+                                  outlier.value("ejection_time", 30000),
+                                  outlier.value("max_ejection_percent", 50));
+  }
+  if (conf.contains("health_check")) {
+    const auto& check = conf["health_check"];
+    upstreams.EnableHealthCheck(
+        check.value("interval", 5000), check.value("timeout", 1000),
+        check.value("rise", 2), check.value("fall", 3));
+  }
+  MirrorOptions mirror;
+  if (conf.contains("mirror")) {
+    const auto& mirror_conf = conf["mirror"];
+    mirror.address = NetAddress(mirror_conf["ip"].get<string>(),
+                                mirror_conf["port"].get<uint16_t>());
+    mirror.maxBuffer = mirror_conf.value("max_buffer", mirror.maxBuffer);
+    mirror.dropOnOverflow =
+        mirror_conf.value("on_overflow", "disconnect") == "drop";
+    g_mirror = &mirror;
+    log_info("mirror to %s", mirror.address.GetIpAndPort().c_str());
+  }
+  NetAddress listen_addr(conf.value("listen", "0.0.0.0"),
+                         conf.value("port", 2000));
   log_set_level(LOG_INFO);
-  log_info("start at %s", listen_addr.GetIpAndPort().c_str());
+  log_info("start at %s, %zu upstreams", listen_addr.GetIpAndPort().c_str(),
+           upstreams.Size());
   TcpServer server(loop, listen_addr);
 
   server.SetOnConnection(onServerConnection);
   server.SetOnMessage(onServerMessage);
+  // rtt and retransmits of the client connections, scraped with the metrics
+  server.SetTcpInfoSampling(conf.value("tcp_info_interval", 0));
 
   server.Run();
+  std::unique_ptr<MetricsServer> metrics;
+  if (conf.contains("metrics")) {
+    const auto& metrics_conf = conf["metrics"];
+    NetAddress metrics_addr(metrics_conf.value("ip", "127.0.0.1"),
+                            metrics_conf["port"].get<uint16_t>());
+    metrics = std::make_unique<MetricsServer>(loop, metrics_addr);
+    metrics->Run();
+    log_info("metrics at %s/metrics", metrics_addr.GetIpAndPort().c_str());
+  }
   loop->RunForever();
 }
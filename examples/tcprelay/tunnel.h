@@ -13,56 +13,146 @@
 #include "tohka/noncopyable.h"
 #include "tohka/tcpclient.h"
 #include "tohka/tcpevent.h"
+#include "tohka/upstreamgroup.h"
 #include "tohka/util/log.h"
 using namespace tohka;
 using namespace std;
 using namespace std::placeholders;
 
+// shadow backend that gets a copy of the client data, its answers are
+// dropped
+struct MirrorOptions {
+  NetAddress address;
+  // output of the mirror connection allowed before it counts as behind
+  size_t maxBuffer = 4 * 1024 * 1024;
+  // a mirror that is behind loses data, or is disconnected
+  bool dropOnOverflow = false;
+};
+
 class Tunnel : public std::enable_shared_from_this<Tunnel> {
  public:
-  Tunnel(IoLoop* loop, const NetAddress& serverAddr,
-         const TcpEventPrt_t& serverConn)
-      : client_(loop, serverAddr, serverConn->GetName()),
-        serverConn_(serverConn) {
-    log_info("Tunnel %s <-> %s client fd = %d", serverConn->GetPeerIpAndPort().c_str(),
-             serverAddr.GetIpAndPort().c_str(),serverConn->GetFd());
-  }
+  Tunnel(IoLoop* loop, UpstreamGroup* group, const TcpEventPrt_t& serverConn,
+         const MirrorOptions* mirror = nullptr)
+      : loop_(loop),
+        group_(group),
+        upstream_(UpstreamGroup::kNone),
+        tries_(0),
+        serverConn_(serverConn),
+        mirrorOptions_(mirror),
+        mirrorPendingSize_(0),
+        mirrorDropped_(0),
+        mirrorFailed_(false) {}
 
-  ~Tunnel() { log_info("~Tunnel"); }
+  ~Tunnel() {
+    log_info("~Tunnel");
+    releaseUpstream();
+  }
 
-  void setup() {
-    client_.SetOnConnection(
+  // pick an upstream and connect to it, another one is tried when it fails
+  void connect() {
+    upstream_ = group_->Acquire(
+        UpstreamGroup::HashAddress(serverConn_->GetPeerAddress()));
+    if (upstream_ == UpstreamGroup::kNone) {
+      teardown();
+      return;
+    }
+    const NetAddress& serverAddr = group_->GetAddress(upstream_);
+    log_info("Tunnel %s <-> %s client fd = %d",
+             serverConn_->GetPeerIpAndPort().c_str(),
+             serverAddr.GetIpAndPort().c_str(), serverConn_->GetFd());
+    client_ =
+        std::make_unique<TcpClient>(loop_, serverAddr, serverConn_->GetName());
+    client_->EnableConnectTimeout(true);
+    client_->SetConnectTimeout(kConnectTimeoutMs);
+    client_->SetOnConnection(
         std::bind(&Tunnel::onClientConnection, shared_from_this(), _1));
-    client_.SetOnMessage(
+    client_->SetOnMessage(
         std::bind(&Tunnel::onClientMessage, shared_from_this(), _1, _2));
+    client_->SetOnConnectFailed(
+        std::bind(&Tunnel::onConnectFailed, shared_from_this()));
+    client_->Connect();
   }
 
-  void connect() { client_.Connect(); }
-
   void disconnect() {
-    client_.Disconnect();
+    if (clientConn_) {
+      client_->Disconnect();
+    } else if (client_) {
+      // still connecting
+      client_->Stop();
+      teardown();
+    }
     // serverConn_.reset();
   }
 
+  // data from the client, for the upstream and the mirror
+  void onServerMessage(IoBuf* buf) {
+    if (!mirror_ || mirrorFailed_) {
+      clientConn_->Send(buf);
+      return;
+    }
+    // one copy shared by both connections
+    auto data = std::make_shared<const std::string>(buf->ReceiveAllAsString());
+    clientConn_->Send(data);
+    mirrorSend(data);
+  }
+
  private:
   void teardown() {
-    client_.SetOnConnection(DefaultOnConnection);
-    client_.SetOnMessage(DefaultOnMessage);
+    stopMirror();
+    if (client_) {
+      client_->SetOnConnection(DefaultOnConnection);
+      client_->SetOnMessage(DefaultOnMessage);
+      client_->SetOnConnectFailed(nullptr);
+    }
     if (serverConn_) {
       serverConn_->SetContext(any());
       serverConn_->ShutDown();
     }
     clientConn_.reset();
+    releaseUpstream();
+  }
+
+  void releaseUpstream() {
+    if (upstream_ != UpstreamGroup::kNone) {
+      group_->Release(upstream_);
+      upstream_ = UpstreamGroup::kNone;
+    }
+  }
+
+  void onConnectFailed() {
+    // we are inside the connector of client_, replace it later
+    loop_->CallSoon(std::bind(&Tunnel::retry, shared_from_this()));
+  }
+
+  void retry() {
+    if (upstream_ == UpstreamGroup::kNone) {
+      return;
+    }
+    log_warn("connect %s failed",
+             group_->GetAddress(upstream_).GetIpAndPort().c_str());
+    group_->ReportConnectFailure(upstream_);
+    releaseUpstream();
+    if (serverConn_->Connected() && ++tries_ < kMaxTries) {
+      connect();
+    } else {
+      teardown();
+    }
   }
 
   void onClientConnection(const TcpEventPrt_t& conn) {
     log_debug(conn->Connected() ? "server UP" : "server DOWN");
     if (conn->Connected()) {
-      serverConn_->SetContext(conn);
+      group_->ReportConnectSuccess(upstream_);
+      serverConn_->SetContext(shared_from_this());
+      // bound the memory of each direction when one peer is slower, the
+      // mirror is never waited for
+      Pipe(serverConn_, conn);
+      Pipe(conn, serverConn_);
       serverConn_->StartReading();
       clientConn_ = conn;
+      startMirror();
       if (serverConn_->GetInputBuf()->GetReadableSize() > 0) {
-        conn->Send(serverConn_->GetInputBuf());
+        onServerMessage(serverConn_->GetInputBuf());
       }
     } else {
       teardown();
@@ -80,12 +170,144 @@ class Tunnel : public std::enable_shared_from_this<Tunnel> {
     }
   }
 
+  void startMirror() {
+    if (!mirrorOptions_) {
+      return;
+    }
+    mirror_ = std::make_shared<TcpClient>(loop_, mirrorOptions_->address,
+                                          serverConn_->GetName() + "-mirror");
+    mirror_->EnableConnectTimeout(true);
+    mirror_->SetConnectTimeout(kConnectTimeoutMs);
+    std::weak_ptr<Tunnel> weakSelf(shared_from_this());
+    mirror_->SetOnConnection([weakSelf](const TcpEventPrt_t& conn) {
+      if (auto self = weakSelf.lock()) {
+        self->onMirrorConnection(conn);
+      }
+    });
+    mirror_->SetOnMessage(
+        [](const TcpEventPrt_t& conn, IoBuf* buf) { buf->Refresh(); });
+    mirror_->SetOnConnectFailed([weakSelf] {
+      if (auto self = weakSelf.lock()) {
+        log_warn("mirror connect failed, not mirroring %s",
+                 self->serverConn_->GetName().c_str());
+        self->mirrorPending_.clear();
+        self->mirrorPendingSize_ = 0;
+        self->mirrorFailed_ = true;
+      }
+    });
+    mirror_->Connect();
+  }
+
+  void stopMirror() {
+    if (!mirror_) {
+      return;
+    }
+    if (mirrorDropped_ > 0) {
+      log_info("mirror of %s dropped %zu bytes",
+               serverConn_->GetName().c_str(), mirrorDropped_);
+    }
+    if (mirrorConn_) {
+      drainMirror();
+    } else {
+      mirror_->SetOnConnection(DefaultOnConnection);
+      mirror_->Stop();
+    }
+    mirrorPending_.clear();
+    mirrorPendingSize_ = 0;
+    mirrorFailed_ = true;
+  }
+
+  // the mirror client outlives the tunnel until its output is written and
+  // the mirror closed, or kMirrorDrainMs passed
+  void drainMirror() {
+    std::shared_ptr<TcpClient> client(std::move(mirror_));
+    IoLoop* loop = loop_;
+    client->SetOnConnection([loop, client](const TcpEventPrt_t& conn) {
+      if (!conn->Connected()) {
+        // we are inside a callback of client
+        loop->CallSoon(
+            [client] { client->SetOnConnection(DefaultOnConnection); });
+      }
+    });
+    std::weak_ptr<TcpEvent> weakConn(mirrorConn_);
+    loop_->CallLater(kMirrorDrainMs, [weakConn] {
+      if (auto conn = weakConn.lock()) {
+        conn->ForceClose();
+      }
+    });
+    mirrorConn_.reset();
+    client->Disconnect();
+  }
+
+  void onMirrorConnection(const TcpEventPrt_t& conn) {
+    if (conn->Connected()) {
+      mirrorConn_ = conn;
+      for (const auto& data : mirrorPending_) {
+        conn->Send(data);
+      }
+      mirrorPending_.clear();
+      mirrorPendingSize_ = 0;
+    } else {
+      mirrorConn_.reset();
+      mirrorFailed_ = true;
+    }
+  }
+
+  void mirrorSend(const SharedBufPrt_t& data) {
+    if (mirrorFailed_) {
+      return;
+    }
+    size_t queued = mirrorConn_ ? mirrorConn_->GetOutputSize()
+                                : mirrorPendingSize_;
+    if (queued + data->size() > mirrorOptions_->maxBuffer) {
+      if (mirrorOptions_->dropOnOverflow) {
+        mirrorDropped_ += data->size();
+        return;
+      }
+      log_warn("mirror of %s is behind, disconnect it",
+               serverConn_->GetName().c_str());
+      mirrorFailed_ = true;
+      mirrorPending_.clear();
+      mirrorPendingSize_ = 0;
+      if (auto conn = mirrorConn_) {
+        conn->ForceClose();
+      } else {
+        mirror_->Stop();
+      }
+      return;
+    }
+    if (mirrorConn_) {
+      mirrorConn_->Send(data);
+    } else {
+      mirrorPending_.push_back(data);
+      mirrorPendingSize_ += data->size();
+    }
+  }
+
  private:
-  TcpClient client_;
+  static constexpr int kConnectTimeoutMs = 3000;
+  // upstreams tried for one connection
+  static constexpr int kMaxTries = 3;
+  static constexpr int kMirrorDrainMs = 5000;
+  IoLoop* loop_;
+  UpstreamGroup* group_;
+  // index in group_ while connecting or connected
+  size_t upstream_;
+  int tries_;
+  std::unique_ptr<TcpClient> client_;
   // 代表做为server的那个连接，也就是与客户端的连接
   TcpEventPrt_t serverConn_;
   // 代表做为client的那个连接，也就是与服户端的连接
   TcpEventPrt_t clientConn_;
+  const MirrorOptions* mirrorOptions_;
+  std::shared_ptr<TcpClient> mirror_;
+  TcpEventPrt_t mirrorConn_;
+  // client data that came before the mirror connected
+  std::vector<SharedBufPrt_t> mirrorPending_;
+  size_t mirrorPendingSize_;
+  size_t mirrorDropped_;
+  // the mirror is gone, do not send to it any more
+  bool mirrorFailed_;
 };
 using TunnelPtr = std::shared_ptr<Tunnel>;
 
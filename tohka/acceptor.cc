@@ -7,12 +7,15 @@
 #include "ioloop.h"
 #include "socketutil.h"
 #include "util/log.h"
+#include "util/probes.h"
 using namespace tohka;
 Acceptor::Acceptor(IoLoop* loop, NetAddress bind_address)
     : loop_(loop),
       socket_(SockUtil::CreateNonBlockFd_(bind_address.GetFamily(), SOCK_STREAM,
                                           IPPROTO_TCP)),
-      event_(loop_, socket_.GetFd()) {
+      event_(loop_, socket_.GetFd()),
+      accept_batch_(kDefaultAcceptBatch),
+      listening_(false) {
 // HINT: idle only support on unix
 #if defined(OS_UNIX)
   idle_fd_ = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
@@ -26,29 +29,42 @@ Acceptor::Acceptor(IoLoop* loop, NetAddress bind_address)
 };
 
 void Acceptor::OnAccept() {
-  NetAddress peer_address{};
-  // TODO ipv6 test?
-  int conn_fd = socket_.Accept(&peer_address);
-  if (conn_fd > 0 && conn_fd <= kMaxConn) {
-    if (on_accept_) {
-      on_accept_(conn_fd, peer_address);
-    } else {
-      log_warn("no OnAccept callback!");
+  // accept until the queue is drained or the batch is full
+  accepted_.clear();
+  for (int i = 0; i < accept_batch_; ++i) {
+    NetAddress peer_address{};
+    // TODO ipv6 test?
+    int conn_fd = socket_.Accept(&peer_address);
+    if (conn_fd < 0) {
 #if defined(OS_UNIX)
-      SockUtil::Close_(conn_fd);
+      if (errno == EMFILE) {
+        log_warn("use idle fd...");
+        ::close(idle_fd_);
+        idle_fd_ = ::accept(socket_.GetFd(), nullptr, nullptr);
+        ::close(idle_fd_);
+        idle_fd_ = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+      }
 #endif
+      break;
+    }
+    TOHKA_PROBE2(accept, socket_.GetFd(), conn_fd);
+    accepted_.emplace_back(conn_fd, peer_address);
+  }
+  if (accepted_.empty()) {
+    return;
+  }
+  log_trace("Acceptor::OnAccept accepted %d connections", accepted_.size());
+  if (on_accept_batch_) {
+    on_accept_batch_(accepted_);
+  } else if (on_accept_) {
+    for (auto& [conn_fd, peer_address] : accepted_) {
+      on_accept_(conn_fd, peer_address);
     }
   } else {
-    log_error("accept error!");
-#if defined(OS_UNIX)
-    if (errno == EMFILE) {
-      log_warn("use idle fd...");
-      ::close(idle_fd_);
-      idle_fd_ = ::accept(socket_.GetFd(), nullptr, nullptr);
-      ::close(idle_fd_);
-      idle_fd_ = ::open("/dev/null", O_RDONLY | O_CLOEXEC);
+    log_warn("no OnAccept callback!");
+    for (const auto& item : accepted_) {
+      SockUtil::Close_(item.first);
     }
-#endif
   }
 }
 Acceptor::~Acceptor() {
@@ -60,5 +76,18 @@ Acceptor::~Acceptor() {
 }
 void Acceptor::Listen() {
   socket_.Listen(kBackLog);
+  listening_ = true;
   event_.EnableReading();
 }
+void Acceptor::StopAccepting() {
+  if (event_.IsReading()) {
+    log_debug("Acceptor::StopAccepting fd = %d", socket_.GetFd());
+    event_.DisableReading();
+  }
+}
+void Acceptor::StartAccepting() {
+  if (listening_ && !event_.IsReading()) {
+    log_debug("Acceptor::StartAccepting fd = %d", socket_.GetFd());
+    event_.EnableReading();
+  }
+}
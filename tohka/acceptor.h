@@ -21,19 +21,38 @@ class Acceptor : noncopyable {
   void SetOnAccept(const OnAcceptCallback& on_accept) {
     on_accept_ = on_accept;
   }
+  // if set, called once per readiness event with all accepted connections
+  // instead of on_accept_
+  void SetOnAcceptBatch(const OnAcceptBatchCallback& on_accept_batch) {
+    on_accept_batch_ = on_accept_batch;
+  }
+  // max connections accepted per readiness event
+  void SetAcceptBatch(int accept_batch) { accept_batch_ = accept_batch; }
+
+  // see Socket::SetTcpFastOpen and Socket::SetDeferAccept, before Listen
+  void SetTcpFastOpen(int queue_len) { socket_.SetTcpFastOpen(queue_len); }
+  void SetDeferAccept(int timeout_sec) { socket_.SetDeferAccept(timeout_sec); }
 
   void Listen();
+  // pause/resume accepting, pending connections wait in the kernel backlog
+  void StopAccepting();
+  void StartAccepting();
+  bool IsAccepting() const { return event_.IsReading(); }
 
  private:
   void OnAccept();
-  static constexpr int kMaxConn = 200000;
   static constexpr int kBackLog = 512;
+  static constexpr int kDefaultAcceptBatch = 64;
   IoLoop* loop_;
   Socket socket_;
   IoEvent event_;
   int idle_fd_;  // For discarding failed connections
+  int accept_batch_;
+  bool listening_;
+  AcceptedList accepted_;
 
   OnAcceptCallback on_accept_;
+  OnAcceptBatchCallback on_accept_batch_;
 };
 }  // namespace tohka
 #endif  // TOHKA_TOHKA_ACCEPTOR_H
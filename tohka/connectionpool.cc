@@ -0,0 +1,284 @@
+//
+// Created by li on 2022/6/18.
+//
+
+#include "connectionpool.h"
+
+#include "iobuf.h"
+#include "ioloop.h"
+#include "socketutil.h"
+#include "tcpevent.h"
+#include "util/log.h"
+using namespace tohka;
+
+ConnectionPool::ConnectionPool(IoLoop* loop)
+    : loop_(loop),
+      max_idle_(kDefaultMaxIdle),
+      idle_timeout_ms_(kDefaultIdleTimeoutMs),
+      connect_timeout_ms_(kDefaultConnectTimeoutMs) {
+  sweep_timer_ = loop_->CallEvery(kSweepIntervalMs, [this] { Sweep(); });
+}
+ConnectionPool::~ConnectionPool() {
+  loop_->DeleteTimer(sweep_timer_);
+  for (auto& item : peers_) {
+    for (auto& entry : item.second.entries) {
+      if (entry->connect_timer.GetId() != 0) {
+        loop_->DeleteTimer(entry->connect_timer);
+      }
+      // the pool is gone, TcpClient closes what nobody else holds
+      if (entry->conn) {
+        entry->conn->SetOnConnection(DefaultOnConnection);
+        entry->conn->SetOnOnMessage(DefaultOnMessage);
+        entry->conn.reset();
+      }
+    }
+  }
+}
+
+void ConnectionPool::Acquire(const NetAddress& peer,
+                             const OnConnectionCallback& on_connection,
+                             const OnMessageCallback& on_message) {
+  auto handlers = std::make_shared<Handlers>();
+  handlers->on_connection = on_connection;
+  handlers->on_message = on_message;
+  Peer& p = GetPeer(peer);
+  // the most recently used connection is the least likely to be closed by
+  // the peer
+  while (true) {
+    EntryPtr_t best;
+    for (const auto& entry : p.entries) {
+      if (entry->state == kIdle &&
+          (!best || best->idle_since < entry->idle_since)) {
+        best = entry;
+      }
+    }
+    if (!best) {
+      break;
+    }
+    if (!IsHealthy(best->conn)) {
+      log_debug("[ConnectionPool::Acquire]->drop broken idle connection %s",
+                best->conn->GetName().c_str());
+      Close(best);
+      continue;
+    }
+    best->state = kBusy;
+    best->handlers = handlers;
+    Warm(p);
+    handlers->on_connection(best->conn);
+    return;
+  }
+  // take over a pre-warming connection nobody waits for
+  for (const auto& entry : p.entries) {
+    if (entry->state == kConnecting && !entry->handlers) {
+      entry->handlers = handlers;
+      Warm(p);
+      return;
+    }
+  }
+  auto entry = NewEntry(p);
+  entry->handlers = handlers;
+}
+void ConnectionPool::Release(const TcpEventPrt_t& conn) {
+  auto it = peers_.find(conn->GetPeerIpAndPort());
+  if (it == peers_.end()) {
+    log_warn("[ConnectionPool::Release]->not a pooled connection %s",
+             conn->GetName().c_str());
+    return;
+  }
+  Peer& p = it->second;
+  auto entry_it =
+      std::find_if(p.entries.begin(), p.entries.end(),
+                   [&conn](const EntryPtr_t& e) { return e->conn == conn; });
+  // already closed and removed
+  if (entry_it == p.entries.end() || (*entry_it)->state != kBusy) {
+    return;
+  }
+  EntryPtr_t entry = *entry_it;
+  entry->handlers.reset();
+  size_t idle_count = std::count_if(
+      p.entries.begin(), p.entries.end(),
+      [](const EntryPtr_t& e) { return e->state == kIdle; });
+  if (!IsHealthy(conn) || idle_count >= max_idle_) {
+    Close(entry);
+  } else {
+    SetIdle(entry);
+  }
+}
+void ConnectionPool::PreWarm(const NetAddress& peer, size_t count) {
+  Peer& p = GetPeer(peer);
+  p.warm_count = count;
+  Warm(p);
+}
+size_t ConnectionPool::GetIdleCount(const NetAddress& peer) {
+  auto it = peers_.find(peer.GetIpAndPort());
+  if (it == peers_.end()) {
+    return 0;
+  }
+  return std::count_if(
+      it->second.entries.begin(), it->second.entries.end(),
+      [](const EntryPtr_t& e) { return e->state == kIdle; });
+}
+
+ConnectionPool::Peer& ConnectionPool::GetPeer(const NetAddress& peer) {
+  auto result = peers_.try_emplace(peer.GetIpAndPort());
+  if (result.second) {
+    result.first->second.address = peer;
+  }
+  return result.first->second;
+}
+ConnectionPool::EntryPtr_t ConnectionPool::NewEntry(Peer& peer) {
+  auto entry = std::make_shared<Entry>();
+  entry->state = kConnecting;
+  entry->client = std::make_unique<TcpClient>(
+      loop_, peer.address, "pool-" + peer.address.GetIpAndPort());
+  std::weak_ptr<Entry> weak_entry(entry);
+  entry->client->SetOnConnection(
+      [this, weak_entry](const TcpEventPrt_t& conn) {
+        OnConnection(weak_entry, conn);
+      });
+  entry->client->SetOnMessage(
+      [this, weak_entry](const TcpEventPrt_t& conn, IoBuf* buf) {
+        OnMessage(weak_entry, conn, buf);
+      });
+  entry->connect_timer = loop_->CallLater(
+      connect_timeout_ms_, [this, weak_entry] { OnConnectTimeout(weak_entry); });
+  peer.entries.push_back(entry);
+  entry->client->Connect();
+  return entry;
+}
+void ConnectionPool::OnConnection(const std::weak_ptr<Entry>& weak_entry,
+                                  const TcpEventPrt_t& conn) {
+  auto entry = weak_entry.lock();
+  if (!entry) {
+    return;
+  }
+  if (conn->Connected()) {
+    if (entry->connect_timer.GetId() != 0) {
+      loop_->DeleteTimer(entry->connect_timer);
+      entry->connect_timer = TimerId();
+    }
+    entry->conn = conn;
+    if (entry->handlers) {
+      entry->state = kBusy;
+      auto handlers = entry->handlers;
+      handlers->on_connection(conn);
+    } else {
+      SetIdle(entry);
+    }
+  } else {
+    State state = entry->state;
+    auto handlers = entry->handlers;
+    Remove(entry);
+    if (state == kBusy && handlers) {
+      handlers->on_connection(conn);
+    }
+  }
+}
+void ConnectionPool::OnMessage(const std::weak_ptr<Entry>& weak_entry,
+                               const TcpEventPrt_t& conn, IoBuf* buf) {
+  auto entry = weak_entry.lock();
+  if (entry && entry->state == kBusy && entry->handlers) {
+    // the handler may Release (and so drop the handlers) while running
+    auto handlers = entry->handlers;
+    handlers->on_message(conn, buf);
+    return;
+  }
+  // data on an idle connection, the exchange on it is out of sync
+  log_warn("[ConnectionPool::OnMessage]->unexpected %d bytes on idle %s",
+           buf->GetReadableSize(), conn->GetName().c_str());
+  buf->Refresh();
+  if (entry) {
+    Close(entry);
+  } else {
+    conn->ForceClose();
+  }
+}
+void ConnectionPool::OnConnectTimeout(const std::weak_ptr<Entry>& weak_entry) {
+  auto entry = weak_entry.lock();
+  if (!entry) {
+    return;
+  }
+  entry->connect_timer = TimerId();
+  if (entry->state != kConnecting) {
+    return;
+  }
+  log_warn("[ConnectionPool::OnConnectTimeout]->connect %s timeout",
+           entry->client->GetPeerAddress().GetIpAndPort().c_str());
+  auto handlers = entry->handlers;
+  Close(entry);
+  if (handlers) {
+    handlers->on_connection(nullptr);
+  }
+}
+bool ConnectionPool::IsHealthy(const TcpEventPrt_t& conn) {
+  if (!conn || !conn->Connected() || conn->GetInputBuf()->GetReadableSize()) {
+    return false;
+  }
+  // the close (or data) may have arrived after the last poll
+  char c;
+  ssize_t n = SockUtil::Peek_(conn->GetFd(), &c, 1);
+  return n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+void ConnectionPool::SetIdle(const EntryPtr_t& entry) {
+  entry->state = kIdle;
+  entry->idle_since = TimePoint::now();
+}
+void ConnectionPool::Close(const EntryPtr_t& entry) {
+  State state = entry->state;
+  // no user callback from OnConnection for a connection we close
+  entry->state = kClosed;
+  if (entry->conn && entry->conn->Connected()) {
+    entry->conn->ForceClose();
+  } else if (state == kConnecting) {
+    entry->client->Stop();
+  }
+  Remove(entry);
+}
+void ConnectionPool::Remove(const EntryPtr_t& entry) {
+  if (entry->connect_timer.GetId() != 0) {
+    loop_->DeleteTimer(entry->connect_timer);
+    entry->connect_timer = TimerId();
+  }
+  entry->state = kClosed;
+  auto it = peers_.find(entry->client->GetPeerAddress().GetIpAndPort());
+  if (it == peers_.end()) {
+    return;
+  }
+  auto& entries = it->second.entries;
+  auto entry_it = std::find(entries.begin(), entries.end(), entry);
+  if (entry_it == entries.end()) {
+    return;
+  }
+  entries.erase(entry_it);
+  // we may be inside a callback of its TcpClient
+  loop_->CallSoon([entry] {});
+}
+void ConnectionPool::Sweep() {
+  auto now = TimePoint::now();
+  std::vector<EntryPtr_t> expired;
+  for (auto& item : peers_) {
+    for (const auto& entry : item.second.entries) {
+      if (entry->state == kIdle &&
+          entry->idle_since + idle_timeout_ms_ < now) {
+        expired.push_back(entry);
+      }
+    }
+  }
+  for (const auto& entry : expired) {
+    log_debug("[ConnectionPool::Sweep]->close idle connection %s",
+              entry->conn->GetName().c_str());
+    Close(entry);
+  }
+  for (auto& item : peers_) {
+    Warm(item.second);
+  }
+}
+void ConnectionPool::Warm(Peer& peer) {
+  size_t ready = std::count_if(
+      peer.entries.begin(), peer.entries.end(), [](const EntryPtr_t& e) {
+        return e->state == kIdle || (e->state == kConnecting && !e->handlers);
+      });
+  for (; ready < peer.warm_count; ++ready) {
+    NewEntry(peer);
+  }
+}
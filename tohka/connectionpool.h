@@ -0,0 +1,97 @@
+//
+// Created by li on 2022/6/18.
+//
+
+#ifndef TOHKA_TOHKA_CONNECTIONPOOL_H
+#define TOHKA_TOHKA_CONNECTIONPOOL_H
+
+#include "netaddress.h"
+#include "noncopyable.h"
+#include "tcpclient.h"
+#include "timepoint.h"
+#include "timerid.h"
+#include "tohka.h"
+
+namespace tohka {
+// Upstream connections of one loop, keyed by peer address.
+//
+// Acquire hands out a connected TcpEvent. on_connection is called with the
+// connection once it is checked out, again (Connected() == false) if it
+// closes while checked out, and with nullptr if no connection could be made
+// within the connect timeout. on_message gets the data of the connection
+// while it is checked out. Release puts it back for reuse; a connection the
+// caller shuts down or closes is simply dropped from the pool.
+class ConnectionPool : noncopyable {
+ public:
+  explicit ConnectionPool(IoLoop* loop);
+  ~ConnectionPool();
+
+  void Acquire(const NetAddress& peer, const OnConnectionCallback& on_connection,
+               const OnMessageCallback& on_message);
+  void Release(const TcpEventPrt_t& conn);
+  // keep count connections to peer connected or connecting
+  void PreWarm(const NetAddress& peer, size_t count);
+
+  // max idle connections kept per peer
+  void SetMaxIdle(size_t max_idle) { max_idle_ = max_idle; }
+  // idle connections older than this are closed
+  void SetIdleTimeout(int idle_timeout_ms) {
+    idle_timeout_ms_ = idle_timeout_ms;
+  }
+  void SetConnectTimeout(int connect_timeout_ms) {
+    connect_timeout_ms_ = connect_timeout_ms;
+  }
+  size_t GetIdleCount(const NetAddress& peer);
+
+ private:
+  enum State { kConnecting, kIdle, kBusy, kClosed };
+  struct Handlers {
+    OnConnectionCallback on_connection;
+    OnMessageCallback on_message;
+  };
+  using HandlersPtr_t = std::shared_ptr<Handlers>;
+  struct Entry {
+    std::unique_ptr<TcpClient> client;
+    TcpEventPrt_t conn;
+    State state;
+    TimePoint idle_since;
+    TimerId connect_timer;
+    // set while somebody waits for or holds this connection
+    HandlersPtr_t handlers;
+  };
+  using EntryPtr_t = std::shared_ptr<Entry>;
+  struct Peer {
+    NetAddress address;
+    std::vector<EntryPtr_t> entries;
+    size_t warm_count = 0;
+  };
+
+  Peer& GetPeer(const NetAddress& peer);
+  EntryPtr_t NewEntry(Peer& peer);
+  void OnConnection(const std::weak_ptr<Entry>& weak_entry,
+                    const TcpEventPrt_t& conn);
+  void OnMessage(const std::weak_ptr<Entry>& weak_entry,
+                 const TcpEventPrt_t& conn, IoBuf* buf);
+  void OnConnectTimeout(const std::weak_ptr<Entry>& weak_entry);
+  // peer closed, data or buffered input on an idle connection
+  static bool IsHealthy(const TcpEventPrt_t& conn);
+  void SetIdle(const EntryPtr_t& entry);
+  void Close(const EntryPtr_t& entry);
+  // remove from peer and destroy at the end of this iteration
+  void Remove(const EntryPtr_t& entry);
+  void Sweep();
+  void Warm(Peer& peer);
+
+  static constexpr size_t kDefaultMaxIdle = 16;
+  static constexpr int kDefaultIdleTimeoutMs = 60 * 1000;
+  static constexpr int kDefaultConnectTimeoutMs = 5000;
+  static constexpr int kSweepIntervalMs = 1000;
+  IoLoop* loop_;
+  std::map<std::string, Peer> peers_;
+  size_t max_idle_;
+  int idle_timeout_ms_;
+  int connect_timeout_ms_;
+  TimerId sweep_timer_;
+};
+}  // namespace tohka
+#endif  // TOHKA_TOHKA_CONNECTIONPOOL_H
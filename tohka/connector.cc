@@ -5,10 +5,37 @@
 #include "connector.h"
 
 #include "ioloop.h"
+#include "metrics.h"
 #include "socketutil.h"
 #include "util/log.h"
 using namespace tohka;
 
+namespace {
+struct ConnectorMetrics {
+  Histogram* connect_duration;
+  Counter* retries;
+  Counter* timeouts;
+};
+ConnectorMetrics& GetMetrics() {
+  static ConnectorMetrics metrics = [] {
+    auto* registry = MetricsRegistry::Get();
+    return ConnectorMetrics{
+        registry->AddHistogram(
+            "tohka_connector_connect_duration_seconds",
+            "Time from connect to the connection established.",
+            {500, 1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000,
+             500000, 1000000, 2500000, 5000000, 10000000},
+            1e-6),
+        registry->AddCounter("tohka_connector_retries_total",
+                             "Failed connects scheduled to retry."),
+        registry->AddCounter("tohka_connector_timeouts_total",
+                             "Connects that timed out."),
+    };
+  }();
+  return metrics;
+}
+}  // namespace
+
 Connector::Connector(IoLoop* loop, const NetAddress& peer)
     : loop_(loop),
       timer_id_(),
@@ -16,13 +43,16 @@ Connector::Connector(IoLoop* loop, const NetAddress& peer)
       peer_(peer),
       state_(kDisconnected),
       connect_(false),
+      retry_(true),
       enable_connect_timeout_(false),
+      enable_fast_open_(false),
       connect_timeout_ms_(kDefaultTimeoutMs) {}
 Connector::~Connector() {
   // 关闭定时器
   if (timer_id_.GetId() != 0) {
     IoLoop::GetLoop()->DeleteTimer(timer_id_);
   }
+  DeleteTimeoutTimer();
   assert(!event_);
 }
 
@@ -32,18 +62,28 @@ void Connector::OnConnect() {
   if (state_ == kConnecting) {
     // HINT 这时候连接不一定成功(可能发生错误),但是我们任然要把poll中的event去掉
     int fd = RemoveAndResetEvent();
+    DeleteTimeoutTimer();
     // HINT 判断是否是真正连接成功
-    int err = SockUtil::GetPeerName_(fd, peer_.GetAddress(), peer_.GetSize());
+    // A fast open connect with a cookie is deferred until the first write,
+    // getpeername fails with ENOTCONN until then, so check SO_ERROR only.
+    int err = enable_fast_open_
+                  ? SockUtil::GetSocketError_(fd)
+                  : SockUtil::GetPeerName_(fd, peer_.GetAddress(),
+                                           peer_.GetSize());
     if (err) {
       log_trace("Connector::OnConnect err");
       // 如果没有真正连接成功，那么一定后时间重连
       Retry(fd);
     } else {
       SetState(kConnected);
+      GetMetrics().connect_duration->Observe(
+          TimePoint::now().GetMicroSeconds() -
+          connect_start_.GetMicroSeconds());
       if (connect_) {
         on_connect_(fd);
       } else {
         SockUtil::Close_(fd);
+        source_lease_.reset();
       }
     }
   } else {
@@ -51,16 +91,44 @@ void Connector::OnConnect() {
   }
 }
 void Connector::Connect() {
-  int sockfd =
-      SockUtil::CreateNonBlockFd_(peer_.GetFamily(), SOCK_STREAM, IPPROTO_TCP);
-  log_trace("Connector create fd = %d", sockfd);
-  int ret = SockUtil::Connect_(sockfd, peer_.GetAddress(), peer_.GetSize());
-  int saved_errno = (ret == 0) ? 0 : errno;
+  // a source with no port left to peer is skipped for another one at once,
+  // instead of backing off, each source at most once
+  size_t tries = source_pool_ ? source_pool_->GetSourceCount() : 1;
+  int sockfd;
+  int saved_errno;
+  for (size_t i = 0;; ++i) {
+    sockfd = SockUtil::CreateNonBlockFd_(peer_.GetFamily(), SOCK_STREAM,
+                                         IPPROTO_TCP);
+    log_trace("Connector create fd = %d", sockfd);
+    connect_start_ = TimePoint::now();
+    if (enable_fast_open_) {
+      SockUtil::SetTcpFastOpenConnect_(sockfd);
+    }
+    if (source_pool_ && !BindSource(sockfd)) {
+      Retry(sockfd);
+      return;
+    }
+    int ret = SockUtil::Connect_(sockfd, peer_.GetAddress(), peer_.GetSize());
+    saved_errno = (ret == 0) ? 0 : errno;
+    if (saved_errno != EADDRNOTAVAIL || !source_lease_) {
+      break;
+    }
+    source_pool_->MarkExhausted(*source_lease_);
+    if (i + 1 >= tries) {
+      break;
+    }
+    SockUtil::Close_(sockfd);
+    source_lease_.reset();
+  }
 
   // set connect timeout
   if (enable_connect_timeout_) {
-    IoLoop::GetLoop()->CallLater(connect_timeout_ms_,
-                                 [this] { OnConnectTimeout(); });
+    DeleteTimeoutTimer();
+    timeout_timer_id_ =
+        IoLoop::GetLoop()->CallLater(connect_timeout_ms_, [this] {
+          timeout_timer_id_ = TimerId();
+          OnConnectTimeout();
+        });
   }
   log_trace("errno = %d errmsg = %s", errno, strerror(errno));
   switch (saved_errno) {
@@ -88,13 +156,13 @@ void Connector::Connect() {
     case EFAULT:
     case ENOTSOCK:
       log_error("Connector::Connect error errno=%d", saved_errno);
-      SockUtil::Close_(sockfd);
+      Fail(sockfd);
       break;
 
     default:
       log_error("Connector::Connect Unexpected error errno=%d errmsg = %s",
                 errno, strerror(errno));
-      SockUtil::Close_(sockfd);
+      Fail(sockfd);
       break;
   }
 }
@@ -117,28 +185,75 @@ void Connector::Retry(int sock_fd) {
   log_trace("Connector::Retry");
   // 关闭当前的socket
   SockUtil::Close_(sock_fd);
+  source_lease_.reset();
   SetState(kDisconnected);
+  DeleteTimeoutTimer();
+  if (!retry_) {
+    if (connect_ && on_connect_failed_) {
+      on_connect_failed_();
+    }
+    return;
+  }
   // 一定时间后重新尝试连接
   if (connect_) {
-    timer_id_ =
-        IoLoop::GetLoop()->CallLater(retry_delay_ms_, [this] { Start(); });
+    GetMetrics().retries->Inc();
+    timer_id_ = IoLoop::GetLoop()->CallLater(retry_delay_ms_, [this] {
+      // fired, nothing to delete any more
+      timer_id_ = TimerId();
+      Start();
+    });
     retry_delay_ms_ = std::min(retry_delay_ms_ * 2, kMaxDelayMs);
   } else {
     log_debug("[Connector::Retry]->do not reconnect");
   }
 }
 
+void Connector::Fail(int sock_fd) {
+  SockUtil::Close_(sock_fd);
+  source_lease_.reset();
+  SetState(kDisconnected);
+  DeleteTimeoutTimer();
+  if (connect_ && on_connect_failed_) {
+    on_connect_failed_();
+  }
+}
+bool Connector::BindSource(int sock_fd) {
+  source_lease_ = source_pool_->Acquire(peer_);
+  if (!source_lease_) {
+    log_warn("[Connector::BindSource]->no source address left to %s",
+             peer_.GetIpAndPort().c_str());
+    return false;
+  }
+  SockUtil::SetBindAddressNoPort_(sock_fd);
+  const NetAddress& source = source_lease_->GetAddress();
+  if (SockUtil::BindAddress_(sock_fd, source.GetAddress(), source.GetSize()) <
+      0) {
+    source_lease_.reset();
+    return false;
+  }
+  return true;
+}
+void Connector::DeleteTimeoutTimer() {
+  if (timeout_timer_id_.GetId() != 0) {
+    IoLoop::GetLoop()->DeleteTimer(timeout_timer_id_);
+    timeout_timer_id_ = TimerId();
+  }
+}
+
 void Connector::Stop() {
   connect_ = false;
   if (state_ == kConnecting) {
     SetState(kDisconnected);
     int fd = RemoveAndResetEvent();
     SockUtil::Close_(fd);
+    source_lease_.reset();
   }
   // 关闭定时器
   if (timer_id_.GetId() != 0) {
     IoLoop::GetLoop()->DeleteTimer(timer_id_);
+    timer_id_ = TimerId();
   }
+  DeleteTimeoutTimer();
 }
 int Connector::RemoveAndResetEvent() {
   event_->DisableAll();
@@ -162,7 +277,8 @@ void Connector::OnConnectTimeout() {
     log_debug("[ConnectTimeout]->connect %s ok! status=kConnected",
               peer_.GetIpAndPort().c_str());
   }
-  if (state_ == kConnecting || state_ == kDisconnected) {
+  if (state_ == kConnecting) {
+    GetMetrics().timeouts->Inc();
     log_debug(
         "[Connector::OnConnectTimeout]-> connect %s timeout now status= "
         "kConnecting and try to reconnected!",
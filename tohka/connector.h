@@ -7,6 +7,8 @@
 
 #include "ioevent.h"
 #include "socket.h"
+#include "sourceaddresspool.h"
+#include "timepoint.h"
 #include "timerid.h"
 #include "tohka.h"
 namespace tohka {
@@ -18,6 +20,11 @@ class Connector {
   void SetOnConnect(OnConnectCallback on_connect) {
     on_connect_ = std::move(on_connect);
   }
+  // called when the connector gives up: on an error that is never retried,
+  // or on any failure once retry is off
+  void SetOnConnectFailed(NormalCallback on_connect_failed) {
+    on_connect_failed_ = std::move(on_connect_failed);
+  }
 
   void Start();
   void Restart();
@@ -29,7 +36,22 @@ class Connector {
   void SetConnectTimeout(int connect_timeout_ms) {
     connect_timeout_ms_ = connect_timeout_ms;
   }
+  // internal use only
+  void EnableFastOpen(bool on) { enable_fast_open_ = on; }
+  // internal use only
+  void SetRetry(bool on) { retry_ = on; }
+  // internal use only
+  void SetSourcePool(std::shared_ptr<SourceAddressPool> source_pool) {
+    source_pool_ = std::move(source_pool);
+  }
+  // the source address of the connection just made, it stays in use for
+  // the destination as long as the lease lives
+  SourceAddressPool::LeasePtr_t TakeSourceLease() {
+    return std::move(source_lease_);
+  }
   NetAddress& GetPeerAddress() { return peer_; }
+  // waiting for the connect to complete
+  bool IsConnecting() const { return state_ == kConnecting; }
 
  private:
   enum State { kDisconnected, kConnecting, kConnected };
@@ -37,6 +59,9 @@ class Connector {
   void Connect();
   void Connecting(int sock_fd);
   void Retry(int sock_fd);
+  void Fail(int sock_fd);
+  bool BindSource(int sock_fd);
+  void DeleteTimeoutTimer();
   int RemoveAndResetEvent();
   void ResetEvent();
 
@@ -47,14 +72,22 @@ class Connector {
   static constexpr int kDefaultTimeoutMs = 8000;
   IoLoop* loop_;
   TimerId timer_id_;
+  TimerId timeout_timer_id_;
   int retry_delay_ms_;
   std::unique_ptr<IoEvent> event_;
   NetAddress peer_;
   State state_;
   bool connect_;
+  bool retry_;
   bool enable_connect_timeout_;
+  bool enable_fast_open_;
   int connect_timeout_ms_;
+  // of the attempt in progress
+  TimePoint connect_start_;
+  std::shared_ptr<SourceAddressPool> source_pool_;
+  SourceAddressPool::LeasePtr_t source_lease_;
   OnConnectCallback on_connect_;
+  NormalCallback on_connect_failed_;
 };
 }  // namespace tohka
 
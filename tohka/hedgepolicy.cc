@@ -0,0 +1,44 @@
+//
+// Created by li on 2022/6/25.
+//
+
+#include "hedgepolicy.h"
+using namespace tohka;
+
+HedgePolicy::HedgePolicy(int delay_ms, double quantile)
+    : delay_ms_(delay_ms),
+      quantile_(quantile),
+      next_sample_(0),
+      records_since_update_(0),
+      quantile_delay_ms_(delay_ms),
+      hedges_sent_(0),
+      hedges_won_(0) {
+  samples_.reserve(kWindow);
+  sorted_.reserve(kWindow);
+}
+
+int HedgePolicy::GetDelayMs() const {
+  return samples_.size() < kMinSamples ? delay_ms_ : quantile_delay_ms_;
+}
+void HedgePolicy::RecordConnectTime(int64_t connect_us) {
+  if (samples_.size() < kWindow) {
+    samples_.push_back(connect_us);
+  } else {
+    samples_[next_sample_] = connect_us;
+    next_sample_ = (next_sample_ + 1) % kWindow;
+  }
+  if (samples_.size() < kMinSamples) {
+    return;
+  }
+  // the quantile of a window moves slowly, no need to sort on every connect
+  if (samples_.size() > kMinSamples &&
+      ++records_since_update_ < kUpdateInterval) {
+    return;
+  }
+  records_since_update_ = 0;
+  sorted_.assign(samples_.begin(), samples_.end());
+  auto nth = sorted_.begin() + (size_t)(quantile_ * (sorted_.size() - 1));
+  std::nth_element(sorted_.begin(), nth, sorted_.end());
+  // round up, a sub-millisecond p95 still needs a timer of 1ms
+  quantile_delay_ms_ = std::max((int)((*nth + 999) / 1000), kMinDelayMs);
+}
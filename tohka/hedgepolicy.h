@@ -0,0 +1,50 @@
+//
+// Created by li on 2022/6/25.
+//
+
+#ifndef TOHKA_TOHKA_HEDGEPOLICY_H
+#define TOHKA_TOHKA_HEDGEPOLICY_H
+
+#include "noncopyable.h"
+#include "platform.h"
+namespace tohka {
+// When to send a hedged connect, shared by the clients of one upstream.
+//
+// A connect still pending after the delay gets a second attempt and the
+// first one to complete wins. The delay starts at the configured value and
+// follows the given quantile (p95 by default) of the recent connect times
+// once enough of them are known, so about one connect in twenty is hedged.
+class HedgePolicy : noncopyable {
+ public:
+  explicit HedgePolicy(int delay_ms, double quantile = 0.95);
+
+  int GetDelayMs() const;
+  void RecordConnectTime(int64_t connect_us);
+
+  void OnHedgeSent() { ++hedges_sent_; }
+  void OnHedgeWon() { ++hedges_won_; }
+  uint64_t GetHedgesSent() const { return hedges_sent_; }
+  uint64_t GetHedgesWon() const { return hedges_won_; }
+
+ private:
+  static constexpr size_t kWindow = 128;
+  static constexpr size_t kMinSamples = 16;
+  // records between two recomputes of the quantile
+  static constexpr size_t kUpdateInterval = 16;
+  static constexpr int kMinDelayMs = 1;
+  int delay_ms_;
+  double quantile_;
+  // ring of the last kWindow connect times
+  std::vector<int64_t> samples_;
+  size_t next_sample_;
+  size_t records_since_update_;
+  // scratch copy of samples_ for nth_element
+  std::vector<int64_t> sorted_;
+  // recomputed every kUpdateInterval records, read on every connect
+  int quantile_delay_ms_;
+  uint64_t hedges_sent_;
+  uint64_t hedges_won_;
+};
+}  // namespace tohka
+
+#endif  // TOHKA_TOHKA_HEDGEPOLICY_H
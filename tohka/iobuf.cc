@@ -41,11 +41,19 @@ void IoBuf::MakeSpace(size_t len) {
     assert(readable == GetReadableSize());
   }
 }
+void IoBuf::Shrink(size_t reserve) {
+  size_t readable = GetReadableSize();
+  std::vector<char> data(kPrependSize + readable + reserve);
+  std::copy(Peek(), Peek() + readable, data.begin() + kPrependSize);
+  data_.swap(data);
+  read_index_ = kPrependSize;
+  write_index_ = read_index_ + readable;
+}
 std::string IoBuf::ReceiveAllAsString() {
   size_t readable = GetReadableSize();
 
-  // c++ 17
-  std::string result{Peek(), 0, readable};
+  // (pointer, length), the data may contain '\0'
+  std::string result(Peek(), readable);
 
   // refresh
   Refresh();
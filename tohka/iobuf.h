@@ -63,6 +63,8 @@ class IoBuf {
   void SetWriteIndex(size_t index) { write_index_ = index; }
   void EnsureWritableBytes(size_t len);
   void MakeSpace(size_t len);
+  // release memory, keep readable data and `reserve` writeable bytes
+  void Shrink(size_t reserve);
 
   size_t GetBufferSize() { return data_.size(); };
 
@@ -6,25 +6,56 @@
 
 #include "ioloop.h"
 #include "tohka/tohka.h"
+#include "util/binlog.h"
 #include "util/log.h"
 
 using namespace tohka;
 
 IoEvent::IoEvent(IoLoop* loop, int fd)
-    : loop_(loop), fd_(fd), events_(0), revents_(0), tied_(false), index_(-1) {}
+    : loop_(loop),
+      fd_(fd),
+      events_(0),
+      revents_(0),
+      tied_(false),
+      index_(-1),
+      read_site_(nullptr),
+      write_site_(nullptr) {}
 
 void IoEvent::ExecuteEvent() {
   std::shared_ptr<void> guard;
   // 避免每次都去lock
   if (tied_) {
     guard = tie_obj_.lock();
-    if (guard) {
-      SafeExecuteEvent();
+    if (!guard) {
+      return;
     }
+  }
+  Watchdog* watchdog = loop_->GetCallbackWatchdog();
+  if (watchdog != nullptr) {
+    // before the callbacks change the events, or destroy this event as an
+    // untied Connector does once connected
+    const std::type_info& site = GetCallbackType();
+    int fd = fd_;
+    std::string name = name_;
+    TimePoint start = TimePoint::now();
+    SafeExecuteEvent();
+    watchdog->OnCallbackDone(start, site, fd, name);
   } else {
     SafeExecuteEvent();
   }
 }
+const std::type_info& IoEvent::GetCallbackType() const {
+  if ((events_ & EV_READ) && (revents_ & EV_READ) && read_callback_) {
+    if (read_site_ != nullptr && *read_site_ != typeid(void)) {
+      return *read_site_;
+    }
+    return read_callback_.target_type();
+  }
+  if (write_site_ != nullptr && *write_site_ != typeid(void)) {
+    return *write_site_;
+  }
+  return write_callback_.target_type();
+}
 
 void IoEvent::Register() { loop_->GetWatcherRawPoint()->RegisterEvent(this); }
 void IoEvent::UnRegister() {
@@ -35,8 +66,9 @@ void IoEvent::Tie(const std::shared_ptr<void>& tie) {
   tied_ = true;
 }
 void IoEvent::SafeExecuteEvent() {
-  log_trace("fd = %d IoEvent::ExecuteEvent() events=0x%x revents=0x%x", fd_,
-            events_, revents_);
+  binlog_log_trace(
+      "fd = %d IoEvent::ExecuteEvent() events=0x%x revents=0x%x", fd_,
+      events_, revents_);
   if ((events_ & EV_READ) && (revents_ & EV_READ)) {
     if (read_callback_) {
       read_callback_();
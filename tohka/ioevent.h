@@ -52,6 +52,16 @@ class IoEvent : noncopyable {
 
   // HINT: 延长ioevent的生命周期
   void Tie(const std::shared_ptr<void>& tie);
+  // logged by the Watchdog, the connection name for a TcpEvent
+  void SetName(std::string name) { name_ = std::move(name); }
+  // counted by the Watchdog instead of the read or write callback, when
+  // those only dispatch to a user's callback. Types of empty functions are
+  // ignored.
+  void SetCallbackSites(const std::type_info* read_site,
+                        const std::type_info* write_site) {
+    read_site_ = read_site;
+    write_site_ = write_site;
+  }
   short GetEvents() const { return events_; }
   void SetEvents(short events) { events_ = events; }
   short GetRevents() const { return revents_; }
@@ -69,11 +79,16 @@ class IoEvent : noncopyable {
   short events_;
   short revents_;
   void SafeExecuteEvent();
+  // where the callbacks to run now were made
+  const std::type_info& GetCallbackType() const;
   std::weak_ptr<void> tie_obj_;
   bool tied_;
   int index_;  // for poller
   EventCallback read_callback_;
   EventCallback write_callback_;
+  std::string name_;
+  const std::type_info* read_site_;
+  const std::type_info* write_site_;
 };
 }  // namespace tohka
 #endif  // TOHKA_TOHKA_IOEVENT_H
@@ -4,8 +4,11 @@
 
 #include "ioloop.h"
 
+#include "resolver.h"
+#include "trafficshaper.h"
 #include "tohka/iowatcher.h"
 #include "util/log.h"
+#include "util/probes.h"
 
 using namespace tohka;
 
@@ -56,6 +59,10 @@ SignalHandler SH;
 IoLoop::IoLoop()
     : io_watcher_(IoWatcher::ChooseIoWatcher()),
       timer_manager_(std::make_unique<TimerManager>()),
+      max_io_bytes_(0),
+      max_callback_time_ms_(0),
+      telemetry_on_(false),
+      callback_watchdog_(nullptr),
       running_(false) {
   // init log level
   log_set_level(LOG_INFO);
@@ -67,6 +74,8 @@ IoLoop::IoLoop()
   }
 }
 
+IoLoop::~IoLoop() = default;
+
 void IoLoop::RunForever() {
   if (current_loop_thread != this) {
     log_fatal("This thread now have thread at %p", current_loop_thread);
@@ -76,17 +85,129 @@ void IoLoop::RunForever() {
   std::vector<IoEvent*> activate_event_list;
   while (running_) {
     activate_event_list.clear();
-    int64_t next_expired_duration = timer_manager_->GetNextExpiredDuration();
+    RunIteration(activate_event_list);
+  }
+  if (watchdog_) {
+    watchdog_->OnIdle();
+  }
+}
+void IoLoop::RunIteration(EventList& activate_event_list) {
+  int64_t next_expired_duration = timer_manager_->GetNextExpiredDuration();
+  // callbacks queued or events deferred by the last iteration must not
+  // wait for io
+  if (!pending_callbacks_.empty() || !deferred_fds_.empty()) {
+    next_expired_duration = 0;
+  }
+  // the clock is read for telemetry only while it is on, a callback turning
+  // it on takes effect next iteration
+  bool with_telemetry = telemetry_on_;
+  TimePoint next_timer;
+  TimePoint poll_start;
+  if (with_telemetry) {
+    next_timer = timer_manager_->GetNextExpiredTime();
+  }
+
+  TOHKA_PROBE1(loop_start, next_expired_duration);
+  int64_t start = TOHKA_PROBE_START(loop_end);
+
+  if (watchdog_) {
+    watchdog_->OnIdle();
+  }
+  if (with_telemetry) {
+    poll_start = TimePoint::now();
+  }
+  // get activate event and fill those to activate_event_list
+  TimePoint poll_end =
+      io_watcher_->PollEvents((int)next_expired_duration, &activate_event_list);
+  if (watchdog_) {
+    watchdog_->OnBusy();
+  }
 
-    // get activate event and fill those to activate_event_list
-    io_watcher_->PollEvents((int)next_expired_duration, &activate_event_list);
+  // do io event
+  DoIoEvents(activate_event_list);
+  TimePoint io_end = with_telemetry ? TimePoint::now() : TimePoint();
+  // do timer
+  size_t timers_fired = timer_manager_->DoExpiredTimers();
+  TimePoint timer_end = with_telemetry ? TimePoint::now() : TimePoint();
+  // do callbacks queued by io events and timers
+  DoPendingCallbacks();
+  TOHKA_PROBE3(loop_end, activate_event_list.size(), timers_fired,
+               TOHKA_PROBE_ELAPSED(start));
+  if (!with_telemetry) {
+    return;
+  }
 
-    // do io event
+  TimePoint callback_end = TimePoint::now();
+  LoopTelemetry& telemetry = *telemetry_;
+  telemetry.poll_wait_us.Record(poll_end.GetMicroSeconds() -
+                                poll_start.GetMicroSeconds());
+  telemetry.io_callback_us.Record(io_end.GetMicroSeconds() -
+                                  poll_end.GetMicroSeconds());
+  telemetry.timer_us.Record(timer_end.GetMicroSeconds() -
+                            io_end.GetMicroSeconds());
+  telemetry.pending_callback_us.Record(callback_end.GetMicroSeconds() -
+                                       timer_end.GetMicroSeconds());
+  telemetry.ready_events.Record(activate_event_list.size());
+  telemetry.timers_fired.Record(timers_fired);
+  if (next_timer.GetMicroSeconds() >= 0 && !(poll_end < next_timer)) {
+    telemetry.lag_us.Record(poll_end.GetMicroSeconds() -
+                            next_timer.GetMicroSeconds());
+  }
+}
+void IoLoop::EnableTelemetry(bool on) {
+  if (on && !telemetry_) {
+    telemetry_ = std::make_unique<LoopTelemetry>();
+  }
+  telemetry_on_ = on;
+}
+void IoLoop::DoIoEvents(EventList& activate_event_list) {
+  if (max_callback_time_ms_ <= 0) {
     for (auto event : activate_event_list) {
       event->ExecuteEvent();
     }
-    // do timer
-    timer_manager_->DoExpiredTimers();
+    return;
+  }
+  // events deferred last iteration go first, so a big batch can not starve
+  // the fds at its tail
+  if (!deferred_fds_.empty()) {
+    std::stable_partition(
+        activate_event_list.begin(), activate_event_list.end(),
+        [this](IoEvent* event) {
+          return std::binary_search(deferred_fds_.begin(), deferred_fds_.end(),
+                                    event->GetFd());
+        });
+    deferred_fds_.clear();
+  }
+  // a callback may destroy a later event of this list, keep its fd only
+  std::vector<int> fds;
+  fds.reserve(activate_event_list.size());
+  for (auto event : activate_event_list) {
+    fds.push_back(event->GetFd());
+  }
+  auto deadline = TimePoint::now() + max_callback_time_ms_;
+  for (size_t i = 0; i < activate_event_list.size(); ++i) {
+    activate_event_list[i]->ExecuteEvent();
+    if (i + 1 < activate_event_list.size() && deadline < TimePoint::now()) {
+      log_debug("IoLoop::DoIoEvents over budget, defer %d events",
+                activate_event_list.size() - i - 1);
+      deferred_fds_.assign(fds.begin() + (long)i + 1, fds.end());
+      std::sort(deferred_fds_.begin(), deferred_fds_.end());
+      break;
+    }
+  }
+}
+void IoLoop::CallSoon(NormalCallback callback) {
+  pending_callbacks_.emplace_back(std::move(callback));
+}
+void IoLoop::DoPendingCallbacks() {
+  if (pending_callbacks_.empty()) {
+    return;
+  }
+  // callbacks may queue new callbacks, those are run next iteration
+  std::vector<NormalCallback> callbacks;
+  callbacks.swap(pending_callbacks_);
+  for (const auto& callback : callbacks) {
+    callback();
   }
 }
 TimerId IoLoop::CallAt(TimePoint when, TimerTask callback) {
@@ -100,7 +221,34 @@ TimerId IoLoop::CallEvery(int interval, TimerTask callback) {
   auto expired = TimePoint::now() + interval;
   return timer_manager_->AddTimer(expired, std::move(callback), interval);
 }
+Watchdog* IoLoop::GetOrCreateWatchdog() {
+  if (!watchdog_) {
+    watchdog_ = std::make_unique<Watchdog>(this);
+  }
+  return watchdog_.get();
+}
+void IoLoop::SetSlowCallbackThreshold(int slow_callback_ms) {
+  Watchdog* watchdog = GetOrCreateWatchdog();
+  watchdog->SetSlowCallbackThreshold(slow_callback_ms);
+  callback_watchdog_ = watchdog->IsTimingCallbacks() ? watchdog : nullptr;
+  timer_manager_->SetWatchdog(callback_watchdog_);
+}
+void IoLoop::SetStuckThreshold(int stuck_ms) {
+  GetOrCreateWatchdog()->SetStuckThreshold(stuck_ms);
+}
 IoWatcher* IoLoop::GetWatcherRawPoint() { return io_watcher_.get(); }
+Resolver* IoLoop::GetResolver() {
+  if (!resolver_) {
+    resolver_ = std::make_unique<Resolver>(this);
+  }
+  return resolver_.get();
+}
+TrafficShaper* IoLoop::GetTrafficShaper() {
+  if (!traffic_shaper_) {
+    traffic_shaper_ = std::make_unique<TrafficShaper>(this);
+  }
+  return traffic_shaper_.get();
+}
 IoLoop* IoLoop::GetLoop() {
   if (!current_loop_thread) {
     static IoLoop loop;
@@ -7,26 +7,64 @@
 
 #include "ioevent.h"
 #include "iowatcher.h"
+#include "looptelemetry.h"
 #include "platform.h"
 #include "poll.h"
 #include "socket.h"
 #include "timepoint.h"
 #include "timermanager.h"
+#include "watchdog.h"
 namespace tohka {
 class IoLoop : public noncopyable {
  public:
   using TimerTask = std::function<void()>;
   IoLoop();
-  ~IoLoop() = default;
+  ~IoLoop();
   void RunForever();
   void Quit() { running_ = false; };
 
-  //  void CallSoon();
+  // run callback at the end of the current loop iteration
+  void CallSoon(NormalCallback callback);
   TimerId CallAt(TimePoint when, TimerTask callback);
   TimerId CallLater(int delay, TimerTask callback);
   TimerId CallEvery(int interval, TimerTask callback);
   void DeleteTimer(const TimerId& timer_id);
 
+  // Scheduling budgets, 0 means unlimited.
+  // Max bytes one connection reads or writes per ready event, the rest is
+  // left in the socket (or out buffer) for the next iteration.
+  void SetMaxIoBytes(size_t max_io_bytes) { max_io_bytes_ = max_io_bytes; }
+  size_t GetMaxIoBytes() const { return max_io_bytes_; }
+  // Max time spent in io callbacks per iteration before timers run. Events
+  // not handled in time go first in the next iteration, which polls without
+  // waiting.
+  void SetMaxCallbackTime(int max_callback_time_ms) {
+    max_callback_time_ms_ = max_callback_time_ms;
+  }
+
+  // Record where each iteration spends its time into histograms any thread
+  // may read, see LoopTelemetry. Off by default, it costs a few clock reads
+  // per iteration. Turning it off keeps what was recorded.
+  void EnableTelemetry(bool on);
+  // nullptr until telemetry is first enabled
+  const LoopTelemetry* GetTelemetry() const { return telemetry_.get(); }
+
+  // Find what blocks the loop, see Watchdog. Call on the loop's thread.
+  // Log io and timer callbacks slower than slow_callback_ms, 0 is off.
+  void SetSlowCallbackThreshold(int slow_callback_ms);
+  // Dump the loop thread's stack when an iteration runs callbacks longer
+  // than stuck_ms, checked by a thread of its own, 0 is off.
+  void SetStuckThreshold(int stuck_ms);
+  // nullptr until one of the above is set
+  const Watchdog* GetWatchdog() const { return watchdog_.get(); }
+  /// Internal use only, nullptr unless callbacks are timed.
+  Watchdog* GetCallbackWatchdog() const { return callback_watchdog_; }
+
+  // DNS resolver of this loop, created on first use
+  Resolver* GetResolver();
+  // resumes rate limited connections, created on first use
+  TrafficShaper* GetTrafficShaper();
+
   IoWatcher* GetWatcherRawPoint();
   static IoLoop* GetLoop();
 
@@ -35,6 +73,22 @@ class IoLoop : public noncopyable {
   using TimerManagerPtr = std::unique_ptr<TimerManager>;
   IoWatcherPtr io_watcher_;
   TimerManagerPtr timer_manager_;
+  // after the watcher and timers, it unregisters from them when destroyed
+  std::unique_ptr<Resolver> resolver_;
+  std::unique_ptr<TrafficShaper> traffic_shaper_;
+  void DoPendingCallbacks();
+  void DoIoEvents(EventList& activate_event_list);
+  void RunIteration(EventList& activate_event_list);
+  std::vector<NormalCallback> pending_callbacks_;
+  size_t max_io_bytes_;
+  int max_callback_time_ms_;
+  // fds of events skipped by the callback time budget, sorted
+  std::vector<int> deferred_fds_;
+  std::unique_ptr<LoopTelemetry> telemetry_;
+  bool telemetry_on_;
+  Watchdog* GetOrCreateWatchdog();
+  std::unique_ptr<Watchdog> watchdog_;
+  Watchdog* callback_watchdog_;
 
   bool running_;
 };
@@ -0,0 +1,99 @@
+//
+// Created by li on 2022/6/14.
+//
+
+#include "ipcounter.h"
+
+using namespace tohka;
+
+namespace {
+size_t Hash(uint64_t high, uint64_t low) {
+  // splitmix64 finalizer
+  uint64_t x = high ^ (low * 0x9e3779b97f4a7c15ULL);
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+  return (size_t)(x ^ (x >> 31));
+}
+}  // namespace
+
+IpCounter::IpCounter() : slots_(kInitialCapacity), size_(0) {}
+
+void IpCounter::ToKey(const NetAddress& address, uint64_t* high,
+                      uint64_t* low) {
+  unsigned char bytes[16]{};
+  const sockaddr* sock = address.GetAddress();
+  if (sock->sa_family == AF_INET6) {
+    ::memcpy(bytes, &((const sockaddr_in6*)sock)->sin6_addr, 16);
+  } else {
+    bytes[10] = 0xff;
+    bytes[11] = 0xff;
+    ::memcpy(bytes + 12, &((const sockaddr_in*)sock)->sin_addr, 4);
+  }
+  ::memcpy(high, bytes, 8);
+  ::memcpy(low, bytes + 8, 8);
+}
+size_t IpCounter::Find(uint64_t high, uint64_t low) const {
+  size_t index = Hash(high, low) & Mask();
+  // the table is never full, stop at the first empty slot
+  while (slots_[index].count != 0 &&
+         (slots_[index].high != high || slots_[index].low != low)) {
+    index = (index + 1) & Mask();
+  }
+  return index;
+}
+uint32_t IpCounter::Increase(const NetAddress& address) {
+  // keep load factor under 0.7
+  if ((size_ + 1) * 10 > slots_.size() * 7) {
+    Grow();
+  }
+  uint64_t high, low;
+  ToKey(address, &high, &low);
+  Slot& slot = slots_[Find(high, low)];
+  if (slot.count == 0) {
+    slot.high = high;
+    slot.low = low;
+    ++size_;
+  }
+  return ++slot.count;
+}
+void IpCounter::Decrease(const NetAddress& address) {
+  uint64_t high, low;
+  ToKey(address, &high, &low);
+  size_t index = Find(high, low);
+  if (slots_[index].count == 0) {
+    return;
+  }
+  if (--slots_[index].count == 0) {
+    Erase(index);
+  }
+}
+uint32_t IpCounter::Get(const NetAddress& address) const {
+  uint64_t high, low;
+  ToKey(address, &high, &low);
+  return slots_[Find(high, low)].count;
+}
+void IpCounter::Grow() {
+  std::vector<Slot> old(slots_.size() * 2);
+  old.swap(slots_);
+  for (const auto& slot : old) {
+    if (slot.count != 0) {
+      slots_[Find(slot.high, slot.low)] = slot;
+    }
+  }
+}
+void IpCounter::Erase(size_t index) {
+  // backward shift deletion, no tombstones
+  --size_;
+  size_t hole = index;
+  size_t next = (hole + 1) & Mask();
+  while (slots_[next].count != 0) {
+    size_t home = Hash(slots_[next].high, slots_[next].low) & Mask();
+    // move next into the hole if its home is not in (hole, next]
+    if (((next - home) & Mask()) >= ((next - hole) & Mask())) {
+      slots_[hole] = slots_[next];
+      hole = next;
+    }
+    next = (next + 1) & Mask();
+  }
+  slots_[hole].count = 0;
+}
@@ -0,0 +1,40 @@
+//
+// Created by li on 2022/6/14.
+//
+
+#ifndef TOHKA_TOHKA_IPCOUNTER_H
+#define TOHKA_TOHKA_IPCOUNTER_H
+
+#include "netaddress.h"
+#include "platform.h"
+
+namespace tohka {
+// Count of live connections per source ip. Open addressing with linear
+// probing over one flat array, ipv4 is stored as ipv4-mapped ipv6.
+class IpCounter {
+ public:
+  IpCounter();
+
+  // return the count after increase
+  uint32_t Increase(const NetAddress& address);
+  void Decrease(const NetAddress& address);
+  uint32_t Get(const NetAddress& address) const;
+  size_t Size() const { return size_; }
+
+ private:
+  struct Slot {
+    uint64_t high;
+    uint64_t low;
+    uint32_t count;  // 0 means empty
+  };
+  static constexpr size_t kInitialCapacity = 64;
+  static void ToKey(const NetAddress& address, uint64_t* high, uint64_t* low);
+  size_t Find(uint64_t high, uint64_t low) const;
+  size_t Mask() const { return slots_.size() - 1; }
+  void Grow();
+  void Erase(size_t index);
+  std::vector<Slot> slots_;
+  size_t size_;
+};
+}  // namespace tohka
+#endif  // TOHKA_TOHKA_IPCOUNTER_H
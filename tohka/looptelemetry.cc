@@ -0,0 +1,55 @@
+//
+// Created by li on 2022/7/11.
+//
+
+#include "looptelemetry.h"
+using namespace tohka;
+
+Log2Histogram::Log2Histogram() : count_(0), sum_(0), max_(0) {
+  for (auto& bucket : buckets_) {
+    bucket.store(0, std::memory_order_relaxed);
+  }
+}
+
+uint64_t Log2Histogram::GetPercentile(double percentile) const {
+  uint64_t count = GetCount();
+  if (count == 0) {
+    return 0;
+  }
+  auto rank = (uint64_t)(count * percentile / 100);
+  uint64_t seen = 0;
+  for (int i = 0; i < kBuckets; ++i) {
+    seen += GetBucket(i);
+    if (seen > rank) {
+      // the max is tighter than the bound of the last bucket
+      uint64_t bound = i == 0 ? 0 : (1ULL << i) - 1;
+      return std::min(bound, GetMax());
+    }
+  }
+  return GetMax();
+}
+std::string Log2Histogram::ToString() const {
+  uint64_t count = GetCount();
+  char buf[128];
+  snprintf(buf, sizeof(buf),
+           "count=%llu mean=%llu p50=%llu p99=%llu p999=%llu max=%llu",
+           (unsigned long long)count,
+           (unsigned long long)(count ? GetSum() / count : 0),
+           (unsigned long long)GetPercentile(50),
+           (unsigned long long)GetPercentile(99),
+           (unsigned long long)GetPercentile(99.9),
+           (unsigned long long)GetMax());
+  return buf;
+}
+
+std::string LoopTelemetry::ToString() const {
+  std::string result;
+  result += "poll_wait_us: " + poll_wait_us.ToString() + "\n";
+  result += "io_callback_us: " + io_callback_us.ToString() + "\n";
+  result += "timer_us: " + timer_us.ToString() + "\n";
+  result += "pending_callback_us: " + pending_callback_us.ToString() + "\n";
+  result += "ready_events: " + ready_events.ToString() + "\n";
+  result += "timers_fired: " + timers_fired.ToString() + "\n";
+  result += "lag_us: " + lag_us.ToString() + "\n";
+  return result;
+}
@@ -0,0 +1,79 @@
+//
+// Created by li on 2022/7/11.
+//
+
+#ifndef TOHKA_TOHKA_LOOPTELEMETRY_H
+#define TOHKA_TOHKA_LOOPTELEMETRY_H
+
+#include <atomic>
+
+#include "noncopyable.h"
+#include "tohka.h"
+namespace tohka {
+// Histogram with power of two buckets, bucket i counts values in
+// [2^(i-1), 2^i). Written by one thread without locks, any thread may read
+// it, a read racing with a write may be off by the sample being recorded.
+class Log2Histogram : noncopyable {
+ public:
+  static constexpr int kBuckets = 40;
+
+  Log2Histogram();
+  // only from the writing thread
+  void Record(uint64_t value) {
+    int bucket = value == 0 ? 0 : 64 - __builtin_clzll(value);
+    if (bucket >= kBuckets) {
+      bucket = kBuckets - 1;
+    }
+    Add(buckets_[bucket], 1);
+    Add(count_, 1);
+    Add(sum_, value);
+    if (value > max_.load(std::memory_order_relaxed)) {
+      max_.store(value, std::memory_order_relaxed);
+    }
+  }
+
+  uint64_t GetCount() const { return count_.load(std::memory_order_relaxed); }
+  uint64_t GetSum() const { return sum_.load(std::memory_order_relaxed); }
+  uint64_t GetMax() const { return max_.load(std::memory_order_relaxed); }
+  uint64_t GetBucket(int bucket) const {
+    return buckets_[bucket].load(std::memory_order_relaxed);
+  }
+  // upper bound of the bucket holding the given percentile, 0 to 100
+  uint64_t GetPercentile(double percentile) const;
+  // "count=10 mean=3 p50=4 p99=8 max=7"
+  std::string ToString() const;
+
+ private:
+  // one writer, no read modify write needed
+  static void Add(std::atomic<uint64_t>& counter, uint64_t value) {
+    counter.store(counter.load(std::memory_order_relaxed) + value,
+                  std::memory_order_relaxed);
+  }
+  std::atomic<uint64_t> buckets_[kBuckets];
+  std::atomic<uint64_t> count_;
+  std::atomic<uint64_t> sum_;
+  std::atomic<uint64_t> max_;
+};
+
+// What the iterations of one loop spent their time on, see
+// IoLoop::EnableTelemetry. Times are in microseconds.
+struct LoopTelemetry {
+  // blocked in PollEvents
+  Log2Histogram poll_wait_us;
+  // in io callbacks
+  Log2Histogram io_callback_us;
+  // in DoExpiredTimers
+  Log2Histogram timer_us;
+  // in callbacks queued with CallSoon
+  Log2Histogram pending_callback_us;
+  Log2Histogram ready_events;
+  Log2Histogram timers_fired;
+  // how late the loop woke up for a due timer, only for iterations that
+  // had one
+  Log2Histogram lag_us;
+
+  std::string ToString() const;
+};
+}  // namespace tohka
+
+#endif  // TOHKA_TOHKA_LOOPTELEMETRY_H
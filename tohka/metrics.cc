@@ -0,0 +1,176 @@
+//
+// Created by li on 2022/7/12.
+//
+
+#include "metrics.h"
+
+#include "util/log.h"
+using namespace tohka;
+
+namespace {
+// gives the shard of a thread back to the registry when the thread exits
+struct ShardHolder {
+  ~ShardHolder() { MetricsShard::Retire(); }
+};
+thread_local ShardHolder t_shard_holder;
+
+std::string FormatDouble(double value) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%.9g", value);
+  return buf;
+}
+}  // namespace
+
+thread_local MetricsShard* MetricsShard::t_current_ = nullptr;
+
+MetricsShard::MetricsShard() {
+  for (auto& slot : slots_) {
+    slot.store(0, std::memory_order_relaxed);
+  }
+}
+MetricsShard* MetricsShard::Create() {
+  auto* shard = new MetricsShard();
+  MetricsRegistry::Get()->AddShard(shard);
+  t_current_ = shard;
+  // constructs the holder of this thread
+  (void)t_shard_holder;
+  return shard;
+}
+void MetricsShard::Retire() {
+  if (t_current_ != nullptr) {
+    MetricsRegistry::Get()->RemoveShard(t_current_);
+    t_current_ = nullptr;
+  }
+}
+
+MetricsRegistry::MetricsRegistry()
+    : retired_(MetricsShard::kMaxSlots, 0),
+      next_slot_(MetricsShard::kSinkSlots) {}
+MetricsRegistry* MetricsRegistry::Get() {
+  // never destroyed, threads may still exit after static destruction
+  static auto* registry = new MetricsRegistry();
+  return registry;
+}
+
+Counter* MetricsRegistry::AddCounter(const std::string& name,
+                                     const std::string& help) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (Metric* metric = Find(name)) {
+    assert(metric->GetKind() == Metric::kCounter);
+    return static_cast<Counter*>(metric);
+  }
+  auto* counter = new Counter(name, help, AllocateSlots(name, 1));
+  metrics_.emplace_back(counter);
+  return counter;
+}
+Gauge* MetricsRegistry::AddGauge(const std::string& name,
+                                 const std::string& help) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (Metric* metric = Find(name)) {
+    assert(metric->GetKind() == Metric::kGauge);
+    return static_cast<Gauge*>(metric);
+  }
+  auto* gauge = new Gauge(name, help, AllocateSlots(name, 1));
+  metrics_.emplace_back(gauge);
+  return gauge;
+}
+Histogram* MetricsRegistry::AddHistogram(const std::string& name,
+                                         const std::string& help,
+                                         std::vector<int64_t> bounds,
+                                         double scale) {
+  assert(std::is_sorted(bounds.begin(), bounds.end()));
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (Metric* metric = Find(name)) {
+    assert(metric->GetKind() == Metric::kHistogram);
+    return static_cast<Histogram*>(metric);
+  }
+  int slot = AllocateSlots(name, (int)bounds.size() + 2);
+  if (slot == 0) {
+    // without buckets every observation lands in the sink slot
+    bounds.clear();
+  }
+  auto* histogram =
+      new Histogram(name, help, slot, std::move(bounds), scale);
+  metrics_.emplace_back(histogram);
+  return histogram;
+}
+Metric* MetricsRegistry::Find(const std::string& name) {
+  for (const auto& metric : metrics_) {
+    if (metric->GetName() == name) {
+      return metric.get();
+    }
+  }
+  return nullptr;
+}
+int MetricsRegistry::AllocateSlots(const std::string& name, int count) {
+  if (next_slot_ + count > MetricsShard::kMaxSlots) {
+    log_error("[MetricsRegistry::AllocateSlots]->no slot left for %s",
+              name.c_str());
+    return 0;
+  }
+  int slot = next_slot_;
+  next_slot_ += count;
+  return slot;
+}
+
+void MetricsRegistry::AddShard(MetricsShard* shard) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  shards_.push_back(shard);
+}
+void MetricsRegistry::RemoveShard(MetricsShard* shard) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (int i = 0; i < MetricsShard::kMaxSlots; ++i) {
+    retired_[i] += shard->Get(i);
+  }
+  shards_.erase(std::find(shards_.begin(), shards_.end(), shard));
+  delete shard;
+}
+
+std::string MetricsRegistry::Scrape() {
+  std::lock_guard<std::mutex> lock(mutex_);
+  std::vector<int64_t> totals(retired_);
+  for (const auto* shard : shards_) {
+    for (int i = MetricsShard::kSinkSlots; i < next_slot_; ++i) {
+      totals[i] += shard->Get(i);
+    }
+  }
+
+  std::string result;
+  for (const auto& metric : metrics_) {
+    const std::string& name = metric->GetName();
+    if (metric->slot_ == 0) {
+      continue;
+    }
+    result += "# HELP " + name + " " + metric->GetHelp() + "\n";
+    switch (metric->GetKind()) {
+      case Metric::kCounter:
+        result += "# TYPE " + name + " counter\n";
+        result += name + " " + std::to_string(totals[metric->slot_]) + "\n";
+        break;
+      case Metric::kGauge:
+        result += "# TYPE " + name + " gauge\n";
+        result += name + " " + std::to_string(totals[metric->slot_]) + "\n";
+        break;
+      case Metric::kHistogram: {
+        auto* histogram = static_cast<Histogram*>(metric.get());
+        const auto& bounds = histogram->GetBounds();
+        double scale = histogram->GetScale();
+        result += "# TYPE " + name + " histogram\n";
+        // the buckets of the exposition are cumulative
+        int64_t count = 0;
+        for (size_t i = 0; i <= bounds.size(); ++i) {
+          count += totals[metric->slot_ + i];
+          std::string le =
+              i < bounds.size() ? FormatDouble(bounds[i] * scale) : "+Inf";
+          result += name + "_bucket{le=\"" + le + "\"} " +
+                    std::to_string(count) + "\n";
+        }
+        int64_t sum = totals[metric->slot_ + bounds.size() + 1];
+        result += name + "_sum " + FormatDouble(sum * scale) + "\n";
+        result += name + "_count " + std::to_string(count) + "\n";
+        break;
+      }
+    }
+  }
+  return result;
+}
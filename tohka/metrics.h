@@ -0,0 +1,151 @@
+//
+// Created by li on 2022/7/12.
+//
+
+#ifndef TOHKA_TOHKA_METRICS_H
+#define TOHKA_TOHKA_METRICS_H
+
+#include <atomic>
+#include <mutex>
+
+#include "noncopyable.h"
+#include "tohka.h"
+namespace tohka {
+// Values of all metrics written by one thread, that is by one loop. Only
+// the owning thread writes, so an update is a load and a store with no
+// contention, MetricsRegistry::Scrape sums the shards of all threads.
+class MetricsShard : noncopyable {
+ public:
+  static constexpr int kMaxSlots = 2048;
+  // where the updates of metrics that did not get slots go, enough for a
+  // histogram without buckets
+  static constexpr int kSinkSlots = 2;
+
+  MetricsShard();
+  static MetricsShard* Current() {
+    return t_current_ != nullptr ? t_current_ : Create();
+  }
+  void Add(int slot, int64_t value) {
+    slots_[slot].store(slots_[slot].load(std::memory_order_relaxed) + value,
+                       std::memory_order_relaxed);
+  }
+  int64_t Get(int slot) const {
+    return slots_[slot].load(std::memory_order_relaxed);
+  }
+  /// Internal use only, hands the shard of this thread to the registry on
+  /// thread exit.
+  static void Retire();
+
+ private:
+  static MetricsShard* Create();
+  static thread_local MetricsShard* t_current_;
+  std::atomic<int64_t> slots_[kMaxSlots];
+};
+
+class Metric : noncopyable {
+ public:
+  enum Kind { kCounter, kGauge, kHistogram };
+  const std::string& GetName() const { return name_; }
+  const std::string& GetHelp() const { return help_; }
+  Kind GetKind() const { return kind_; }
+
+ protected:
+  Metric(std::string name, std::string help, Kind kind, int slot)
+      : name_(std::move(name)), help_(std::move(help)), kind_(kind),
+        slot_(slot) {}
+  friend class MetricsRegistry;
+  std::string name_;
+  std::string help_;
+  Kind kind_;
+  int slot_;
+};
+
+class Counter : public Metric {
+ public:
+  void Inc(int64_t n = 1) { MetricsShard::Current()->Add(slot_, n); }
+
+ private:
+  friend class MetricsRegistry;
+  Counter(std::string name, std::string help, int slot)
+      : Metric(std::move(name), std::move(help), kCounter, slot) {}
+};
+
+// Only moves by deltas, the value is the sum over all threads, so a gauge
+// of a per loop quantity reads as the total of all loops
+class Gauge : public Metric {
+ public:
+  void Add(int64_t n) { MetricsShard::Current()->Add(slot_, n); }
+  void Inc() { Add(1); }
+  void Dec() { Add(-1); }
+
+ private:
+  friend class MetricsRegistry;
+  Gauge(std::string name, std::string help, int slot)
+      : Metric(std::move(name), std::move(help), kGauge, slot) {}
+};
+
+// Fixed bucket histogram of integer observations. scale converts them to
+// the exposed unit, observe microseconds and scale by 1e-6 to expose
+// seconds.
+class Histogram : public Metric {
+ public:
+  void Observe(int64_t value) {
+    size_t bucket = 0;
+    while (bucket < bounds_.size() && value > bounds_[bucket]) {
+      ++bucket;
+    }
+    MetricsShard* shard = MetricsShard::Current();
+    shard->Add(slot_ + (int)bucket, 1);
+    shard->Add(slot_ + (int)bounds_.size() + 1, value);
+  }
+  const std::vector<int64_t>& GetBounds() const { return bounds_; }
+  double GetScale() const { return scale_; }
+
+ private:
+  friend class MetricsRegistry;
+  // the buckets, one more for +Inf, then the sum
+  Histogram(std::string name, std::string help, int slot,
+            std::vector<int64_t> bounds, double scale)
+      : Metric(std::move(name), std::move(help), kHistogram, slot),
+        bounds_(std::move(bounds)),
+        scale_(scale) {}
+  std::vector<int64_t> bounds_;
+  double scale_;
+};
+
+// Process wide set of metrics. Register metrics once, on setup, and keep
+// the pointers, adding a metric with a name that exists returns the
+// existing one.
+class MetricsRegistry : noncopyable {
+ public:
+  static MetricsRegistry* Get();
+
+  Counter* AddCounter(const std::string& name, const std::string& help);
+  Gauge* AddGauge(const std::string& name, const std::string& help);
+  // bounds are the inclusive upper bounds of the buckets, ascending
+  Histogram* AddHistogram(const std::string& name, const std::string& help,
+                          std::vector<int64_t> bounds, double scale = 1);
+
+  // all metrics in the prometheus text format
+  std::string Scrape();
+
+  /// Internal use only, called by MetricsShard.
+  void AddShard(MetricsShard* shard);
+  void RemoveShard(MetricsShard* shard);
+
+ private:
+  MetricsRegistry();
+  Metric* Find(const std::string& name);
+  // first of count slots, 0 (the sink) when out of slots
+  int AllocateSlots(const std::string& name, int count);
+
+  std::mutex mutex_;
+  std::vector<std::unique_ptr<Metric>> metrics_;
+  std::vector<MetricsShard*> shards_;
+  // totals of the shards of exited threads
+  std::vector<int64_t> retired_;
+  int next_slot_;
+};
+}  // namespace tohka
+
+#endif  // TOHKA_TOHKA_METRICS_H
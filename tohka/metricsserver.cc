@@ -0,0 +1,63 @@
+//
+// Created by li on 2022/7/12.
+//
+
+#include "metricsserver.h"
+
+#include "iobuf.h"
+#include "util/log.h"
+using namespace tohka;
+
+MetricsServer::MetricsServer(IoLoop* loop, const NetAddress& bind_address,
+                             MetricsRegistry* registry)
+    : server_(loop, bind_address), registry_(registry) {
+  // scrapes are not traffic of the servers being measured
+  server_.EnableMetrics(false);
+  server_.SetOnMessage(std::bind(&MetricsServer::OnMessage, this,
+                                 std::placeholders::_1,
+                                 std::placeholders::_2));
+}
+
+void MetricsServer::OnMessage(const TcpEventPrt_t& conn, IoBuf* buf) {
+  if (!conn->Connected()) {
+    // replied, waiting for the client to close
+    buf->Retrieve(buf->GetReadableSize());
+    return;
+  }
+  std::string_view request(buf->Peek(), buf->GetReadableSize());
+  if (request.find("\r\n\r\n") == std::string_view::npos) {
+    if (request.size() > kMaxRequestSize) {
+      log_warn("[MetricsServer::OnMessage]->request too large from %s",
+               conn->GetPeerIpAndPort().c_str());
+      conn->ForceClose();
+    }
+    return;
+  }
+  std::string_view line = request.substr(0, request.find("\r\n"));
+  buf->Retrieve(buf->GetReadableSize());
+  if (line.substr(0, 4) != "GET ") {
+    Reply(conn, "405 Method Not Allowed", "");
+    return;
+  }
+  // the path, without a query
+  std::string_view path = line.substr(4, line.find(' ', 4) - 4);
+  path = path.substr(0, path.find('?'));
+  if (path != "/metrics") {
+    Reply(conn, "404 Not Found", "");
+    return;
+  }
+  Reply(conn, "200 OK", registry_->Scrape());
+}
+void MetricsServer::Reply(const TcpEventPrt_t& conn, const char* status,
+                          const std::string& body) {
+  std::string response = "HTTP/1.1 ";
+  response += status;
+  response +=
+      "\r\nContent-Type: text/plain; version=0.0.4\r\n"
+      "Connection: close\r\n"
+      "Content-Length: " +
+      std::to_string(body.size()) + "\r\n\r\n";
+  response += body;
+  conn->Send(response);
+  conn->ShutDown();
+}
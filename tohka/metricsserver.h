@@ -0,0 +1,35 @@
+//
+// Created by li on 2022/7/12.
+//
+
+#ifndef TOHKA_TOHKA_METRICSSERVER_H
+#define TOHKA_TOHKA_METRICSSERVER_H
+
+#include "metrics.h"
+#include "netaddress.h"
+#include "noncopyable.h"
+#include "tcpserver.h"
+#include "tohka.h"
+namespace tohka {
+// Answers "GET /metrics" with MetricsRegistry::Scrape, one request per
+// connection. Runs on a loop of the process, a scrape takes the registry
+// lock for the time of merging the shards.
+class MetricsServer : noncopyable {
+ public:
+  MetricsServer(IoLoop* loop, const NetAddress& bind_address,
+                MetricsRegistry* registry = MetricsRegistry::Get());
+
+  void Run() { server_.Run(); }
+
+ private:
+  void OnMessage(const TcpEventPrt_t& conn, IoBuf* buf);
+  void Reply(const TcpEventPrt_t& conn, const char* status,
+             const std::string& body);
+  // requests with larger headers are dropped
+  static constexpr size_t kMaxRequestSize = 8192;
+  TcpServer server_;
+  MetricsRegistry* registry_;
+};
+}  // namespace tohka
+
+#endif  // TOHKA_TOHKA_METRICSSERVER_H
@@ -0,0 +1,283 @@
+//
+// Created by li on 2022/6/20.
+//
+
+#include "multiconnector.h"
+
+#include "ioloop.h"
+#include "util/log.h"
+using namespace tohka;
+
+MultiConnector::MultiConnector(IoLoop* loop,
+                               const std::vector<NetAddress>& candidates)
+    : loop_(loop),
+      hedge_pending_(false),
+      hedge_candidate_(0),
+      hedge_replaces_attempt_(false),
+      next_attempt_(0),
+      failed_attempts_(0),
+      winner_(0),
+      connect_(false),
+      retry_(true),
+      attempt_delay_ms_(kDefaultAttemptDelayMs),
+      retry_delay_ms_(kInitDelayMs),
+      enable_connect_timeout_(false),
+      connect_timeout_ms_(0),
+      enable_fast_open_(false) {
+  SetCandidates(candidates);
+}
+MultiConnector::~MultiConnector() { Stop(); }
+
+void MultiConnector::SetCandidates(const std::vector<NetAddress>& candidates) {
+  assert(!connect_);
+  attempts_.clear();
+  hedge_.reset();
+  winner_ = 0;
+  for (const auto& address : Interleave(candidates)) {
+    attempts_.push_back(NewAttempt(address, attempts_.size()));
+  }
+}
+std::unique_ptr<Connector> MultiConnector::NewAttempt(
+    const NetAddress& address, size_t index) {
+  auto attempt = std::make_unique<Connector>(loop_, address);
+  attempt->SetRetry(false);
+  attempt->EnableConnectTimeout(enable_connect_timeout_);
+  if (connect_timeout_ms_ > 0) {
+    attempt->SetConnectTimeout(connect_timeout_ms_);
+  }
+  attempt->EnableFastOpen(enable_fast_open_);
+  attempt->SetSourcePool(source_pool_);
+  attempt->SetOnConnect(
+      [this, index](int sock_fd) { OnAttemptConnect(index, sock_fd); });
+  attempt->SetOnConnectFailed([this, index] { OnAttemptFailed(index); });
+  return attempt;
+}
+
+void MultiConnector::Start() {
+  assert(!attempts_.empty());
+  connect_ = true;
+  next_attempt_ = 0;
+  failed_attempts_ = 0;
+  hedge_pending_ = false;
+  round_started_ = TimePoint::now();
+  if (hedge_policy_) {
+    // armed first, the round may fail before StartNextAttempt returns
+    DeleteTimer(hedge_timer_);
+    hedge_timer_ = loop_->CallLater(hedge_policy_->GetDelayMs(), [this] {
+      hedge_timer_ = TimerId();
+      StartHedge();
+    });
+  }
+  StartNextAttempt();
+}
+void MultiConnector::Restart() {
+  Stop();
+  retry_delay_ms_ = kInitDelayMs;
+  Start();
+}
+void MultiConnector::Stop() {
+  connect_ = false;
+  DeleteTimer(attempt_timer_);
+  DeleteTimer(retry_timer_);
+  DeleteTimer(hedge_timer_);
+  StopAttempts();
+  hedge_pending_ = false;
+}
+
+void MultiConnector::EnableConnectTimeout(bool on) {
+  enable_connect_timeout_ = on;
+  for (auto& attempt : attempts_) {
+    attempt->EnableConnectTimeout(on);
+  }
+}
+void MultiConnector::SetConnectTimeout(int connect_timeout_ms) {
+  connect_timeout_ms_ = connect_timeout_ms;
+  for (auto& attempt : attempts_) {
+    attempt->SetConnectTimeout(connect_timeout_ms);
+  }
+}
+void MultiConnector::EnableFastOpen(bool on) {
+  enable_fast_open_ = on;
+  for (auto& attempt : attempts_) {
+    attempt->EnableFastOpen(on);
+  }
+}
+void MultiConnector::SetSourcePool(
+    const std::shared_ptr<SourceAddressPool>& source_pool) {
+  source_pool_ = source_pool;
+  for (auto& attempt : attempts_) {
+    attempt->SetSourcePool(source_pool);
+  }
+}
+SourceAddressPool::LeasePtr_t MultiConnector::TakeSourceLease() {
+  if (winner_ == kHedgeIndex) {
+    return hedge_->TakeSourceLease();
+  }
+  if (attempts_.empty()) {
+    return nullptr;
+  }
+  return attempts_[winner_]->TakeSourceLease();
+}
+NetAddress& MultiConnector::GetPeerAddress() {
+  if (winner_ == kHedgeIndex) {
+    return hedge_->GetPeerAddress();
+  }
+  if (attempts_.empty()) {
+    return no_address_;
+  }
+  return attempts_[winner_]->GetPeerAddress();
+}
+
+void MultiConnector::StartNextAttempt() {
+  DeleteTimer(attempt_timer_);
+  if (next_attempt_ >= attempts_.size()) {
+    return;
+  }
+  size_t index = next_attempt_++;
+  // armed first, a synchronous failure below starts the next one itself
+  if (next_attempt_ < attempts_.size()) {
+    attempt_timer_ = loop_->CallLater(attempt_delay_ms_, [this] {
+      attempt_timer_ = TimerId();
+      StartNextAttempt();
+    });
+  }
+  log_debug("[MultiConnector::StartNextAttempt]->connect %s",
+            attempts_[index]->GetPeerAddress().GetIpAndPort().c_str());
+  attempts_[index]->Restart();
+}
+void MultiConnector::StartHedge() {
+  if (next_attempt_ < attempts_.size()) {
+    // the hedge takes the place of the next attempt in the round
+    hedge_candidate_ = next_attempt_++;
+    hedge_replaces_attempt_ = true;
+  } else {
+    // every candidate has an attempt, hedge the one in flight the longest:
+    // a lost SYN waits for the retransmission timeout, a second one may not
+    hedge_candidate_ = attempts_.size();
+    for (size_t i = 0; i < next_attempt_; ++i) {
+      if (attempts_[i]->IsConnecting()) {
+        hedge_candidate_ = i;
+        break;
+      }
+    }
+    if (hedge_candidate_ == attempts_.size()) {
+      log_debug("[MultiConnector::StartHedge]->no candidate in flight");
+      return;
+    }
+    hedge_replaces_attempt_ = false;
+  }
+  const NetAddress& address = attempts_[hedge_candidate_]->GetPeerAddress();
+  log_debug("[MultiConnector::StartHedge]->hedge to %s",
+            address.GetIpAndPort().c_str());
+  hedge_ = NewAttempt(address, kHedgeIndex);
+  hedge_pending_ = true;
+  hedge_policy_->OnHedgeSent();
+  hedge_->Start();
+}
+void MultiConnector::OnAttemptConnect(size_t index, int sock_fd) {
+  if (hedge_policy_) {
+    hedge_policy_->RecordConnectTime(TimePoint::now().GetMicroSeconds() -
+                                     round_started_.GetMicroSeconds());
+    if (index == kHedgeIndex) {
+      hedge_policy_->OnHedgeWon();
+    }
+  }
+  winner_ = index;
+  retry_delay_ms_ = kInitDelayMs;
+  DeleteTimer(attempt_timer_);
+  DeleteTimer(hedge_timer_);
+  hedge_pending_ = false;
+  // the winner is connected, Stop leaves it alone
+  StopAttempts();
+  on_connect_(sock_fd);
+}
+void MultiConnector::OnAttemptFailed(size_t index) {
+  if (index == kHedgeIndex) {
+    log_debug("[MultiConnector::OnAttemptFailed]->hedge to %s failed",
+              hedge_->GetPeerAddress().GetIpAndPort().c_str());
+    hedge_pending_ = false;
+    if (!hedge_replaces_attempt_) {
+      // the candidate's own attempt is still counted
+      if (connect_) {
+        CheckRoundFailed();
+      }
+      return;
+    }
+    index = hedge_candidate_;
+  } else {
+    log_debug("[MultiConnector::OnAttemptFailed]->connect %s failed",
+              attempts_[index]->GetPeerAddress().GetIpAndPort().c_str());
+  }
+  ++failed_attempts_;
+  if (!connect_) {
+    return;
+  }
+  if (failed_attempts_ < attempts_.size()) {
+    // do not wait for the attempt delay once the latest one is gone
+    if (index + 1 == next_attempt_) {
+      StartNextAttempt();
+    }
+    return;
+  }
+  CheckRoundFailed();
+}
+void MultiConnector::CheckRoundFailed() {
+  if (failed_attempts_ < attempts_.size() || hedge_pending_ ||
+      retry_timer_.GetId() != 0) {
+    return;
+  }
+  log_info("[MultiConnector::CheckRoundFailed]->all %zu candidates failed",
+           attempts_.size());
+  DeleteTimer(attempt_timer_);
+  DeleteTimer(hedge_timer_);
+  if (!retry_) {
+    connect_ = false;
+    if (on_connect_failed_) {
+      on_connect_failed_();
+    }
+    return;
+  }
+  retry_timer_ = loop_->CallLater(retry_delay_ms_, [this] {
+    retry_timer_ = TimerId();
+    Start();
+  });
+  retry_delay_ms_ = std::min(retry_delay_ms_ * 2, kMaxDelayMs);
+}
+void MultiConnector::StopAttempts() {
+  for (auto& attempt : attempts_) {
+    attempt->Stop();
+  }
+  if (hedge_) {
+    hedge_->Stop();
+  }
+}
+void MultiConnector::DeleteTimer(TimerId& timer_id) {
+  if (timer_id.GetId() != 0) {
+    loop_->DeleteTimer(timer_id);
+    timer_id = TimerId();
+  }
+}
+
+std::vector<NetAddress> MultiConnector::Interleave(
+    const std::vector<NetAddress>& candidates) {
+  if (candidates.empty()) {
+    return {};
+  }
+  sa_family_t first_family = candidates.front().GetFamily();
+  std::vector<NetAddress> first;
+  std::vector<NetAddress> second;
+  for (const auto& address : candidates) {
+    (address.GetFamily() == first_family ? first : second).push_back(address);
+  }
+  std::vector<NetAddress> result;
+  result.reserve(candidates.size());
+  for (size_t i = 0; i < first.size() || i < second.size(); ++i) {
+    if (i < first.size()) {
+      result.push_back(first[i]);
+    }
+    if (i < second.size()) {
+      result.push_back(second[i]);
+    }
+  }
+  return result;
+}
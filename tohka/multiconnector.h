@@ -0,0 +1,118 @@
+//
+// Created by li on 2022/6/20.
+//
+
+#ifndef TOHKA_TOHKA_MULTICONNECTOR_H
+#define TOHKA_TOHKA_MULTICONNECTOR_H
+
+#include "connector.h"
+#include "hedgepolicy.h"
+#include "netaddress.h"
+#include "noncopyable.h"
+#include "timerid.h"
+#include "tohka.h"
+namespace tohka {
+// Happy eyeballs (RFC 8305) over a list of candidate addresses.
+//
+// Candidates are reordered to alternate address families, starting with the
+// family of the first one. The first attempt starts at once, the next one
+// after the attempt delay or as soon as the latest attempt fails. The first
+// connection made wins and the other attempts are cancelled. When all
+// candidates fail the whole round is retried with backoff, like Connector
+// does for one address.
+class MultiConnector : noncopyable {
+ public:
+  MultiConnector(IoLoop* loop, const std::vector<NetAddress>& candidates);
+  ~MultiConnector();
+
+  void SetOnConnect(OnConnectCallback on_connect) {
+    on_connect_ = std::move(on_connect);
+  }
+  // called instead of retrying once a round failed, if retry is off
+  void SetOnConnectFailed(NormalCallback on_connect_failed) {
+    on_connect_failed_ = std::move(on_connect_failed);
+  }
+
+  // replace the candidates, only while stopped
+  void SetCandidates(const std::vector<NetAddress>& candidates);
+
+  void Start();
+  void Restart();
+  void Stop();
+
+  // delay before the next attempt starts, 250ms by default
+  // retry failed rounds with backoff, on by default
+  void SetRetry(bool on) { retry_ = on; }
+  void SetAttemptDelay(int attempt_delay_ms) {
+    attempt_delay_ms_ = attempt_delay_ms;
+  }
+  // per attempt, a timed out attempt counts as failed
+  void EnableConnectTimeout(bool on);
+  void SetConnectTimeout(int connect_timeout_ms);
+  void EnableFastOpen(bool on);
+  void SetSourcePool(const std::shared_ptr<SourceAddressPool>& source_pool);
+  void SetHedgePolicy(std::shared_ptr<HedgePolicy> hedge_policy) {
+    hedge_policy_ = std::move(hedge_policy);
+  }
+  // see Connector::TakeSourceLease
+  SourceAddressPool::LeasePtr_t TakeSourceLease();
+  // the address connected to, or the first candidate before that
+  NetAddress& GetPeerAddress();
+  bool HasCandidates() const { return !attempts_.empty(); }
+
+ private:
+  std::unique_ptr<Connector> NewAttempt(const NetAddress& address,
+                                        size_t index);
+  void StartNextAttempt();
+  void StartHedge();
+  // retry the round later once every attempt and the hedge failed
+  void CheckRoundFailed();
+  void OnAttemptConnect(size_t index, int sock_fd);
+  void OnAttemptFailed(size_t index);
+  void StopAttempts();
+  void DeleteTimer(TimerId& timer_id);
+  static std::vector<NetAddress> Interleave(
+      const std::vector<NetAddress>& candidates);
+
+  // index of the hedge in the attempt callbacks
+  static constexpr size_t kHedgeIndex = SIZE_MAX;
+  static constexpr int kDefaultAttemptDelayMs = 250;
+  static constexpr int kInitDelayMs = 500;
+  static constexpr int kMaxDelayMs = 30 * 1000;
+  IoLoop* loop_;
+  std::vector<std::unique_ptr<Connector>> attempts_;
+  std::unique_ptr<Connector> hedge_;
+  // connect times are taken from here, as the caller sees them
+  TimePoint round_started_;
+  bool hedge_pending_;
+  // the candidate the hedge connects to
+  size_t hedge_candidate_;
+  // no attempt is started for hedge_candidate_, the hedge took its place.
+  // Otherwise the hedge is a second connect to a candidate in flight.
+  bool hedge_replaces_attempt_;
+  // returned by GetPeerAddress while there is no candidate
+  NetAddress no_address_;
+  size_t next_attempt_;
+  size_t failed_attempts_;
+  size_t winner_;
+  bool connect_;
+  bool retry_;
+  int attempt_delay_ms_;
+  int retry_delay_ms_;
+  // applied to the attempts of later candidates too
+  bool enable_connect_timeout_;
+  int connect_timeout_ms_;
+  bool enable_fast_open_;
+  std::shared_ptr<SourceAddressPool> source_pool_;
+  // starts the next attempt
+  TimerId attempt_timer_;
+  // restarts the round after every attempt failed
+  TimerId retry_timer_;
+  TimerId hedge_timer_;
+  std::shared_ptr<HedgePolicy> hedge_policy_;
+  OnConnectCallback on_connect_;
+  NormalCallback on_connect_failed_;
+};
+}  // namespace tohka
+
+#endif  // TOHKA_TOHKA_MULTICONNECTOR_H
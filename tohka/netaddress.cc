@@ -49,6 +49,9 @@ std::string NetAddress::GetIpAndPort() const {
   return GetIp() + ":" + std::to_string(GetPort());
 }
 sockaddr* NetAddress::GetAddress() { return (sockaddr*)&in6_; }
+const sockaddr* NetAddress::GetAddress() const {
+  return (const sockaddr*)&in6_;
+}
 uint32_t NetAddress::GetSize() const {
   if (in4_.sin_family == AF_INET) {
     return sizeof(struct sockaddr_in);
@@ -60,3 +63,14 @@ uint32_t NetAddress::GetSize() const {
 }
 sa_family_t NetAddress::GetFamily() const { return in4_.sin_family; }
 void NetAddress::SetSockAddrInet6(sockaddr_in6& in6) { in6_ = in6; }
+void NetAddress::SetSockAddrInet(const sockaddr_in& in4) {
+  ::memset(&in6_, 0, sizeof(in6_));
+  in4_ = in4;
+}
+void NetAddress::SetPort(uint16_t port) {
+  if (in4_.sin_family == AF_INET6) {
+    in6_.sin6_port = htons(port);
+  } else {
+    in4_.sin_port = htons(port);
+  }
+}
@@ -20,9 +20,12 @@ class NetAddress {
   std::string GetIpAndPort() const;
 
   sockaddr* GetAddress();
+  const sockaddr* GetAddress() const;
   uint32_t GetSize() const;
 
   void SetSockAddrInet6(sockaddr_in6& in6);
+  void SetSockAddrInet(const sockaddr_in& in4);
+  void SetPort(uint16_t port);
 
  private:
   union {
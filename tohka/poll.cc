@@ -7,6 +7,7 @@
 #include "ioevent.h"
 #include "timepoint.h"
 #include "tohka/tohka.h"
+#include "util/binlog.h"
 #include "util/log.h"
 
 using namespace tohka;
@@ -22,7 +23,7 @@ TimePoint Poll::PollEvents(int timeout, EventList* event_list) {
   //  }
   int active_events = poll(pfds_.data(), pfds_.size(), timeout);
   if (active_events > 0) {
-    log_trace("Poll::PollEvents %d events happened", active_events);
+    binlog_log_trace("Poll::PollEvents %d events happened", active_events);
     for (const auto pfd : pfds_) {
       if (pfd.revents > 0) {
         auto it = io_events_map.find(pfd.fd);
@@ -113,7 +114,7 @@ void Poll::RegisterEvent(IoEvent* io_event) {
     if (pfd.events == EV_NONE) {
       pfd.fd = -io_event->GetFd() - 1;
     }
-    log_trace(
+    binlog_log_trace(
         "Poll::RegisterEvent update event: fd = %d event:events=0x%x pfd "
         "events=0x%x",
         io_event->GetFd(), io_event->GetEvents(), pfd.events);
@@ -0,0 +1,31 @@
+//
+// Created by li on 2022/6/28.
+//
+
+#include "ratelimiter.h"
+
+using namespace tohka;
+
+RateLimiter::RateLimiter(double rate, double burst, RateLimiterPtr_t parent)
+    : bucket_(rate, burst), parent_(std::move(parent)) {}
+
+size_t RateLimiter::GetAllowance(size_t want, TimePoint now) {
+  for (RateLimiter* limiter = this; limiter && want > 0;
+       limiter = limiter->parent_.get()) {
+    double tokens = limiter->bucket_.GetTokens(now);
+    want = tokens < 1 ? 0 : std::min(want, (size_t)tokens);
+  }
+  return want;
+}
+void RateLimiter::Consume(size_t n, TimePoint now) {
+  for (RateLimiter* limiter = this; limiter; limiter = limiter->parent_.get()) {
+    limiter->bucket_.Consume((double)n, now);
+  }
+}
+int64_t RateLimiter::GetWaitMs(TimePoint now) {
+  int64_t wait_ms = 0;
+  for (RateLimiter* limiter = this; limiter; limiter = limiter->parent_.get()) {
+    wait_ms = std::max(wait_ms, limiter->bucket_.GetWaitMs(1, now));
+  }
+  return wait_ms;
+}
@@ -0,0 +1,40 @@
+//
+// Created by li on 2022/6/28.
+//
+
+#ifndef TOHKA_TOHKA_RATELIMITER_H
+#define TOHKA_TOHKA_RATELIMITER_H
+
+#include "noncopyable.h"
+#include "tokenbucket.h"
+#include "tohka.h"
+namespace tohka {
+// Byte rate limit of one connection or of a group of them.
+//
+// A limiter may have a parent, e.g. one per user under a global one, and
+// bytes are allowed only while every bucket up to the root has tokens.
+// Limiters are shared by the connections of the group, all of one loop.
+class RateLimiter : noncopyable {
+ public:
+  using RateLimiterPtr_t = std::shared_ptr<RateLimiter>;
+  // rate bytes per second, bursts up to burst bytes
+  RateLimiter(double rate, double burst, RateLimiterPtr_t parent = nullptr);
+
+  void SetRate(double rate, double burst) { bucket_.SetRate(rate, burst); }
+  const RateLimiterPtr_t& GetParent() const { return parent_; }
+
+  // bytes that may be moved now, at most want
+  size_t GetAllowance(size_t want, TimePoint now);
+  // account n bytes to this limiter and its parents
+  void Consume(size_t n, TimePoint now);
+  // milliseconds until every bucket up to the root has a token
+  int64_t GetWaitMs(TimePoint now);
+
+ private:
+  TokenBucket bucket_;
+  RateLimiterPtr_t parent_;
+};
+using RateLimiterPtr_t = RateLimiter::RateLimiterPtr_t;
+}  // namespace tohka
+
+#endif  // TOHKA_TOHKA_RATELIMITER_H
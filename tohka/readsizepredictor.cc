@@ -0,0 +1,59 @@
+//
+// Created by li on 2022/6/12.
+//
+
+#include "readsizepredictor.h"
+
+using namespace tohka;
+
+namespace {
+// 16 bytes step up to 512, then doubled up to kMaxSize
+const std::vector<size_t>& SizeTable() {
+  static const std::vector<size_t> size_table = [] {
+    std::vector<size_t> table;
+    for (size_t i = 16; i < 512; i += 16) {
+      table.push_back(i);
+    }
+    for (size_t i = 512; i <= ReadSizePredictor::kMaxSize; i <<= 1) {
+      table.push_back(i);
+    }
+    return table;
+  }();
+  return size_table;
+}
+}  // namespace
+
+ReadSizePredictor::ReadSizePredictor()
+    : index_(GetSizeTableIndex(kInitialSize)),
+      min_index_(GetSizeTableIndex(kMinSize)),
+      max_index_(GetSizeTableIndex(kMaxSize)),
+      next_read_size_(SizeTable()[index_]),
+      decrease_now_(false) {}
+
+void ReadSizePredictor::Record(size_t actual_bytes) {
+  const auto& table = SizeTable();
+  size_t lower = index_ > kIndexDecrement ? index_ - kIndexDecrement : 0;
+  if (actual_bytes <= table[lower]) {
+    if (decrease_now_) {
+      index_ = std::max(lower, min_index_);
+      next_read_size_ = table[index_];
+      decrease_now_ = false;
+    } else {
+      decrease_now_ = true;
+    }
+  } else if (actual_bytes >= next_read_size_) {
+    index_ = std::min(index_ + kIndexIncrement, max_index_);
+    next_read_size_ = table[index_];
+    decrease_now_ = false;
+  }
+}
+
+size_t ReadSizePredictor::GetSizeTableIndex(size_t size) {
+  const auto& table = SizeTable();
+  // first size not less than size
+  auto it = std::lower_bound(table.begin(), table.end(), size);
+  if (it == table.end()) {
+    return table.size() - 1;
+  }
+  return it - table.begin();
+}
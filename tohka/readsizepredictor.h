@@ -0,0 +1,37 @@
+//
+// Created by li on 2022/6/12.
+//
+
+#ifndef TOHKA_TOHKA_READSIZEPREDICTOR_H
+#define TOHKA_TOHKA_READSIZEPREDICTOR_H
+
+#include "platform.h"
+
+namespace tohka {
+// Guess the size of the next read from the recent reads, like netty's
+// AdaptiveRecvByteBufAllocator. Grows fast after a full read and shrinks
+// slowly after two small reads in a row.
+class ReadSizePredictor {
+ public:
+  static constexpr size_t kMinSize = 64;
+  static constexpr size_t kInitialSize = 4096;
+  static constexpr size_t kMaxSize = 256 * 1024;
+
+  ReadSizePredictor();
+
+  size_t NextReadSize() const { return next_read_size_; }
+  // record the bytes got by the last read
+  void Record(size_t actual_bytes);
+
+ private:
+  static constexpr size_t kIndexIncrement = 4;
+  static constexpr size_t kIndexDecrement = 1;
+  static size_t GetSizeTableIndex(size_t size);
+  size_t index_;
+  size_t min_index_;
+  size_t max_index_;
+  size_t next_read_size_;
+  bool decrease_now_;
+};
+}  // namespace tohka
+#endif  // TOHKA_TOHKA_READSIZEPREDICTOR_H
@@ -0,0 +1,603 @@
+//
+// Created by li on 2022/6/22.
+//
+
+#include "resolver.h"
+
+#include <fstream>
+#include <sstream>
+
+#include "ioloop.h"
+#include "socketutil.h"
+#include "util/log.h"
+using namespace tohka;
+
+namespace {
+constexpr uint16_t kTypeA = 1;
+constexpr uint16_t kTypeCname = 5;
+constexpr uint16_t kTypeSoa = 6;
+constexpr uint16_t kTypeAaaa = 28;
+constexpr uint16_t kTypeOpt = 41;
+constexpr uint16_t kClassIn = 1;
+constexpr uint16_t kFlagResponse = 0x8000;
+constexpr uint16_t kFlagTruncated = 0x0200;
+constexpr uint16_t kFlagRecursionDesired = 0x0100;
+constexpr uint16_t kRcodeNoError = 0;
+constexpr uint16_t kRcodeNxDomain = 3;
+constexpr size_t kHeaderSize = 12;
+// EDNS0 payload size, fits the minimum IPv6 MTU
+constexpr uint16_t kUdpPayloadSize = 1232;
+constexpr int kMaxPointers = 16;
+
+uint16_t ReadU16(const unsigned char* p) { return (p[0] << 8) | p[1]; }
+uint32_t ReadU32(const unsigned char* p) {
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+         ((uint32_t)p[2] << 8) | p[3];
+}
+void WriteU16(std::string* out, uint16_t v) {
+  out->push_back((char)(v >> 8));
+  out->push_back((char)(v & 0xff));
+}
+std::string ToLower(std::string s) {
+  std::transform(s.begin(), s.end(), s.begin(),
+                 [](unsigned char c) { return std::tolower(c); });
+  return s;
+}
+bool IsValidName(const std::string& name) {
+  if (name.empty() || name.size() > 253) {
+    return false;
+  }
+  size_t label = 0;
+  for (char c : name) {
+    if (c == '.') {
+      if (label == 0) {
+        return false;
+      }
+      label = 0;
+    } else if (++label > 63) {
+      return false;
+    }
+  }
+  return true;
+}
+// read a possibly compressed name at *pos and move *pos past it,
+// name may be nullptr to skip it
+bool ReadName(const unsigned char* msg, size_t len, size_t* pos,
+              std::string* name) {
+  size_t p = *pos;
+  bool jumped = false;
+  int pointers = 0;
+  size_t name_size = 0;
+  if (name) {
+    name->clear();
+  }
+  while (true) {
+    if (p >= len) {
+      return false;
+    }
+    unsigned char c = msg[p];
+    if ((c & 0xc0) == 0xc0) {
+      if (p + 1 >= len || ++pointers > kMaxPointers) {
+        return false;
+      }
+      if (!jumped) {
+        *pos = p + 2;
+      }
+      jumped = true;
+      p = ((c & 0x3f) << 8) | msg[p + 1];
+    } else if (c & 0xc0) {
+      return false;
+    } else if (c == 0) {
+      if (!jumped) {
+        *pos = p + 1;
+      }
+      return true;
+    } else {
+      if (p + 1 + c > len || (name_size += c + 1) > 255) {
+        return false;
+      }
+      if (name) {
+        if (!name->empty()) {
+          name->push_back('.');
+        }
+        name->append((const char*)msg + p + 1, c);
+      }
+      p += 1 + c;
+    }
+  }
+}
+std::string EncodeQuery(uint16_t id, const std::string& name, uint16_t type) {
+  std::string msg;
+  msg.reserve(kHeaderSize + name.size() + 2 + 4 + 11);
+  WriteU16(&msg, id);
+  WriteU16(&msg, kFlagRecursionDesired);
+  WriteU16(&msg, 1);  // question
+  WriteU16(&msg, 0);  // answer
+  WriteU16(&msg, 0);  // authority
+  WriteU16(&msg, 1);  // additional, the OPT record
+  size_t start = 0;
+  while (start < name.size()) {
+    size_t end = name.find('.', start);
+    if (end == std::string::npos) {
+      end = name.size();
+    }
+    msg.push_back((char)(end - start));
+    msg.append(name, start, end - start);
+    start = end + 1;
+  }
+  msg.push_back(0);
+  WriteU16(&msg, type);
+  WriteU16(&msg, kClassIn);
+  // OPT: root name, payload size as class, zero ttl and rdata
+  msg.push_back(0);
+  WriteU16(&msg, kTypeOpt);
+  WriteU16(&msg, kUdpPayloadSize);
+  msg.append(6, '\0');
+  return msg;
+}
+}  // namespace
+
+Resolver::Resolver(IoLoop* loop)
+    : loop_(loop),
+      ndots_(kDefaultNdots),
+      timeout_ms_(kDefaultTimeoutMs),
+      attempts_(kDefaultAttempts),
+      next_request_id_(1),
+      random_(std::random_device{}()) {
+  LoadResolvConf("/etc/resolv.conf");
+  if (servers_.empty()) {
+    servers_.push_back({NetAddress("127.0.0.1", 53), nullptr});
+  }
+  LoadHosts("/etc/hosts");
+}
+Resolver::~Resolver() {
+  for (auto& item : queries_) {
+    if (item.second.timer.GetId() != 0) {
+      loop_->DeleteTimer(item.second.timer);
+    }
+  }
+  CloseServers();
+}
+
+uint64_t Resolver::Resolve(const std::string& host,
+                           OnResolveCallback on_resolve) {
+  NetAddress address;
+  if (ParseLiteral(host, &address)) {
+    on_resolve({address});
+    return 0;
+  }
+  std::string key = ToLower(host);
+  bool absolute = !key.empty() && key.back() == '.';
+  auto hosts_it = hosts_.find(absolute ? key.substr(0, key.size() - 1) : key);
+  if (hosts_it != hosts_.end()) {
+    on_resolve(hosts_it->second);
+    return 0;
+  }
+  auto cache_it = cache_.find(key);
+  if (cache_it != cache_.end()) {
+    if (TimePoint::now() < cache_it->second.expire) {
+      // the callback may clear the cache
+      auto addresses = cache_it->second.addresses;
+      on_resolve(addresses);
+      return 0;
+    }
+    cache_.erase(cache_it);
+  }
+  if (!IsValidName(absolute ? key.substr(0, key.size() - 1) : key)) {
+    log_warn("[Resolver::Resolve]->invalid name %s", host.c_str());
+    on_resolve({});
+    return 0;
+  }
+  uint64_t id = next_request_id_++;
+  requests_[id] = key;
+  auto result = lookups_.try_emplace(key);
+  Lookup& lookup = result.first->second;
+  lookup.waiters.push_back({id, std::move(on_resolve)});
+  if (result.second) {
+    lookup.names = GetSearchNames(key);
+    StartName(key, lookup);
+  }
+  return id;
+}
+void Resolver::Cancel(uint64_t request_id) {
+  auto it = requests_.find(request_id);
+  if (it == requests_.end()) {
+    return;
+  }
+  // the lookup goes on and fills the cache
+  auto lookup_it = lookups_.find(it->second);
+  requests_.erase(it);
+  if (lookup_it == lookups_.end()) {
+    return;
+  }
+  auto& waiters = lookup_it->second.waiters;
+  waiters.erase(std::remove_if(waiters.begin(), waiters.end(),
+                               [request_id](const Waiter& w) {
+                                 return w.id == request_id;
+                               }),
+                waiters.end());
+}
+void Resolver::SetNameServers(const std::vector<NetAddress>& name_servers) {
+  assert(!name_servers.empty());
+  // queries in flight go to the new servers on their next try
+  CloseServers();
+  servers_.clear();
+  for (const auto& address : name_servers) {
+    servers_.push_back({address, nullptr});
+  }
+}
+
+void Resolver::LoadResolvConf(const char* path) {
+  std::ifstream in(path);
+  std::string line;
+  while (std::getline(in, line)) {
+    line = line.substr(0, line.find_first_of("#;"));
+    std::istringstream tokens(line);
+    std::string key;
+    tokens >> key;
+    if (key == "nameserver") {
+      std::string ip;
+      tokens >> ip;
+      NetAddress address;
+      if (servers_.size() < kMaxNameServers && ParseLiteral(ip, &address)) {
+        address.SetPort(53);
+        servers_.push_back({address, nullptr});
+      }
+    } else if (key == "domain" || key == "search") {
+      search_.clear();
+      std::string domain;
+      while (tokens >> domain) {
+        if (domain.back() == '.') {
+          domain.pop_back();
+        }
+        if (!domain.empty()) {
+          search_.push_back(ToLower(domain));
+        }
+      }
+    } else if (key == "options") {
+      std::string option;
+      while (tokens >> option) {
+        size_t colon = option.find(':');
+        if (colon == std::string::npos) {
+          continue;
+        }
+        int value = atoi(option.c_str() + colon + 1);
+        std::string name = option.substr(0, colon);
+        if (name == "ndots") {
+          ndots_ = std::min(std::max(value, 0), 15);
+        } else if (name == "timeout") {
+          timeout_ms_ = std::min(std::max(value, 1), 30) * 1000;
+        } else if (name == "attempts") {
+          attempts_ = std::min(std::max(value, 1), 5);
+        }
+      }
+    }
+  }
+}
+void Resolver::LoadHosts(const char* path) {
+  std::ifstream in(path);
+  std::string line;
+  while (std::getline(in, line)) {
+    std::istringstream tokens(line.substr(0, line.find('#')));
+    std::string ip;
+    NetAddress address;
+    if (!(tokens >> ip) || !ParseLiteral(ip, &address)) {
+      continue;
+    }
+    std::string name;
+    while (tokens >> name) {
+      hosts_[ToLower(name)].push_back(address);
+    }
+  }
+}
+std::vector<std::string> Resolver::GetSearchNames(
+    const std::string& host) const {
+  if (host.back() == '.') {
+    return {host.substr(0, host.size() - 1)};
+  }
+  std::vector<std::string> names;
+  bool as_is_first = std::count(host.begin(), host.end(), '.') >= ndots_;
+  if (as_is_first) {
+    names.push_back(host);
+  }
+  for (const auto& domain : search_) {
+    if (IsValidName(host + "." + domain)) {
+      names.push_back(host + "." + domain);
+    }
+  }
+  if (!as_is_first) {
+    names.push_back(host);
+  }
+  return names;
+}
+void Resolver::StartName(const std::string& host, Lookup& lookup) {
+  const std::string& name = lookup.names[lookup.name_index];
+  log_debug("[Resolver::StartName]->query %s", name.c_str());
+  uint16_t ids[2];
+  uint16_t types[2] = {kTypeAaaa, kTypeA};
+  for (int i = 0; i < 2; ++i) {
+    ids[i] = NewQueryId();
+    queries_[ids[i]] = {host, name, types[i], 0, 0, TimerId()};
+  }
+  lookup.pending = 2;
+  for (uint16_t id : ids) {
+    SendQuery(id);
+  }
+}
+void Resolver::SendQuery(uint16_t id) {
+  Query& query = queries_[id];
+  query.server = query.tries % servers_.size();
+  std::string msg = EncodeQuery(id, query.name, query.type);
+  bool sent = OpenServer(query.server) &&
+              SockUtil::Write_(servers_[query.server].event->GetFd(),
+                               &msg[0], msg.size()) == (ssize_t)msg.size();
+  if (!sent) {
+    log_warn("[Resolver::SendQuery]->send to %s failed errmsg = %s",
+             servers_[query.server].address.GetIpAndPort().c_str(),
+             strerror(errno));
+  }
+  // a failed send moves on to the next server in the next iteration
+  query.timer = loop_->CallLater(sent ? timeout_ms_ : 0, [this, id] {
+    auto it = queries_.find(id);
+    if (it != queries_.end()) {
+      it->second.timer = TimerId();
+      OnQueryTimeout(id);
+    }
+  });
+}
+void Resolver::OnQueryTimeout(uint16_t id) {
+  log_debug("[Resolver::OnQueryTimeout]->query %s timeout",
+            queries_[id].name.c_str());
+  RetryQuery(id);
+}
+void Resolver::RetryQuery(uint16_t id) {
+  Query& query = queries_[id];
+  if (query.timer.GetId() != 0) {
+    loop_->DeleteTimer(query.timer);
+    query.timer = TimerId();
+  }
+  if (++query.tries < attempts_ * (int)servers_.size()) {
+    SendQuery(id);
+    return;
+  }
+  Answer answer;
+  answer.failed = true;
+  FinishQuery(id, answer);
+}
+void Resolver::OnRead(size_t server) {
+  unsigned char buffer[4096];
+  // a resolve callback may replace the name servers
+  while (server < servers_.size() && servers_[server].event) {
+    ssize_t n = SockUtil::Read_(servers_[server].event->GetFd(), buffer,
+                                sizeof(buffer));
+    if (n >= 0) {
+      HandleResponse(server, buffer, n);
+      continue;
+    }
+    if (errno == ECONNREFUSED) {
+      // nobody listens there, do not wait for the timeouts
+      std::vector<uint16_t> refused;
+      for (const auto& item : queries_) {
+        if (item.second.server == server) {
+          refused.push_back(item.first);
+        }
+      }
+      for (uint16_t id : refused) {
+        if (queries_.count(id)) {
+          RetryQuery(id);
+        }
+      }
+      continue;
+    }
+    break;
+  }
+}
+void Resolver::HandleResponse(size_t server, const unsigned char* msg,
+                              size_t len) {
+  if (len < kHeaderSize) {
+    return;
+  }
+  uint16_t id = ReadU16(msg);
+  auto it = queries_.find(id);
+  // late answer to a query already retried elsewhere, or a stray packet
+  if (it == queries_.end() || it->second.server != server) {
+    return;
+  }
+  const Query& query = it->second;
+  uint16_t flags = ReadU16(msg + 2);
+  if (!(flags & kFlagResponse) || ReadU16(msg + 4) != 1) {
+    return;
+  }
+  size_t pos = kHeaderSize;
+  std::string name;
+  if (!ReadName(msg, len, &pos, &name) || pos + 4 > len ||
+      ToLower(name) != ToLower(query.name) || ReadU16(msg + pos) != query.type) {
+    return;
+  }
+  pos += 4;
+  uint16_t rcode = flags & 0xf;
+  if (rcode != kRcodeNoError && rcode != kRcodeNxDomain) {
+    log_debug("[Resolver::HandleResponse]->%s rcode = %d",
+              servers_[server].address.GetIpAndPort().c_str(), rcode);
+    RetryQuery(id);
+    return;
+  }
+  Answer answer;
+  uint16_t counts[2] = {ReadU16(msg + 6), ReadU16(msg + 8)};
+  for (int section = 0; section < 2; ++section) {
+    for (uint16_t i = 0; i < counts[section]; ++i) {
+      if (!ReadName(msg, len, &pos, nullptr) || pos + 10 > len) {
+        // truncated or malformed, keep what we have
+        section = 2;
+        break;
+      }
+      uint16_t type = ReadU16(msg + pos);
+      uint16_t rr_class = ReadU16(msg + pos + 2);
+      uint32_t ttl = ReadU32(msg + pos + 4);
+      uint16_t rdlength = ReadU16(msg + pos + 8);
+      pos += 10;
+      if (pos + rdlength > len) {
+        section = 2;
+        break;
+      }
+      const unsigned char* rdata = msg + pos;
+      pos += rdlength;
+      if (rr_class != kClassIn) {
+        continue;
+      }
+      if (section == 0) {
+        if (type == kTypeA && query.type == kTypeA && rdlength == 4) {
+          sockaddr_in in4{};
+          in4.sin_family = AF_INET;
+          memcpy(&in4.sin_addr, rdata, 4);
+          NetAddress address;
+          address.SetSockAddrInet(in4);
+          answer.addresses.push_back(address);
+          answer.ttl = std::min(answer.ttl, ttl);
+        } else if (type == kTypeAaaa && query.type == kTypeAaaa &&
+                   rdlength == 16) {
+          sockaddr_in6 in6{};
+          in6.sin6_family = AF_INET6;
+          memcpy(&in6.sin6_addr, rdata, 16);
+          NetAddress address;
+          address.SetSockAddrInet6(in6);
+          answer.addresses.push_back(address);
+          answer.ttl = std::min(answer.ttl, ttl);
+        } else if (type == kTypeCname) {
+          answer.ttl = std::min(answer.ttl, ttl);
+        }
+      } else if (type == kTypeSoa && rdlength >= 20) {
+        // RFC 2308: min of the SOA ttl and its MINIMUM field
+        uint32_t minimum = ReadU32(rdata + rdlength - 4);
+        answer.negative_ttl =
+            std::min(answer.negative_ttl, std::min(ttl, minimum));
+      }
+    }
+  }
+  if ((flags & kFlagTruncated) && answer.addresses.empty()) {
+    log_warn("[Resolver::HandleResponse]->truncated answer for %s",
+             query.name.c_str());
+    answer.failed = true;
+  }
+  FinishQuery(id, answer);
+}
+void Resolver::FinishQuery(uint16_t id, const Answer& answer) {
+  auto it = queries_.find(id);
+  Query query = std::move(it->second);
+  if (query.timer.GetId() != 0) {
+    loop_->DeleteTimer(query.timer);
+  }
+  queries_.erase(it);
+  auto lookup_it = lookups_.find(query.host);
+  if (lookup_it == lookups_.end()) {
+    return;
+  }
+  Lookup& lookup = lookup_it->second;
+  auto& addresses = query.type == kTypeAaaa ? lookup.v6 : lookup.v4;
+  addresses.insert(addresses.end(), answer.addresses.begin(),
+                   answer.addresses.end());
+  lookup.failed = lookup.failed || answer.failed;
+  lookup.ttl = std::min(lookup.ttl, answer.ttl);
+  lookup.negative_ttl = std::min(lookup.negative_ttl, answer.negative_ttl);
+  if (--lookup.pending == 0) {
+    FinishLookup(query.host);
+  }
+}
+void Resolver::FinishLookup(const std::string& host) {
+  Lookup& lookup = lookups_[host];
+  std::vector<NetAddress> addresses = lookup.v6;
+  addresses.insert(addresses.end(), lookup.v4.begin(), lookup.v4.end());
+  if (addresses.empty() && lookup.name_index + 1 < lookup.names.size()) {
+    ++lookup.name_index;
+    StartName(host, lookup);
+    return;
+  }
+  if (!addresses.empty()) {
+    log_debug("[Resolver::FinishLookup]->%s resolved %zu addresses ttl = %u",
+              host.c_str(), addresses.size(), lookup.ttl);
+    AddToCache(host, addresses, lookup.ttl);
+  } else if (!lookup.failed) {
+    log_debug("[Resolver::FinishLookup]->%s has no address", host.c_str());
+    AddToCache(host, addresses,
+               lookup.negative_ttl == UINT32_MAX ? kDefaultNegativeTtl
+                                                 : lookup.negative_ttl);
+  } else {
+    log_warn("[Resolver::FinishLookup]->resolve %s failed", host.c_str());
+  }
+  auto waiters = std::move(lookup.waiters);
+  lookups_.erase(host);
+  for (const auto& waiter : waiters) {
+    requests_.erase(waiter.id);
+  }
+  for (const auto& waiter : waiters) {
+    waiter.on_resolve(addresses);
+  }
+}
+bool Resolver::OpenServer(size_t server) {
+  NameServer& name_server = servers_[server];
+  if (name_server.event) {
+    return true;
+  }
+  int fd = SockUtil::CreateNonBlockFd_(name_server.address.GetFamily(),
+                                       SOCK_DGRAM, IPPROTO_UDP);
+  if (fd < 0) {
+    return false;
+  }
+  // connected, so only the server's datagrams and its ICMP errors come back
+  if (SockUtil::Connect_(fd, name_server.address.GetAddress(),
+                         name_server.address.GetSize()) < 0) {
+    SockUtil::Close_(fd);
+    return false;
+  }
+  name_server.event = std::make_unique<IoEvent>(loop_, fd);
+  name_server.event->SetReadCallback([this, server] { OnRead(server); });
+  name_server.event->EnableReading();
+  return true;
+}
+void Resolver::CloseServers() {
+  for (auto& name_server : servers_) {
+    if (name_server.event) {
+      name_server.event->DisableAll();
+      name_server.event->UnRegister();
+      SockUtil::Close_(name_server.event->GetFd());
+      name_server.event.reset();
+    }
+  }
+}
+uint16_t Resolver::NewQueryId() {
+  uint16_t id;
+  do {
+    id = (uint16_t)random_();
+  } while (queries_.count(id));
+  return id;
+}
+void Resolver::AddToCache(const std::string& host,
+                          const std::vector<NetAddress>& addresses,
+                          uint32_t ttl) {
+  ttl = std::min(ttl, kMaxTtl);
+  if (ttl == 0) {
+    return;
+  }
+  auto now = TimePoint::now();
+  if (cache_.size() >= kMaxCacheSize) {
+    for (auto it = cache_.begin(); it != cache_.end();) {
+      it = it->second.expire < now ? cache_.erase(it) : std::next(it);
+    }
+    if (cache_.size() >= kMaxCacheSize) {
+      cache_.erase(cache_.begin());
+    }
+  }
+  cache_[host] = {addresses, now + (int64_t)ttl * 1000};
+}
+bool Resolver::ParseLiteral(const std::string& host, NetAddress* address) {
+  in6_addr addr6{};
+  if (::inet_pton(AF_INET, host.c_str(), &addr6) == 1) {
+    *address = NetAddress(host, 0);
+    return true;
+  }
+  if (::inet_pton(AF_INET6, host.c_str(), &addr6) == 1) {
+    *address = NetAddress(host, 0, true);
+    return true;
+  }
+  return false;
+}
@@ -0,0 +1,132 @@
+//
+// Created by li on 2022/6/22.
+//
+
+#ifndef TOHKA_TOHKA_RESOLVER_H
+#define TOHKA_TOHKA_RESOLVER_H
+
+#include <random>
+#include <unordered_map>
+
+#include "ioevent.h"
+#include "netaddress.h"
+#include "noncopyable.h"
+#include "timepoint.h"
+#include "timerid.h"
+#include "tohka.h"
+namespace tohka {
+// Non-blocking DNS client of one loop, A and AAAA over UDP.
+//
+// Name servers, search list, ndots, timeout and attempts come from
+// /etc/resolv.conf, and /etc/hosts is consulted first, like the libc
+// resolver does. Answers are cached for their TTL, failures (NXDOMAIN or no
+// address) for the SOA minimum. Lookups of a name already in flight wait for
+// that one instead of sending their own queries.
+//
+// Truncated answers are used as far as they go, there is no TCP fallback.
+class Resolver : noncopyable {
+ public:
+  explicit Resolver(IoLoop* loop);
+  ~Resolver();
+
+  // on_resolve gets the addresses (port 0, IPv6 first) or an empty list if
+  // the name could not be resolved. Literal addresses, hosts file entries
+  // and cached answers call back before Resolve returns 0, otherwise the
+  // returned id can cancel the request.
+  uint64_t Resolve(const std::string& host, OnResolveCallback on_resolve);
+  void Cancel(uint64_t request_id);
+
+  void SetNameServers(const std::vector<NetAddress>& name_servers);
+  // per query to one name server
+  void SetTimeout(int timeout_ms) { timeout_ms_ = timeout_ms; }
+  // rounds over all name servers
+  void SetAttempts(int attempts) { attempts_ = attempts; }
+  void ClearCache() { cache_.clear(); }
+  size_t GetCacheSize() const { return cache_.size(); }
+
+ private:
+  struct Waiter {
+    uint64_t id;
+    OnResolveCallback on_resolve;
+  };
+  struct Lookup {
+    // names to try in order, the host with the search domains applied
+    std::vector<std::string> names;
+    size_t name_index = 0;
+    // queries of the current name in flight
+    int pending = 0;
+    std::vector<NetAddress> v6;
+    std::vector<NetAddress> v4;
+    uint32_t ttl = UINT32_MAX;
+    uint32_t negative_ttl = UINT32_MAX;
+    // a name server failed or timed out, the result is not cached
+    bool failed = false;
+    std::vector<Waiter> waiters;
+  };
+  struct Query {
+    std::string host;
+    std::string name;
+    uint16_t type;
+    int tries;
+    size_t server;
+    TimerId timer;
+  };
+  struct Answer {
+    bool failed = false;
+    std::vector<NetAddress> addresses;
+    uint32_t ttl = UINT32_MAX;
+    uint32_t negative_ttl = UINT32_MAX;
+  };
+  struct NameServer {
+    NetAddress address;
+    std::unique_ptr<IoEvent> event;
+  };
+  struct CacheEntry {
+    std::vector<NetAddress> addresses;
+    TimePoint expire;
+  };
+
+  void LoadResolvConf(const char* path);
+  void LoadHosts(const char* path);
+  std::vector<std::string> GetSearchNames(const std::string& host) const;
+  void StartName(const std::string& host, Lookup& lookup);
+  void SendQuery(uint16_t id);
+  void OnQueryTimeout(uint16_t id);
+  // the current name server failed, try the next one
+  void RetryQuery(uint16_t id);
+  void OnRead(size_t server);
+  void HandleResponse(size_t server, const unsigned char* msg, size_t len);
+  void FinishQuery(uint16_t id, const Answer& answer);
+  void FinishLookup(const std::string& host);
+  bool OpenServer(size_t server);
+  void CloseServers();
+  uint16_t NewQueryId();
+  void AddToCache(const std::string& host,
+                  const std::vector<NetAddress>& addresses, uint32_t ttl);
+  static bool ParseLiteral(const std::string& host, NetAddress* address);
+
+  static constexpr int kDefaultTimeoutMs = 5000;
+  static constexpr int kDefaultAttempts = 2;
+  static constexpr int kDefaultNdots = 1;
+  static constexpr uint32_t kDefaultNegativeTtl = 30;
+  static constexpr uint32_t kMaxTtl = 24 * 3600;
+  static constexpr size_t kMaxCacheSize = 4096;
+  static constexpr size_t kMaxNameServers = 3;
+  IoLoop* loop_;
+  std::vector<NameServer> servers_;
+  std::vector<std::string> search_;
+  int ndots_;
+  int timeout_ms_;
+  int attempts_;
+  uint64_t next_request_id_;
+  std::mt19937 random_;
+  std::unordered_map<std::string, std::vector<NetAddress>> hosts_;
+  std::unordered_map<std::string, CacheEntry> cache_;
+  std::unordered_map<std::string, Lookup> lookups_;
+  // request id -> host
+  std::unordered_map<uint64_t, std::string> requests_;
+  std::unordered_map<uint16_t, Query> queries_;
+};
+}  // namespace tohka
+
+#endif  // TOHKA_TOHKA_RESOLVER_H
@@ -4,6 +4,11 @@
 
 #include "socket.h"
 
+#if defined(OS_LINUX)
+#include <linux/sockios.h>
+#include <sys/ioctl.h>
+#endif
+
 #include "socketutil.h"
 #include "util/log.h"
 using namespace tohka;
@@ -43,10 +48,6 @@ int Socket::Accept(NetAddress* peer_address) const {
   //        log_error("SocketFd SetSO_SNDBUF error");
   //      }
 
-  if (conn_fd < 0) {
-    log_error("[Socket::Accept]->accept error! errno=%d errstr = %s", errno,
-              strerror(errno));
-  }
   peer_address->SetSockAddrInet6(socket_address6);
   return conn_fd;
 }
@@ -88,6 +89,30 @@ void Socket::SetKeepAlive(bool on) const {
   }
 }
 
+void Socket::SetTcpFastOpen(int queue_len) const {
+#if defined(TCP_FASTOPEN)
+  if (::setsockopt(fd_, IPPROTO_TCP, TCP_FASTOPEN, &queue_len,
+                   (socklen_t)(sizeof(queue_len))) < 0) {
+    log_error("Socket::SetTcpFastOpen error errno=%d errstr = %s", errno,
+              strerror(errno));
+  }
+#else
+  log_warn("Socket::SetTcpFastOpen not supported");
+#endif
+}
+
+void Socket::SetDeferAccept(int timeout_sec) const {
+#if defined(TCP_DEFER_ACCEPT)
+  if (::setsockopt(fd_, IPPROTO_TCP, TCP_DEFER_ACCEPT, &timeout_sec,
+                   (socklen_t)(sizeof(timeout_sec))) < 0) {
+    log_error("Socket::SetDeferAccept error errno=%d errstr = %s", errno,
+              strerror(errno));
+  }
+#else
+  log_warn("Socket::SetDeferAccept not supported");
+#endif
+}
+
 ssize_t Socket::Read(void* buffer, size_t len) const {
   return ::read(fd_, buffer, len);
 }
@@ -111,9 +136,41 @@ int Socket::GetPeerName(NetAddress& peer) const {
   socklen_t sock_len = peer.GetSize();
   return SockUtil::GetPeerName_(fd_, peer.GetAddress(), sock_len);
 }
+bool Socket::GetTcpInfo(TcpInfo* info) const {
+#if defined(OS_LINUX)
+  struct tcp_info tcpi {};
+  auto len = static_cast<socklen_t>(sizeof(tcpi));
+  if (::getsockopt(fd_, IPPROTO_TCP, TCP_INFO, &tcpi, &len) < 0) {
+    return false;
+  }
+  info->rtt_us = tcpi.tcpi_rtt;
+  info->rtt_var_us = tcpi.tcpi_rttvar;
+  info->snd_cwnd = tcpi.tcpi_snd_cwnd;
+  info->snd_mss = tcpi.tcpi_snd_mss;
+  info->total_retransmits = tcpi.tcpi_total_retrans;
+  info->lost = tcpi.tcpi_lost;
+  // the send queue holds both the unacked and the unsent bytes
+  int queued = 0;
+  int unsent = 0;
+  if (::ioctl(fd_, SIOCOUTQ, &queued) < 0 ||
+      ::ioctl(fd_, SIOCOUTQNSD, &unsent) < 0) {
+    queued = 0;
+    unsent = 0;
+  }
+  info->unacked_bytes = (uint32_t)std::max(queued - unsent, 0);
+  info->unsent_bytes = (uint32_t)unsent;
+  info->out_buf_bytes = 0;
+  return true;
+#else
+  return false;
+#endif
+}
 
 #ifdef OS_UNIX
 ssize_t Socket::ReadV(const struct iovec* vec, int vec_cnt) const {
   return ::readv(fd_, vec, vec_cnt);
 }
+ssize_t Socket::WriteV(const struct iovec* vec, int vec_cnt) const {
+  return ::writev(fd_, vec, vec_cnt);
+}
 #endif
@@ -11,6 +11,24 @@
 
 // socket and it's ops
 namespace tohka {
+// kernel statistics of a tcp connection, see TCP_INFO in tcp(7)
+struct TcpInfo {
+  // smoothed round trip time and its variation
+  uint32_t rtt_us;
+  uint32_t rtt_var_us;
+  // congestion window in segments of snd_mss bytes
+  uint32_t snd_cwnd;
+  uint32_t snd_mss;
+  // segments retransmitted over the connection's life
+  uint32_t total_retransmits;
+  uint32_t lost;
+  // bytes sent but not acked, and in the socket but not sent yet
+  uint32_t unacked_bytes;
+  uint32_t unsent_bytes;
+  // bytes in the TcpEvent's output, not written to the socket yet
+  size_t out_buf_bytes;
+};
+
 class Socket : noncopyable {
  public:
   Socket();
@@ -29,6 +47,7 @@ class Socket : noncopyable {
   ssize_t Write(const void* buffer, size_t len) const;
 #ifdef OS_UNIX
   ssize_t ReadV(const struct iovec* vec, int vec_cnt) const;
+  ssize_t WriteV(const struct iovec* vec, int vec_cnt) const;
 #endif
   void SetTcpNoDelay(bool on) const;
 
@@ -36,9 +55,16 @@ class Socket : noncopyable {
 
   void SetReusePort(bool on) const;
   void SetKeepAlive(bool on) const;
+  // listen socket options, set before Listen
+  // queue length of pending fast open requests, 0 disables
+  void SetTcpFastOpen(int queue_len) const;
+  // wake up accept only when data arrived, or after timeout_sec
+  void SetDeferAccept(int timeout_sec) const;
 
   int GetSocketError() const;
   int GetPeerName(NetAddress& peer) const;
+  // fills all but out_buf_bytes, false if not supported or on error
+  bool GetTcpInfo(TcpInfo* info) const;
 
  private:
   int fd_;
@@ -32,11 +32,38 @@ void SockUtil::SetNonBlockAndCloseOnExec_(int fd) {
 #endif
 }
 
-void SockUtil::BindAddress_(int fd, const struct sockaddr* addr, size_t len) {
+void SockUtil::SetTcpFastOpenConnect_(int fd) {
+#if defined(TCP_FASTOPEN_CONNECT)
+  int opt = 1;
+  if (::setsockopt(fd, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, &opt,
+                   (socklen_t)(sizeof(opt))) < 0) {
+    log_error("[SetTcpFastOpenConnect] error fd = %d errmsg = %s", fd,
+              strerror(errno));
+  }
+#else
+  log_warn("[SetTcpFastOpenConnect] not supported");
+#endif
+}
+
+void SockUtil::SetBindAddressNoPort_(int fd) {
+#if defined(IP_BIND_ADDRESS_NO_PORT)
+  int opt = 1;
+  if (::setsockopt(fd, IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT, &opt,
+                   (socklen_t)(sizeof(opt))) < 0) {
+    log_error("[SetBindAddressNoPort] error fd = %d errmsg = %s", fd,
+              strerror(errno));
+  }
+#else
+  log_warn("[SetBindAddressNoPort] not supported");
+#endif
+}
+
+int SockUtil::BindAddress_(int fd, const struct sockaddr* addr, size_t len) {
   int ret = ::bind(fd, addr, len);
   if (ret < 0) {
     log_error("bind error! errno=%d errstr = %s", errno, strerror(errno));
   }
+  return ret;
 }
 
 void SockUtil::Listen_(int fd, int backlog) {
@@ -48,10 +75,18 @@ void SockUtil::Listen_(int fd, int backlog) {
 
 int SockUtil::Accept_(int fd, struct sockaddr_in6* addr) {
   socklen_t sock_len = sizeof(*addr);
-
+#if defined(OS_LINUX)
+  // set flags in the same syscall instead of two fcntl round trips
+  int conn_fd = ::accept4(fd, (sockaddr*)addr, &sock_len,
+                          SOCK_NONBLOCK | SOCK_CLOEXEC);
+#else
   int conn_fd = ::accept(fd, (sockaddr*)addr, &sock_len);
-  SetNonBlockAndCloseOnExec_(conn_fd);
-  if (conn_fd < 0) {
+  if (conn_fd >= 0) {
+    SetNonBlockAndCloseOnExec_(conn_fd);
+  }
+#endif
+  // EAGAIN means the accept queue is drained
+  if (conn_fd < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
     log_error("[Accept]->accept error! errno=%d errstr = %s", errno,
               strerror(errno));
   }
@@ -70,6 +105,10 @@ ssize_t SockUtil::Write_(int fd, void* buffer, size_t len) {
   return ::write(fd, buffer, len);
 }
 
+ssize_t SockUtil::Peek_(int fd, void* buffer, size_t len) {
+  return ::recv(fd, buffer, len, MSG_PEEK | MSG_DONTWAIT);
+}
+
 int SockUtil::CreateNonBlockFd_(int domain, int type, int protocol) {
   int sock = ::socket(domain, type, protocol);
   if (sock < 0) {
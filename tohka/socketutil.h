@@ -11,7 +11,7 @@ namespace tohka {
 class SockUtil {
  public:
   static int CreateNonBlockFd_(int domain, int type, int protocol);
-  static void BindAddress_(int fd, const struct sockaddr* addr, size_t len);
+  static int BindAddress_(int fd, const struct sockaddr* addr, size_t len);
   static void Listen_(int fd, int backlog);
   static int Accept_(int fd, struct sockaddr_in6* addr);
   static int Connect_(int fd, const struct sockaddr* addr, socklen_t sock_len);
@@ -19,9 +19,16 @@ class SockUtil {
   static void ShutDownWrite_(int fd);
   static int GetSocketError_(int fd);
   static void SetNonBlockAndCloseOnExec_(int fd);
+  // connect() returns at once and the first write carries the SYN
+  static void SetTcpFastOpenConnect_(int fd);
+  // bind() only takes the address, the port is picked by connect() for the
+  // whole 4-tuple, so one source ip is not limited to one port range
+  static void SetBindAddressNoPort_(int fd);
   static void Close_(int fd);
   static ssize_t Read_(int fd, void* buffer, size_t len);
   static ssize_t Write_(int fd, void* buffer, size_t len);
+  // non-blocking read that leaves the data in the socket
+  static ssize_t Peek_(int fd, void* buffer, size_t len);
 #ifdef OS_UNIX
   static ssize_t ReadV_(int fd, struct iovec* vec, int vec_cnt);
 #endif
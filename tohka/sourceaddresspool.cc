@@ -0,0 +1,93 @@
+//
+// Created by li on 2022/6/24.
+//
+
+#include "sourceaddresspool.h"
+
+#include "util/log.h"
+using namespace tohka;
+
+SourceAddressPool::Lease::Lease(std::shared_ptr<SourceAddressPool> pool,
+                                std::string peer, size_t index)
+    : pool_(std::move(pool)),
+      peer_(std::move(peer)),
+      index_(index),
+      exhausted_(false) {}
+SourceAddressPool::Lease::~Lease() {
+  pool_->Release(peer_, index_, !exhausted_);
+}
+const NetAddress& SourceAddressPool::Lease::GetAddress() const {
+  return pool_->sources_[index_];
+}
+
+SourceAddressPool::SourceAddressPool(const std::vector<NetAddress>& sources)
+    : sources_(sources), cursor_(0) {}
+
+SourceAddressPool::LeasePtr_t SourceAddressPool::Acquire(
+    const NetAddress& peer) {
+  std::string key = peer.GetIpAndPort();
+  auto& usages = usages_[key];
+  usages.resize(sources_.size());
+  auto now = TimePoint::now();
+  size_t best = sources_.size();
+  for (size_t i = 0; i < sources_.size(); ++i) {
+    size_t index = (cursor_ + i) % sources_.size();
+    const Usage& usage = usages[index];
+    if (sources_[index].GetFamily() != peer.GetFamily() ||
+        now < usage.exhausted_until) {
+      continue;
+    }
+    if (best == sources_.size() || usage.count < usages[best].count) {
+      best = index;
+    }
+  }
+  ++cursor_;
+  if (best == sources_.size()) {
+    return nullptr;
+  }
+  ++usages[best].count;
+  return LeasePtr_t(new Lease(shared_from_this(), std::move(key), best));
+}
+void SourceAddressPool::MarkExhausted(Lease& lease) {
+  lease.exhausted_ = true;
+  log_warn("[SourceAddressPool::MarkExhausted]->%s has no port left to %s",
+           sources_[lease.index_].GetIp().c_str(), lease.peer_.c_str());
+  usages_[lease.peer_][lease.index_].exhausted_until =
+      TimePoint::now() + kExhaustedMs;
+}
+size_t SourceAddressPool::GetUseCount(const NetAddress& source,
+                                      const NetAddress& peer) const {
+  auto it = usages_.find(peer.GetIpAndPort());
+  if (it == usages_.end()) {
+    return 0;
+  }
+  for (size_t i = 0; i < sources_.size(); ++i) {
+    if (sources_[i].GetFamily() == source.GetFamily() &&
+        sources_[i].GetIp() == source.GetIp()) {
+      return it->second[i].count;
+    }
+  }
+  return 0;
+}
+
+void SourceAddressPool::Release(const std::string& peer, size_t index,
+                                bool port_freed) {
+  auto it = usages_.find(peer);
+  assert(it != usages_.end() && it->second[index].count > 0);
+  Usage& usage = it->second[index];
+  --usage.count;
+  if (port_freed) {
+    // try it again, at worst the next connect marks it once more
+    usage.exhausted_until = TimePoint();
+  }
+  // an exhausted mark outlives the connections, their ports may still be
+  // in TIME_WAIT
+  auto now = TimePoint::now();
+  bool idle = std::all_of(
+      it->second.begin(), it->second.end(), [now](const Usage& u) {
+        return u.count == 0 && !(now < u.exhausted_until);
+      });
+  if (idle) {
+    usages_.erase(it);
+  }
+}
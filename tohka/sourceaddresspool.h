@@ -0,0 +1,72 @@
+//
+// Created by li on 2022/6/24.
+//
+
+#ifndef TOHKA_TOHKA_SOURCEADDRESSPOOL_H
+#define TOHKA_TOHKA_SOURCEADDRESSPOOL_H
+
+#include <unordered_map>
+
+#include "netaddress.h"
+#include "noncopyable.h"
+#include "timepoint.h"
+namespace tohka {
+// Local addresses outbound connections are bound to, shared by the
+// Connectors of one loop.
+//
+// Each source has its own ephemeral port range per destination. Acquire
+// hands out the source with the fewest connections to that destination.
+// A source the kernel ran out of ports on (EADDRNOTAVAIL) is skipped for
+// that destination until one of its connections there closes, or for a
+// while.
+class SourceAddressPool : noncopyable,
+                          public std::enable_shared_from_this<SourceAddressPool> {
+ public:
+  // one source address in use towards one destination, released on
+  // destruction
+  class Lease : noncopyable {
+   public:
+    ~Lease();
+    const NetAddress& GetAddress() const;
+
+   private:
+    friend class SourceAddressPool;
+    Lease(std::shared_ptr<SourceAddressPool> pool, std::string peer,
+          size_t index);
+    std::shared_ptr<SourceAddressPool> pool_;
+    std::string peer_;
+    size_t index_;
+    // got no port, so releasing it frees none
+    bool exhausted_;
+  };
+  using LeasePtr_t = std::unique_ptr<Lease>;
+
+  // addresses with port 0
+  explicit SourceAddressPool(const std::vector<NetAddress>& sources);
+
+  // a source of the peer's family, nullptr if none is left
+  LeasePtr_t Acquire(const NetAddress& peer);
+  // the lease's source has no port left towards its destination
+  void MarkExhausted(Lease& lease);
+  size_t GetSourceCount() const { return sources_.size(); }
+  // connections from source to peer
+  size_t GetUseCount(const NetAddress& source, const NetAddress& peer) const;
+
+ private:
+  struct Usage {
+    size_t count = 0;
+    // skipped until then
+    TimePoint exhausted_until;
+  };
+  void Release(const std::string& peer, size_t index, bool port_freed);
+
+  static constexpr int kExhaustedMs = 1000;
+  std::vector<NetAddress> sources_;
+  // destination ip:port -> usage of each source
+  std::unordered_map<std::string, std::vector<Usage>> usages_;
+  // spreads ties over the sources
+  size_t cursor_;
+};
+}  // namespace tohka
+
+#endif  // TOHKA_TOHKA_SOURCEADDRESSPOOL_H
@@ -6,22 +6,35 @@
 
 #include "iobuf.h"
 #include "ioloop.h"
+#include "resolver.h"
 #include "tcpevent.h"
 #include "util/log.h"
 using namespace tohka;
 
 TcpClient::TcpClient(IoLoop* loop, const NetAddress& peer, std::string name)
+    : TcpClient(loop, std::vector<NetAddress>{peer}, std::move(name)) {}
+TcpClient::TcpClient(IoLoop* loop, const std::vector<NetAddress>& candidates,
+                     std::string name)
     : loop_(loop),
-      connector_(std::make_unique<Connector>(loop_, peer)),
+      connector_(std::make_unique<MultiConnector>(loop_, candidates)),
       retry_(true),
       connect_(true),
+      auto_cork_(false),
       conn_id_(1),
       on_connection_(DefaultOnConnection),
       on_message_(DefaultOnMessage),
-      name_(std::move(name)) {
+      name_(std::move(name)),
+      port_(0),
+      resolve_id_(0) {
   // socket writeable
   connector_->SetOnConnect([this](int sock_fd) { OnConnect(sock_fd); });
 }
+TcpClient::TcpClient(IoLoop* loop, std::string host, uint16_t port,
+                     std::string name)
+    : TcpClient(loop, std::vector<NetAddress>{}, std::move(name)) {
+  host_ = std::move(host);
+  port_ = port;
+}
 TcpClient::~TcpClient() {
   log_debug("[TcpClient::~TcpClient]");
   // assert(connection_ == nullptr);
@@ -36,13 +49,19 @@ TcpClient::~TcpClient() {
     log_trace("TcpClient::~TcpClient()");
   } else {
     log_trace("TcpClient::~TcpClient()");
-    connector_->Stop();
+    Stop();
   }
 }
 void TcpClient::Connect() {
-  log_info("[TcpClient::connect]->try to Connect to %s",
-           connector_->GetPeerAddress().GetIpAndPort().c_str());
-  connector_->Start();
+  if (host_.empty()) {
+    log_info("[TcpClient::connect]->try to Connect to %s",
+             connector_->GetPeerAddress().GetIpAndPort().c_str());
+    connector_->Start();
+  } else {
+    log_info("[TcpClient::connect]->try to Connect to %s:%d", host_.c_str(),
+             port_);
+    Resolve();
+  }
   if (normal_callback_) {
     // Hint 这个时候有可能TcpClient被析构了
     IoLoop::GetLoop()->CallLater(5000, [this] { OnTimeOut(); });
@@ -57,7 +76,49 @@ void TcpClient::Disconnect() {
     log_warn("TcpClient::Disconnect no connection connected!");
   }
 }
-void TcpClient::Stop() { connector_->Stop(); }
+void TcpClient::Stop() {
+  if (resolve_id_ != 0) {
+    loop_->GetResolver()->Cancel(resolve_id_);
+    resolve_id_ = 0;
+  }
+  if (resolve_timer_.GetId() != 0) {
+    loop_->DeleteTimer(resolve_timer_);
+    resolve_timer_ = TimerId();
+  }
+  connector_->Stop();
+}
+void TcpClient::Resolve() {
+  resolve_id_ = loop_->GetResolver()->Resolve(
+      host_, [this](const std::vector<NetAddress>& addresses) {
+        resolve_id_ = 0;
+        OnResolve(addresses);
+      });
+}
+void TcpClient::OnResolve(const std::vector<NetAddress>& addresses) {
+  if (addresses.empty() && !retry_) {
+    log_warn("[TcpClient::OnResolve]->resolve %s failed", host_.c_str());
+    if (on_connect_failed_) {
+      on_connect_failed_();
+    }
+    return;
+  }
+  if (addresses.empty()) {
+    log_warn("[TcpClient::OnResolve]->resolve %s failed, retry in %d ms",
+             host_.c_str(), kResolveRetryDelayMs);
+    resolve_timer_ = loop_->CallLater(kResolveRetryDelayMs, [this] {
+      resolve_timer_ = TimerId();
+      Resolve();
+    });
+    return;
+  }
+  std::vector<NetAddress> candidates(addresses);
+  for (auto& address : candidates) {
+    address.SetPort(port_);
+  }
+  connector_->Stop();
+  connector_->SetCandidates(candidates);
+  connector_->Start();
+}
 void TcpClient::OnConnect(int sock_fd) {
   auto name = connector_->GetPeerAddress().GetIpAndPort() + "#" +
               std::to_string(conn_id_);
@@ -71,6 +132,7 @@ void TcpClient::OnConnect(int sock_fd) {
   new_conn->SetOnConnection(on_connection_);
   new_conn->SetOnOnMessage(on_message_);
   new_conn->SetOnWriteDone(on_write_done_);
+  new_conn->SetAutoCork(auto_cork_);
   // handle close
   // 在连接关闭时清除掉pollfd和对应的ioevent
 
@@ -78,6 +140,7 @@ void TcpClient::OnConnect(int sock_fd) {
       [this](const TcpEventPrt_t& conn) { RemoveConnection(conn); });
   // 把新连接托管给tcp client管理
   connection_ = new_conn;
+  source_lease_ = connector_->TakeSourceLease();
   new_conn->ConnectEstablished();
 }
 void TcpClient::OnTimeOut() {
@@ -91,6 +154,7 @@ void TcpClient::RemoveConnection(const TcpEventPrt_t& conn) {
            connector_->GetPeerAddress().GetIpAndPort().c_str(), conn->GetFd());
   assert(connection_ == conn);
   connection_.reset();
+  source_lease_.reset();
   // remove from pollfd
   conn->ConnectDestroyed();
   //  if (retry_ && connect_) {
@@ -4,7 +4,7 @@
 
 #ifndef TOHKA_TOHKA_TCPCLIENT_H
 #define TOHKA_TOHKA_TCPCLIENT_H
-#include "connector.h"
+#include "multiconnector.h"
 #include "netaddress.h"
 #include "tcpevent.h"
 #include "tohka.h"
@@ -12,6 +12,12 @@ namespace tohka {
 class TcpClient : noncopyable {
  public:
   TcpClient(IoLoop* loop, const NetAddress& peer, std::string name);
+  // connect to whichever of the candidates answers first, see MultiConnector
+  TcpClient(IoLoop* loop, const std::vector<NetAddress>& candidates,
+            std::string name);
+  // host is resolved by the loop's Resolver on every Connect, then all its
+  // addresses are candidates
+  TcpClient(IoLoop* loop, std::string host, uint16_t port, std::string name);
   ~TcpClient();
 
   // 主动连接
@@ -26,6 +32,32 @@ class TcpClient : noncopyable {
   void SetConnectTimeout(int connect_timeout_ms) {
     connector_->SetConnectTimeout(connect_timeout_ms);
   }
+  // TCP fast open: the first Send goes out with the SYN once the kernel
+  // has a cookie for the server. Connect failures show up on the first
+  // read or write instead of in the connector.
+  void EnableFastOpen(bool on) { connector_->EnableFastOpen(on); }
+  // bind to the least used source address of the pool, which may be
+  // shared by many clients
+  void SetSourcePool(std::shared_ptr<SourceAddressPool> source_pool) {
+    connector_->SetSourcePool(source_pool);
+  }
+  // send a second connect attempt when the first one is slow, to a
+  // candidate not tried yet or else to the same one. The policy may be
+  // shared by many clients and counts hedges sent and won
+  void SetHedgePolicy(std::shared_ptr<HedgePolicy> hedge_policy) {
+    connector_->SetHedgePolicy(std::move(hedge_policy));
+  }
+  // delay between attempts to the candidates
+  void SetAttemptDelay(int attempt_delay_ms) {
+    connector_->SetAttemptDelay(attempt_delay_ms);
+  }
+  // give up once every candidate failed, or the host did not resolve, and
+  // call cb, instead of retrying with backoff
+  void SetOnConnectFailed(NormalCallback cb) {
+    SetRetry(false);
+    on_connect_failed_ = cb;
+    connector_->SetOnConnectFailed(std::move(cb));
+  }
   void SetOnTimeOut(NormalCallback cb) { normal_callback_ = std::move(cb); }
   void SetOnConnection(OnConnectionCallback cb) {
     on_connection_ = std::move(cb);
@@ -34,27 +66,46 @@ class TcpClient : noncopyable {
   void SetOnWriteDone(OnWriteDoneCallback cb) {
     on_write_done_ = std::move(cb);
   }
-  void SetRetry(bool status) { retry_ = status; }
+  // retry failed connects and failed resolves, see SetOnConnectFailed
+  void SetRetry(bool status) {
+    retry_ = status;
+    connector_->SetRetry(status);
+  }
+  // see TcpEvent::SetAutoCork
+  void SetAutoCork(bool on) { auto_cork_ = on; }
 
   bool IsRetry() const { return retry_; }
+  NetAddress& GetPeerAddress() { return connector_->GetPeerAddress(); }
 
  private:
   void OnConnect(int sock_fd);
+  void Resolve();
+  void OnResolve(const std::vector<NetAddress>& addresses);
   void OnTimeOut();
   void RemoveConnection(const TcpEventPrt_t& conn);
   IoLoop* loop_;
   // 持有连接器的共享指针
-  using ConnectorPrt_t = std::unique_ptr<Connector>;
+  using ConnectorPrt_t = std::unique_ptr<MultiConnector>;
   ConnectorPrt_t connector_;
   TcpEventPrt_t connection_;
+  // source address of connection_ while it is open
+  SourceAddressPool::LeasePtr_t source_lease_;
   bool retry_;
   bool connect_;
+  bool auto_cork_;
   int64_t conn_id_;
   NormalCallback normal_callback_;
   OnConnectionCallback on_connection_;
   OnMessageCallback on_message_;
   OnWriteDoneCallback on_write_done_;
+  NormalCallback on_connect_failed_;
   std::string name_;
+  // empty when constructed with addresses
+  std::string host_;
+  uint16_t port_;
+  uint64_t resolve_id_;
+  TimerId resolve_timer_;
+  static constexpr int kResolveRetryDelayMs = 5000;
 };
 }  // namespace tohka
 #endif  // TOHKA_TOHKA_TCPCLIENT_H
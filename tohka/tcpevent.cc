@@ -4,7 +4,12 @@
 
 #include "tcpevent.h"
 
+#include "ioloop.h"
+#include "metrics.h"
 #include "tohka/iobuf.h"
+#include "trafficshaper.h"
+#include "util/binlog.h"
+#include "util/probes.h"
 using namespace tohka;
 
 void tohka::DefaultOnConnection(const TcpEventPrt_t& conn) {
@@ -23,33 +28,76 @@ TcpEvent::TcpEvent(IoLoop* loop, std::string name, int fd, NetAddress& peer)
       peer_(peer),
       name_(std::move(name)),
       state_(kConnecting),
-      high_water_mark_(64 * 1024 * 1024) {
+      shared_out_size_(0),
+      high_water_mark_(64 * 1024 * 1024),
+      low_water_mark_(0),
+      above_high_water_mark_(false),
+      auto_cork_(false),
+      flush_pending_(false),
+      want_reading_(false),
+      read_throttled_(false),
+      write_throttled_(false),
+      throttle_parked_(false),
+      received_bytes_(nullptr),
+      sent_bytes_(nullptr) {
   socket_->SetKeepAlive(true);
 
   event_->SetReadCallback([this] { HandleRead(); });
   event_->SetWriteCallback([this] { HandleWrite(); });
+  event_->SetName(name_);
 }
 
 void TcpEvent::HandleRead() {
-  log_trace("TcpEvent::HandleRead fd = %d", socket_->GetFd());
+  binlog_log_trace("TcpEvent::HandleRead fd = %d", socket_->GetFd());
   // TODO debug only(set read ext_buf size=1)
   ssize_t n;
 #if defined(OS_UNIX)
   char ext_buf[65535];
   struct iovec vec[2];
-  const size_t writeable_size = in_buf_.GetWriteableSize();
+  size_t max_io_bytes = loop_->GetMaxIoBytes();
+  if (read_limiter_) {
+    size_t allowance = read_limiter_->GetAllowance(
+        max_io_bytes > 0 ? max_io_bytes : SIZE_MAX, TimePoint::now());
+    if (allowance == 0) {
+      ThrottleReading();
+      return;
+    }
+    max_io_bytes = allowance;
+  }
+  // size in_buf_ for the predicted read, so a bulk connection reads straight
+  // into it and a small message connection gives back the memory it grew
+  const size_t read_size = read_size_predictor_.NextReadSize();
+  const size_t buffer_size = in_buf_.GetBufferSize();
+  if (in_buf_.GetReadableSize() == 0 &&
+      buffer_size > kShrinkRatio * (read_size + IoBuf::kPrependSize) &&
+      buffer_size > IoBuf::kPreparedSize + IoBuf::kPrependSize) {
+    in_buf_.Shrink(std::max(read_size, IoBuf::kPreparedSize));
+  }
+  in_buf_.EnsureWritableBytes(read_size);
+  size_t writeable_size = in_buf_.GetWriteableSize();
+  size_t ext_size = sizeof(ext_buf);
+  // keep the total read under the loop budget
+  if (max_io_bytes > 0) {
+    writeable_size = std::min(writeable_size, max_io_bytes);
+    ext_size = std::min(ext_size, max_io_bytes - writeable_size);
+  }
   vec[0].iov_base = in_buf_.Begin() + in_buf_.GetWriteIndex();
   vec[0].iov_len = writeable_size;
   vec[1].iov_base = ext_buf;
-  vec[1].iov_len = sizeof(ext_buf);
-  const int vec_number = (writeable_size < sizeof(ext_buf)) ? 2 : 1;
+  vec[1].iov_len = ext_size;
+  const int vec_number =
+      (writeable_size < sizeof(ext_buf) && ext_size > 0) ? 2 : 1;
   n = socket_->ReadV(vec, vec_number);  // read from fd
   // 也就是说还没有占满预分配的vector
   if (n > 0) {
+    read_size_predictor_.Record(n);
+    if (read_limiter_) {
+      read_limiter_->Consume(n, TimePoint::now());
+    }
     if (n <= writeable_size) {
       in_buf_.SetWriteIndex(in_buf_.GetWriteIndex() + n);
     } else {
-      in_buf_.SetWriteIndex(in_buf_.GetBufferSize());
+      in_buf_.SetWriteIndex(in_buf_.GetWriteIndex() + writeable_size);
       in_buf_.Append(ext_buf, n - (long)writeable_size);
     }
   }
@@ -63,9 +111,18 @@ void TcpEvent::HandleRead() {
 #endif
   // check
   if (n > 0) {
+    if (received_bytes_ != nullptr) {
+      received_bytes_->Inc(n);
+    }
+    int fd = socket_->GetFd();
+    int64_t start = TOHKA_PROBE_START(read);
     // call msg callback
     on_message_(shared_from_this(), &in_buf_);
-  } else if (n == 0) {
+    TOHKA_PROBE3(read, fd, n, TOHKA_PROBE_ELAPSED(start));
+    return;
+  }
+  TOHKA_PROBE3(read, socket_->GetFd(), n, 0);
+  if (n == 0) {
     log_trace("TcpEvent::HandleRead half close", socket_->GetFd());
     DoClose();
   } else {
@@ -77,13 +134,19 @@ void TcpEvent::HandleRead() {
 void TcpEvent::HandleWrite() {
   log_trace("TcpEvent::HandleWrite");
   if (event_->IsWriting()) {
-    ssize_t n = socket_->Write(out_buf_.Peek(), out_buf_.GetReadableSize());
-    log_trace("write %d bytes to socket fd %d", n, socket_->GetFd());
+    ssize_t n = WriteOutput();
+    binlog_log_trace("write %zd bytes to socket fd %d", n, socket_->GetFd());
+    TOHKA_PROBE3(write, socket_->GetFd(), n, GetOutputSize());
     if (n >= 0) {
-      out_buf_.Retrieve(n);
+      if (above_high_water_mark_ && GetOutputSize() <= low_water_mark_) {
+        above_high_water_mark_ = false;
+        if (on_low_water_mark_) {
+          on_low_water_mark_(shared_from_this());
+        }
+      }
       // Once the data is written, Close_ the write event immediately to avoid
       // busy loop
-      if (out_buf_.GetReadableSize() == 0) {
+      if (GetOutputSize() == 0) {
         log_trace(
             "[TcpEvent::HandleWrite]->write done and try to stop writing");
         StopWriting();
@@ -103,6 +166,7 @@ void TcpEvent::HandleWrite() {
 }
 void TcpEvent::DoClose() {
   assert(state_ == kConnected || state_ == kDisconnecting);
+  TOHKA_PROBE2(close, socket_->GetFd(), GetOutputSize());
   SetState(kDisconnected);
   StopAll();
   // call user callback
@@ -157,49 +221,228 @@ void TcpEvent::Send(const void* data_dummy, size_t len) {
     return;
   }
 
-  size_t remaining = len;
-  ssize_t n = 0;
-  // If there is still data in the output buffer at this time,
-  // it should not be sent directly, but the data is added to the buffer.
-  if (!event_->IsWriting() && out_buf_.GetReadableSize() == 0) {
-    // FIXME test
-    n = socket_->Write(data, len);
-    if (n >= 0) {
-      // may be not write done
-      remaining -= n;
-      if (remaining == 0) {
-        if (on_write_done_) {
-          on_write_done_(shared_from_this());
-        }
-      }
-
-    } else {
-      n = 0;
-      // Resource temporarily unavailable(EAGAIN)
-      if (errno != EWOULDBLOCK) {
-        log_error("TcpEvent::Send errno != EWOULDBLOCK");
-      }
-    }
+  if (auto_cork_) {
+    TOHKA_PROBE3(send, socket_->GetFd(), len, 0);
+    AppendToOutput(data, len);
+    ScheduleFlush();
+    return;
   }
 
+  size_t n = WriteDirect(data, len);
+  TOHKA_PROBE3(send, socket_->GetFd(), len, n);
   // Put the unsent data into the output buffer and pay attention to the write
   // event
-  assert(remaining <= len);
-  if (remaining > 0) {
-    // Judging whether the current cache data has exceeded the high watermark
-    size_t exist = out_buf_.GetReadableSize();
-    log_debug("remain =%d exist = %d", high_water_mark_, remaining, exist);
-    // FIXME why
-    if (exist + remaining >= high_water_mark_) {
-      // if(exist + remaining >= high_water_mark_ && exist < high_water_mark_){
-      if (on_high_water_mark_) {
-        on_high_water_mark_(shared_from_this());
-      }
+  if (n < len) {
+    AppendToOutput(data + n, len - n);
+    log_trace("[TcpEvent::Send]->no more buffer,so enable writing...");
+    StartWriting();
+  }
+}
+void TcpEvent::Send(const SharedBufPrt_t& buffer) {
+  if (state_ != kConnected) {
+    log_warn("Not connected, give up writing");
+    return;
+  }
+  if (buffer->empty()) {
+    return;
+  }
+  if (auto_cork_) {
+    TOHKA_PROBE3(send, socket_->GetFd(), buffer->size(), 0);
+    AppendToOutput(buffer, 0);
+    ScheduleFlush();
+    return;
+  }
+  size_t n = WriteDirect(buffer->data(), buffer->size());
+  TOHKA_PROBE3(send, socket_->GetFd(), buffer->size(), n);
+  if (n < buffer->size()) {
+    AppendToOutput(buffer, n);
+    StartWriting();
+  }
+}
+size_t TcpEvent::WriteDirect(const char* data, size_t len) {
+  // If there is still data in the output buffer at this time,
+  // it should not be sent directly, but the data is added to the buffer.
+  if (event_->IsWriting() || GetOutputSize() > 0 || write_throttled_) {
+    return 0;
+  }
+  size_t allowed = len;
+  if (write_limiter_) {
+    allowed = write_limiter_->GetAllowance(len, TimePoint::now());
+    if (allowed < len) {
+      // the rest is queued, and written once resumed
+      ThrottleWriting();
+    }
+    if (allowed == 0) {
+      return 0;
+    }
+  }
+  ssize_t n = socket_->Write(data, allowed);
+  if (n < 0) {
+    // Resource temporarily unavailable(EAGAIN)
+    if (errno != EWOULDBLOCK) {
+      log_error("TcpEvent::Send errno != EWOULDBLOCK");
     }
+    return 0;
+  }
+  OnWritten(n);
+  // may be not write done
+  if ((size_t)n == len && on_write_done_) {
+    on_write_done_(shared_from_this());
+  }
+  return n;
+}
+void TcpEvent::AppendToOutput(const char* data, size_t len) {
+  CheckHighWaterMark(len);
+  if (shared_out_.empty()) {
     // append remaining data to buffer
-    out_buf_.Append(data + n, remaining);
-    log_trace("[TcpEvent::Send]->no more buffer,so enable writing...");
+    out_buf_.Append(data, len);
+  } else {
+    shared_out_.push_back(
+        {std::make_shared<const std::string>(data, len), 0});
+    shared_out_size_ += len;
+  }
+}
+void TcpEvent::AppendToOutput(const SharedBufPrt_t& buffer, size_t offset) {
+  size_t len = buffer->size() - offset;
+  CheckHighWaterMark(len);
+  shared_out_.push_back({buffer, offset});
+  shared_out_size_ += len;
+}
+void TcpEvent::CheckHighWaterMark(size_t len) {
+  // Judging whether the current cache data has exceeded the high watermark
+  size_t exist = GetOutputSize();
+  log_debug("remain =%d exist = %d", len, exist);
+  // only fire on crossing, otherwise every Send above the mark calls back
+  if (!above_high_water_mark_ && exist + len >= high_water_mark_) {
+    above_high_water_mark_ = true;
+    if (on_high_water_mark_) {
+      on_high_water_mark_(shared_from_this());
+    }
+  }
+}
+void TcpEvent::ScheduleFlush() {
+  if (flush_pending_) {
+    return;
+  }
+  flush_pending_ = true;
+  std::weak_ptr<TcpEvent> weak_conn(shared_from_this());
+  loop_->CallSoon([weak_conn] {
+    if (auto conn = weak_conn.lock()) {
+      conn->Flush();
+    }
+  });
+}
+void TcpEvent::Flush() {
+  flush_pending_ = false;
+  // closed before the end of iteration, drop the output
+  if (state_ != kConnected && state_ != kDisconnecting) {
+    return;
+  }
+  // HandleWrite will send the rest
+  if (event_->IsWriting() || GetOutputSize() == 0) {
+    return;
+  }
+  ssize_t n = WriteOutput();
+  binlog_log_trace("flush %zd bytes to socket fd %d", n, socket_->GetFd());
+  if (n < 0 && errno != EWOULDBLOCK) {
+    log_error("TcpEvent::Flush errno != EWOULDBLOCK");
+  }
+  if (GetOutputSize() > 0) {
     StartWriting();
+    return;
+  }
+  if (above_high_water_mark_) {
+    above_high_water_mark_ = false;
+    if (on_low_water_mark_) {
+      on_low_water_mark_(shared_from_this());
+    }
+  }
+  if (on_write_done_) {
+    on_write_done_(shared_from_this());
+  }
+  if (state_ == kDisconnecting) {
+    TryEagerShutDown();
+  }
+}
+ssize_t TcpEvent::WriteOutput() {
+  size_t budget = GetWriteSize();
+  if (budget == 0) {
+    // out of write tokens
+    if (GetOutputSize() > 0) {
+      ThrottleWriting();
+    }
+    return 0;
+  }
+  if (shared_out_.empty()) {
+    ssize_t n = socket_->Write(out_buf_.Peek(), budget);
+    if (n > 0) {
+      out_buf_.Retrieve(n);
+      OnWritten(n);
+    }
+    return n;
+  }
+  ssize_t n;
+#if defined(OS_UNIX)
+  // out_buf_ and the shared buffers after it in one write
+  struct iovec vec[kMaxWriteIov];
+  int vec_number = 0;
+  size_t total = 0;
+  if (out_buf_.GetReadableSize() > 0) {
+    vec[0].iov_base = const_cast<char*>(out_buf_.Peek());
+    vec[0].iov_len = std::min(out_buf_.GetReadableSize(), budget);
+    total = vec[0].iov_len;
+    vec_number = 1;
+  }
+  for (const auto& slice : shared_out_) {
+    if (vec_number == kMaxWriteIov || total == budget) {
+      break;
+    }
+    size_t len = std::min(slice.buffer->size() - slice.offset, budget - total);
+    vec[vec_number].iov_base =
+        const_cast<char*>(slice.buffer->data() + slice.offset);
+    vec[vec_number].iov_len = len;
+    total += len;
+    ++vec_number;
+  }
+  n = socket_->WriteV(vec, vec_number);
+#else
+  if (out_buf_.GetReadableSize() > 0) {
+    n = socket_->Write(out_buf_.Peek(),
+                       std::min(out_buf_.GetReadableSize(), budget));
+  } else {
+    const SharedSlice& slice = shared_out_.front();
+    n = socket_->Write(
+        slice.buffer->data() + slice.offset,
+        std::min(slice.buffer->size() - slice.offset, budget));
+  }
+#endif
+  if (n > 0) {
+    RetrieveOutput(n);
+    OnWritten(n);
+  }
+  return n;
+}
+void TcpEvent::OnWritten(size_t n) {
+  if (write_limiter_) {
+    write_limiter_->Consume(n, TimePoint::now());
+  }
+  if (sent_bytes_ != nullptr) {
+    sent_bytes_->Inc((int64_t)n);
+  }
+}
+void TcpEvent::RetrieveOutput(size_t len) {
+  size_t from_buf = std::min(len, out_buf_.GetReadableSize());
+  out_buf_.Retrieve(from_buf);
+  len -= from_buf;
+  while (len > 0) {
+    SharedSlice& slice = shared_out_.front();
+    size_t n = std::min(len, slice.buffer->size() - slice.offset);
+    slice.offset += n;
+    shared_out_size_ -= n;
+    len -= n;
+    if (slice.offset == slice.buffer->size()) {
+      shared_out_.pop_front();
+    }
   }
 }
 void TcpEvent::Send(IoBuf* buffer) {
@@ -222,9 +465,109 @@ void TcpEvent::ForceClose() {
 void TcpEvent::TryEagerShutDown() {
   // we are not writing
   // 保证没有发送完毕的数据能够发送出去
-  if (!event_->IsWriting()) {
+  // (corked output waits in out_buf_ without writing enabled)
+  if (!event_->IsWriting() && GetOutputSize() == 0) {
     socket_->ShutDownWrite();
   }
 }
 
+size_t TcpEvent::GetWriteSize() {
+  size_t max_io_bytes = loop_->GetMaxIoBytes();
+  size_t readable = GetOutputSize();
+  size_t size =
+      max_io_bytes > 0 ? std::min(readable, max_io_bytes) : readable;
+  if (write_limiter_) {
+    size = write_limiter_->GetAllowance(size, TimePoint::now());
+  }
+  return size;
+}
+
+void TcpEvent::ThrottleReading() {
+  if (read_throttled_) {
+    return;
+  }
+  read_throttled_ = true;
+  event_->DisableReading();
+  ParkThrottled();
+}
+void TcpEvent::ThrottleWriting() {
+  if (write_throttled_) {
+    return;
+  }
+  write_throttled_ = true;
+  event_->DisableWriting();
+  ParkThrottled();
+}
+void TcpEvent::ParkThrottled() {
+  if (throttle_parked_) {
+    return;
+  }
+  auto now = TimePoint::now();
+  int64_t wait_ms = INT32_MAX;
+  if (read_throttled_) {
+    wait_ms = std::min(wait_ms, read_limiter_->GetWaitMs(now));
+  }
+  if (write_throttled_) {
+    wait_ms = std::min(wait_ms, write_limiter_->GetWaitMs(now));
+  }
+  throttle_parked_ = true;
+  loop_->GetTrafficShaper()->Park(shared_from_this(), wait_ms);
+}
+void TcpEvent::ResumeThrottled() {
+  throttle_parked_ = false;
+  if (state_ != kConnected && state_ != kDisconnecting) {
+    return;
+  }
+  auto now = TimePoint::now();
+  if (read_throttled_ && read_limiter_->GetAllowance(1, now) > 0) {
+    read_throttled_ = false;
+    if (want_reading_) {
+      event_->EnableReading();
+    }
+  }
+  if (write_throttled_ && write_limiter_->GetAllowance(1, now) > 0) {
+    write_throttled_ = false;
+    if (GetOutputSize() > 0) {
+      event_->EnableWriting();
+    }
+  }
+  if (read_throttled_ || write_throttled_) {
+    ParkThrottled();
+  }
+}
+
 void TcpEvent::SetTcpNoDelay() { socket_->SetTcpNoDelay(true); }
+bool TcpEvent::GetTcpInfo(TcpInfo* info) const {
+  if (!socket_->GetTcpInfo(info)) {
+    return false;
+  }
+  info->out_buf_bytes = GetOutputSize();
+  return true;
+}
+
+void tohka::Pipe(const TcpEventPrt_t& source, const TcpEventPrt_t& sink,
+                 size_t high_water_mark, size_t low_water_mark) {
+  assert(low_water_mark < high_water_mark);
+  std::weak_ptr<TcpEvent> weak_source(source);
+  sink->SetOnHighWaterMark(
+      [weak_source](const TcpEventPrt_t& conn) {
+        auto source = weak_source.lock();
+        // source may already be closed and unregistered from poll
+        if (source && source->Connected()) {
+          log_debug("Pipe %s -> %s high water mark, stop reading",
+                    source->GetName().c_str(), conn->GetName().c_str());
+          source->StopReading();
+        }
+      },
+      high_water_mark);
+  sink->SetOnLowWaterMark(
+      [weak_source](const TcpEventPrt_t& conn) {
+        auto source = weak_source.lock();
+        if (source && source->Connected()) {
+          log_debug("Pipe %s -> %s low water mark, start reading",
+                    source->GetName().c_str(), conn->GetName().c_str());
+          source->StartReading();
+        }
+      },
+      low_water_mark);
+}
@@ -5,23 +5,41 @@
 #ifndef TOHKA_TOHKA_TCPEVENT_H
 #define TOHKA_TOHKA_TCPEVENT_H
 
+#include <deque>
+
 #include "iobuf.h"
 #include "ioevent.h"
 #include "netaddress.h"
+#include "ratelimiter.h"
+#include "readsizepredictor.h"
 #include "socket.h"
 #include "tohka.h"
 #include "util/log.h"
 
 namespace tohka {
+class Counter;
 // one tcp connection
 class TcpEvent : noncopyable, public std::enable_shared_from_this<TcpEvent> {
  public:
   TcpEvent(IoLoop* loop, std::string name, int fd, NetAddress& peer);
   ~TcpEvent();
 
-  void StartReading() { event_->EnableReading(); }
-  void StartWriting() { event_->EnableWriting(); }
-  void StopReading() { event_->DisableReading(); }
+  // reading stays off while the read limit is out of tokens
+  void StartReading() {
+    want_reading_ = true;
+    if (!read_throttled_) {
+      event_->EnableReading();
+    }
+  }
+  void StartWriting() {
+    if (!write_throttled_) {
+      event_->EnableWriting();
+    }
+  }
+  void StopReading() {
+    want_reading_ = false;
+    event_->DisableReading();
+  }
   void StopWriting() { event_->DisableWriting(); }
   void StopAll() { event_->DisableAll(); }
 
@@ -30,22 +48,35 @@ class TcpEvent : noncopyable, public std::enable_shared_from_this<TcpEvent> {
   };
   void SetOnOnMessage(const OnMessageCallback& on_message) {
     on_message_ = on_message;
+    UpdateCallbackSites();
   };
   void SetOnWriteDone(const OnWriteDoneCallback& on_write_done) {
     on_write_done_ = on_write_done;
+    UpdateCallbackSites();
   };
 
   // 写入高水位
-  // TODO  其它水位
+  // called once when the output buffer grows across `size` bytes
   void SetOnHighWaterMark(const OnHighWaterMark& on_high_water_mark,
                           size_t size) {
     on_high_water_mark_ = on_high_water_mark;
     high_water_mark_ = size;
   }
+  // 写入低水位
+  // called once the output buffer drains to `size` bytes or less after the
+  // high water mark was crossed
+  void SetOnLowWaterMark(const OnLowWaterMark& on_low_water_mark,
+                         size_t size) {
+    on_low_water_mark_ = on_low_water_mark;
+    low_water_mark_ = size;
+  }
 
   void Send(std::string_view msg);
   void Send(const void* data, size_t len);
   void Send(IoBuf* buffer);
+  // what can not be written at once is queued by reference, so a buffer
+  // sent to several connections is not copied for each of them
+  void Send(const SharedBufPrt_t& buffer);
 
   void ShutDown();
   void ForceClose();
@@ -56,6 +87,7 @@ class TcpEvent : noncopyable, public std::enable_shared_from_this<TcpEvent> {
   std::string GetPeerIp() { return peer_.GetIp(); };
   uint16_t GetPeerPort() { return peer_.GetPort(); };
   std::string GetPeerIpAndPort() { return peer_.GetIpAndPort(); };
+  const NetAddress& GetPeerAddress() const { return peer_; }
 
   std::string GetName() const { return name_; };
 
@@ -63,8 +95,38 @@ class TcpEvent : noncopyable, public std::enable_shared_from_this<TcpEvent> {
 
   IoBuf* GetInputBuf() { return &in_buf_; };
   IoBuf* GetOutputBuf() { return &out_buf_; };
+  // bytes waiting to be written, in out_buf_ and in shared buffers
+  size_t GetOutputSize() const {
+    return out_buf_.GetReadableSize() + shared_out_size_;
+  }
+
+  // Byte rate limits of the socket reads and writes, a limiter may be
+  // shared with other connections of the loop. Out of tokens, the
+  // connection stops reading (or writing) until the loop's TrafficShaper
+  // resumes it.
+  void SetReadLimiter(RateLimiterPtr_t limiter) {
+    read_limiter_ = std::move(limiter);
+  }
+  void SetWriteLimiter(RateLimiterPtr_t limiter) {
+    write_limiter_ = std::move(limiter);
+  }
+  /// Internal use only, called by TrafficShaper.
+  void ResumeThrottled();
+  // counters of the bytes read from and written to the socket, may be
+  // shared with other connections, see MetricsRegistry
+  void SetByteCounters(Counter* received, Counter* sent) {
+    received_bytes_ = received;
+    sent_bytes_ = sent;
+  }
 
   void SetTcpNoDelay();
+  // kernel statistics of the connection and the bytes in the output, false
+  // if TCP_INFO is not supported
+  bool GetTcpInfo(TcpInfo* info) const;
+  // Send only appends to the output buffer, and all output of this
+  // iteration is written by one write at the end of the loop iteration
+  void SetAutoCork(bool on) { auto_cork_ = on; }
+  bool IsAutoCork() const { return auto_cork_; }
   /// Internal use only.
   void SetOnClose(const OnCloseCallback& on_close) { on_close_ = on_close; }
   // Be called when this connection establishing(call on accept)
@@ -79,6 +141,34 @@ class TcpEvent : noncopyable, public std::enable_shared_from_this<TcpEvent> {
   void DoError();
 
   void TryEagerShutDown();
+  void ThrottleReading();
+  void ThrottleWriting();
+  // wake up when one of the throttled directions has a token
+  void ParkThrottled();
+  // write now if nothing is queued, returns the bytes written
+  size_t WriteDirect(const char* data, size_t len);
+  void AppendToOutput(const char* data, size_t len);
+  void AppendToOutput(const SharedBufPrt_t& buffer, size_t offset);
+  void CheckHighWaterMark(size_t len);
+  void ScheduleFlush();
+  void Flush();
+  // write the queued output up to the loop budget and retrieve what was
+  // written
+  ssize_t WriteOutput();
+  void RetrieveOutput(size_t len);
+  // after n bytes were written to the socket
+  void OnWritten(size_t n);
+  // the Watchdog counts slow reads and writes by the user's callbacks, not
+  // by the HandleRead and HandleWrite lambdas every connection shares
+  void UpdateCallbackSites() {
+    event_->SetCallbackSites(&on_message_.target_type(),
+                             &on_write_done_.target_type());
+  }
+  // bytes of the output to write now, bounded by the loop budget
+  size_t GetWriteSize();
+  // shrink in_buf_ when it is this many times larger than the next read
+  static constexpr size_t kShrinkRatio = 4;
+  static constexpr int kMaxWriteIov = 16;
   enum STATE { kConnecting, kConnected, kDisconnecting, kDisconnected };
   IoLoop* loop_;
   std::unique_ptr<IoEvent> event_;
@@ -88,15 +178,49 @@ class TcpEvent : noncopyable, public std::enable_shared_from_this<TcpEvent> {
   STATE state_;
   IoBuf in_buf_;
   IoBuf out_buf_;
+  struct SharedSlice {
+    SharedBufPrt_t buffer;
+    size_t offset;
+  };
+  // written after out_buf_, output sent while it is not empty is queued
+  // here too to keep the order
+  std::deque<SharedSlice> shared_out_;
+  size_t shared_out_size_;
+  ReadSizePredictor read_size_predictor_;
   std::any context_;
   size_t high_water_mark_;
+  size_t low_water_mark_;
+  // output buffer has crossed the high water mark and not yet drained
+  bool above_high_water_mark_;
+  bool auto_cork_;
+  // a Flush has been queued to the loop
+  bool flush_pending_;
+  RateLimiterPtr_t read_limiter_;
+  RateLimiterPtr_t write_limiter_;
+  // the user's StartReading / StopReading, applied once not throttled
+  bool want_reading_;
+  bool read_throttled_;
+  bool write_throttled_;
+  // waiting in the TrafficShaper
+  bool throttle_parked_;
+  Counter* received_bytes_;
+  Counter* sent_bytes_;
   void SetState(STATE state) { state_ = state; }
   OnMessageCallback on_message_;
   OnConnectionCallback on_connection_;
   OnCloseCallback on_close_;
   OnWriteDoneCallback on_write_done_;
   OnHighWaterMark on_high_water_mark_;
+  OnLowWaterMark on_low_water_mark_;
 };
+
+// Flow control from source to sink: stop reading source when the output
+// buffer of sink crosses high_water_mark, and resume reading when it drains
+// to low_water_mark. Data forwarding is still done by the user's
+// OnMessageCallback. Installs the water mark callbacks of sink.
+void Pipe(const TcpEventPrt_t& source, const TcpEventPrt_t& sink,
+          size_t high_water_mark = 1024 * 1024,
+          size_t low_water_mark = 256 * 1024);
 }  // namespace tohka
 
 #endif  // TOHKA_TOHKA_TCPEVENT_H
@@ -0,0 +1,89 @@
+//
+// Created by li on 2022/7/15.
+//
+
+#include "tcpinfosampler.h"
+
+#include "ioloop.h"
+#include "metrics.h"
+#include "tcpevent.h"
+using namespace tohka;
+
+std::string TcpInfoStats::ToString() const {
+  std::string result;
+  result += "rtt_us: " + rtt_us.ToString() + "\n";
+  result += "rtt_var_us: " + rtt_var_us.ToString() + "\n";
+  result += "snd_cwnd: " + snd_cwnd.ToString() + "\n";
+  result += "retransmits: " + retransmits.ToString() + "\n";
+  result += "unacked_bytes: " + unacked_bytes.ToString() + "\n";
+  result += "out_buf_bytes: " + out_buf_bytes.ToString() + "\n";
+  return result;
+}
+
+TcpInfoSampler::TcpInfoSampler(IoLoop* loop, int interval_ms)
+    : loop_(loop),
+      rtt_metric_(MetricsRegistry::Get()->AddHistogram(
+          "tohka_tcp_rtt_seconds", "Smoothed rtt of sampled connections.",
+          {100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000,
+           250000, 500000, 1000000},
+          1e-6)),
+      retransmits_metric_(MetricsRegistry::Get()->AddCounter(
+          "tohka_tcp_retransmits_total",
+          "Segments retransmitted by sampled connections.")) {
+  timer_ = loop_->CallEvery(interval_ms, [this] { Sample(); });
+}
+TcpInfoSampler::~TcpInfoSampler() { loop_->DeleteTimer(timer_); }
+
+void TcpInfoSampler::Add(const TcpEventPrt_t& conn) {
+  samples_[conn.get()] = Entry{conn, TcpInfo{}, false};
+}
+void TcpInfoSampler::Remove(const TcpEventPrt_t& conn) {
+  samples_.erase(conn.get());
+}
+
+void TcpInfoSampler::Sample() {
+  for (auto it = samples_.begin(); it != samples_.end();) {
+    TcpEventPrt_t conn = it->second.conn.lock();
+    if (!conn || !conn->Connected()) {
+      it = samples_.erase(it);
+      continue;
+    }
+    Entry& entry = it->second;
+    TcpInfo info{};
+    if (conn->GetTcpInfo(&info)) {
+      uint32_t retransmits =
+          entry.sampled ? info.total_retransmits - entry.info.total_retransmits
+                        : info.total_retransmits;
+      stats_.rtt_us.Record(info.rtt_us);
+      stats_.rtt_var_us.Record(info.rtt_var_us);
+      stats_.snd_cwnd.Record(info.snd_cwnd);
+      stats_.retransmits.Record(retransmits);
+      stats_.unacked_bytes.Record(info.unacked_bytes);
+      stats_.out_buf_bytes.Record(info.out_buf_bytes);
+      rtt_metric_->Observe(info.rtt_us);
+      if (retransmits > 0) {
+        retransmits_metric_->Inc(retransmits);
+      }
+      entry.info = info;
+      entry.sampled = true;
+    }
+    ++it;
+  }
+}
+
+std::vector<TcpInfoSample> TcpInfoSampler::GetSlowest(size_t n) const {
+  std::vector<TcpInfoSample> result;
+  for (const auto& item : samples_) {
+    TcpEventPrt_t conn = item.second.conn.lock();
+    if (conn && item.second.sampled) {
+      result.push_back({std::move(conn), item.second.info});
+    }
+  }
+  n = std::min(n, result.size());
+  std::partial_sort(result.begin(), result.begin() + (long)n, result.end(),
+                    [](const TcpInfoSample& a, const TcpInfoSample& b) {
+                      return a.info.rtt_us > b.info.rtt_us;
+                    });
+  result.resize(n);
+  return result;
+}
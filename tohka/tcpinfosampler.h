@@ -0,0 +1,70 @@
+//
+// Created by li on 2022/7/15.
+//
+
+#ifndef TOHKA_TOHKA_TCPINFOSAMPLER_H
+#define TOHKA_TOHKA_TCPINFOSAMPLER_H
+
+#include "looptelemetry.h"
+#include "noncopyable.h"
+#include "socket.h"
+#include "timerid.h"
+#include "tohka.h"
+namespace tohka {
+class Counter;
+class Histogram;
+
+// Distributions over all samples of all connections, any thread may read
+// them, see Log2Histogram
+struct TcpInfoStats {
+  Log2Histogram rtt_us;
+  Log2Histogram rtt_var_us;
+  Log2Histogram snd_cwnd;
+  // segments retransmitted since the last sample of the connection
+  Log2Histogram retransmits;
+  Log2Histogram unacked_bytes;
+  Log2Histogram out_buf_bytes;
+
+  std::string ToString() const;
+};
+
+struct TcpInfoSample {
+  TcpEventPrt_t conn;
+  TcpInfo info;
+};
+
+// Reads TCP_INFO of a set of connections of one loop every interval_ms,
+// to tell the network (rtt, retransmits, a small cwnd, bytes unacked)
+// from the application (bytes piling up in the output buffer).
+class TcpInfoSampler : noncopyable {
+ public:
+  TcpInfoSampler(IoLoop* loop, int interval_ms);
+  ~TcpInfoSampler();
+
+  void Add(const TcpEventPrt_t& conn);
+  void Remove(const TcpEventPrt_t& conn);
+  size_t Size() const { return samples_.size(); }
+
+  const TcpInfoStats& GetStats() const { return stats_; }
+  // the n connections with the highest rtt in their last sample, slowest
+  // first
+  std::vector<TcpInfoSample> GetSlowest(size_t n) const;
+
+ private:
+  void Sample();
+
+  struct Entry {
+    std::weak_ptr<TcpEvent> conn;
+    TcpInfo info;
+    bool sampled;
+  };
+  IoLoop* loop_;
+  TimerId timer_;
+  std::map<const TcpEvent*, Entry> samples_;
+  TcpInfoStats stats_;
+  Histogram* rtt_metric_;
+  Counter* retransmits_metric_;
+};
+}  // namespace tohka
+
+#endif  // TOHKA_TOHKA_TCPINFOSAMPLER_H
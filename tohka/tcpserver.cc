@@ -4,23 +4,62 @@
 
 #include "tcpserver.h"
 
+#include "ioloop.h"
+#include "socketutil.h"
+
 using namespace tohka;
-TcpServer::TcpServer(IoLoop* loop,NetAddress bind_address)
+TcpServer::TcpServer(IoLoop* loop, NetAddress bind_address)
     : loop_(loop),
       acceptor_(std::make_unique<Acceptor>(loop_, bind_address)),
       on_connection_(DefaultOnConnection),
       on_message_(DefaultOnMessage),
-      conn_id_(1) {
-  acceptor_->SetOnAccept(std::bind(&TcpServer::OnAccept, this,
-                                   std::placeholders::_1,
-                                   std::placeholders::_2));
+      conn_id_(1),
+      auto_cork_(false),
+      running_(false),
+      accept_batch_(kDefaultAcceptBatch),
+      max_connections_(kDefaultMaxConnections),
+      max_connections_per_ip_(0),
+      rejected_count_(0) {
+  EnableMetrics(true);
+  acceptor_->SetOnAcceptBatch(
+      std::bind(&TcpServer::OnAcceptBatch, this, std::placeholders::_1));
 }
 TcpServer::~TcpServer() {
+  if (accept_rate_timer_.GetId() != 0) {
+    loop_->DeleteTimer(accept_rate_timer_);
+  }
+  if (active_connections_) {
+    active_connections_->Add(-(int64_t)connection_map_.size());
+  }
   for (const auto& item : connection_map_) {
     item.second->ConnectDestroyed();
   }
 }
 
+void TcpServer::EnableMetrics(bool on) {
+  assert(!running_);
+  if (!on) {
+    accepted_total_ = nullptr;
+    rejected_total_ = nullptr;
+    active_connections_ = nullptr;
+    received_bytes_ = nullptr;
+    sent_bytes_ = nullptr;
+    return;
+  }
+  auto* metrics = MetricsRegistry::Get();
+  accepted_total_ = metrics->AddCounter("tohka_tcp_server_accepted_total",
+                                        "Connections accepted.");
+  rejected_total_ = metrics->AddCounter(
+      "tohka_tcp_server_rejected_total",
+      "Connections closed on accept, over the per ip limit.");
+  active_connections_ = metrics->AddGauge(
+      "tohka_tcp_server_active_connections", "Connections open now.");
+  received_bytes_ = metrics->AddCounter("tohka_tcp_server_received_bytes_total",
+                                        "Bytes read from connections.");
+  sent_bytes_ = metrics->AddCounter("tohka_tcp_server_sent_bytes_total",
+                                    "Bytes written to connections.");
+}
+
 // call OnConnectionCallback
 void TcpServer::OnAccept(int conn_fd, NetAddress& peer_address) {
   auto name = peer_address.GetIpAndPort() + "#" + std::to_string(conn_id_);
@@ -32,16 +71,98 @@ void TcpServer::OnAccept(int conn_fd, NetAddress& peer_address) {
 
   //  connection_map_[name] = new_conn;
   connection_map_.emplace(name, new_conn);
+  if (accepted_total_) {
+    accepted_total_->Inc();
+    active_connections_->Inc();
+  }
   // call user callback
   new_conn->SetOnConnection(on_connection_);
   new_conn->SetOnOnMessage(on_message_);
   new_conn->SetOnWriteDone(on_write_done_);
+  new_conn->SetAutoCork(auto_cork_);
+  new_conn->SetByteCounters(received_bytes_, sent_bytes_);
   new_conn->SetOnClose(
       std::bind(&TcpServer::OnClose, this, std::placeholders::_1));
+  if (tcp_info_sampler_) {
+    tcp_info_sampler_->Add(new_conn);
+  }
 
   // call ConnectEstablished
   new_conn->ConnectEstablished();
 }
+void TcpServer::OnAcceptBatch(AcceptedList& accepted) {
+  auto now = TimePoint::now();
+  for (auto& [conn_fd, peer_address] : accepted) {
+    if (accept_rate_) {
+      accept_rate_->Consume(1, now);
+    }
+    uint32_t count = ip_counter_.Increase(peer_address);
+    if (max_connections_per_ip_ > 0 && count > max_connections_per_ip_) {
+      log_warn("[TcpServer::OnAcceptBatch]->reject %s over %d connections",
+               peer_address.GetIp().c_str(), max_connections_per_ip_);
+      ip_counter_.Decrease(peer_address);
+      ++rejected_count_;
+      if (rejected_total_) {
+        rejected_total_->Inc();
+      }
+      SockUtil::Close_(conn_fd);
+      continue;
+    }
+    OnAccept(conn_fd, peer_address);
+  }
+  UpdateAccepting();
+}
+void TcpServer::SetAcceptRate(double rate, double burst) {
+  if (accept_rate_) {
+    accept_rate_->SetRate(rate, burst);
+  } else {
+    accept_rate_ = std::make_unique<TokenBucket>(rate, burst);
+  }
+}
+void TcpServer::SetTcpInfoSampling(int interval_ms) {
+  tcp_info_sampler_.reset();
+  if (interval_ms <= 0) {
+    return;
+  }
+  tcp_info_sampler_ = std::make_unique<TcpInfoSampler>(loop_, interval_ms);
+  for (const auto& item : connection_map_) {
+    tcp_info_sampler_->Add(item.second);
+  }
+}
+std::vector<TcpInfoSample> TcpServer::GetSlowestConnections(size_t n) const {
+  if (!tcp_info_sampler_) {
+    return {};
+  }
+  return tcp_info_sampler_->GetSlowest(n);
+}
+void TcpServer::UpdateAccepting() {
+  if (!running_) {
+    return;
+  }
+  size_t live = connection_map_.size();
+  size_t allowance =
+      live >= max_connections_
+          ? 0
+          : std::min((size_t)accept_batch_, max_connections_ - live);
+  if (accept_rate_ && allowance > 0) {
+    auto now = TimePoint::now();
+    auto tokens = (size_t)std::max(accept_rate_->GetTokens(now), 0.0);
+    allowance = std::min(allowance, tokens);
+    if (allowance == 0 && accept_rate_timer_.GetId() == 0) {
+      accept_rate_timer_ =
+          loop_->CallLater((int)accept_rate_->GetWaitMs(1, now), [this] {
+            accept_rate_timer_ = TimerId();
+            UpdateAccepting();
+          });
+    }
+  }
+  if (allowance == 0) {
+    acceptor_->StopAccepting();
+  } else {
+    acceptor_->SetAcceptBatch((int)allowance);
+    acceptor_->StartAccepting();
+  }
+}
 // NOTE:
 // 这个OnClose函数有两种被调用的可能性
 // 1. 在tcpevent的handle_close中被调用，也就是read = 0
@@ -53,8 +174,20 @@ void TcpServer::OnClose(const TcpEventPrt_t& conn) {
   // HINT: 这个时候conn指针还有可能还被用户持有
   auto status = connection_map_.erase(name);
   assert(status == 1);
+  if (active_connections_) {
+    active_connections_->Dec();
+  }
   log_info("[TcpServer::OnClose]->remove connection from %s fd = %d",
            name.c_str(), fd);
+  ip_counter_.Decrease(conn->GetPeerAddress());
+  if (tcp_info_sampler_) {
+    tcp_info_sampler_->Remove(conn);
+  }
   conn->ConnectDestroyed();
+  UpdateAccepting();
+}
+void TcpServer::Run() {
+  acceptor_->Listen();
+  running_ = true;
+  UpdateAccepting();
 }
-void TcpServer::Run() { acceptor_->Listen(); }
@@ -7,28 +7,79 @@
 
 #include "acceptor.h"
 #include "iowatcher.h"
+#include "ipcounter.h"
+#include "metrics.h"
 #include "noncopyable.h"
 #include "tcpevent.h"
+#include "tcpinfosampler.h"
+#include "timerid.h"
 #include "tohka.h"
+#include "tokenbucket.h"
 #include "util/log.h"
 
 // manage tcpevent
 namespace tohka {
 class TcpServer : noncopyable {
  public:
-  TcpServer(IoLoop* loop,NetAddress bind_address);
+  TcpServer(IoLoop* loop, NetAddress bind_address);
   ~TcpServer();
 
   void Run();
   void SetOnConnection(const OnConnectionCallback& cb) { on_connection_ = cb; }
   void SetOnMessage(const OnMessageCallback& cb) { on_message_ = cb; }
   void SetOnWriteDone(const OnWriteDoneCallback& cb) { on_write_done_ = cb; }
+  // see TcpEvent::SetAutoCork, applied to connections accepted later
+  void SetAutoCork(bool on) { auto_cork_ = on; }
+  // count this server in the process wide tohka_tcp_server_* metrics, on
+  // by default. Call before Run.
+  void EnableMetrics(bool on);
+  // max connections accepted per listen socket readiness event
+  void SetAcceptBatch(int accept_batch) { accept_batch_ = accept_batch; }
+
+  // TCP fast open: the request in the client's SYN is readable at accept.
+  // queue_len is the max pending fast open requests. Call before Run.
+  void SetTcpFastOpen(int queue_len) { acceptor_->SetTcpFastOpen(queue_len); }
+  // Do not wake up the loop before the client sent data (or timeout_sec
+  // passed). Call before Run.
+  void SetDeferAccept(int timeout_sec) {
+    acceptor_->SetDeferAccept(timeout_sec);
+  }
+
+  // Admission control. While over the global cap or out of accept tokens
+  // the listen socket is not polled, so new connections wait (or are
+  // dropped) in the kernel backlog. A connection over its per ip cap is
+  // closed right after accept.
+  void SetMaxConnections(size_t max_connections) {
+    max_connections_ = max_connections;
+  }
+  // 0 means unlimited
+  void SetMaxConnectionsPerIp(size_t max_connections_per_ip) {
+    max_connections_per_ip_ = max_connections_per_ip;
+  }
+  // accept at most rate connections per second with bursts up to burst
+  void SetAcceptRate(double rate, double burst);
+  size_t GetConnectionCount() const { return connection_map_.size(); }
+  int64_t GetRejectedCount() const { return rejected_count_; }
+
+  // Read TCP_INFO of every connection each interval_ms, see
+  // TcpInfoSampler. 0 stops sampling.
+  void SetTcpInfoSampling(int interval_ms);
+  // nullptr unless sampling
+  const TcpInfoStats* GetTcpInfoStats() const {
+    return tcp_info_sampler_ ? &tcp_info_sampler_->GetStats() : nullptr;
+  }
+  // the n connections with the highest rtt at their last sample, empty
+  // unless sampling
+  std::vector<TcpInfoSample> GetSlowestConnections(size_t n) const;
 
  private:
   // call OnConnectionCallback
   void OnAccept(int conn_fd, NetAddress& peer_address);
+  void OnAcceptBatch(AcceptedList& accepted);
 
   void OnClose(const TcpEventPrt_t& conn);
+  // pause or resume the acceptor and size its next batch
+  void UpdateAccepting();
 
   IoLoop* loop_;
   std::unique_ptr<Acceptor> acceptor_;
@@ -37,6 +88,25 @@ class TcpServer : noncopyable {
   OnMessageCallback on_message_;
   OnWriteDoneCallback on_write_done_;
   int64_t conn_id_;
+  bool auto_cork_;
+  bool running_;
+  int accept_batch_;
+  size_t max_connections_;
+  size_t max_connections_per_ip_;
+  std::unique_ptr<TokenBucket> accept_rate_;
+  // resume accepting once tokens refill
+  TimerId accept_rate_timer_;
+  IpCounter ip_counter_;
+  int64_t rejected_count_;
+  // shared by all servers of the process, nullptr with metrics off
+  Counter* accepted_total_;
+  Counter* rejected_total_;
+  Gauge* active_connections_;
+  Counter* received_bytes_;
+  Counter* sent_bytes_;
+  std::unique_ptr<TcpInfoSampler> tcp_info_sampler_;
+  static constexpr int kDefaultAcceptBatch = 64;
+  static constexpr size_t kDefaultMaxConnections = 200000;
 };
 }  // namespace tohka
 #endif  // TOHKA_TOHKA_TCPSERVER_H
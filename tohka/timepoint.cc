@@ -13,7 +13,8 @@ TimePoint TimePoint::now() {
 }
 std::string TimePoint::ToFormatString(bool show_microseconds) const {
   auto time_t = (std::time_t)(microseconds_ / kMicroSecondPerSecond);
-  auto tm = std::localtime(&time_t);
+  struct tm tm_buffer;
+  auto tm = localtime_r(&time_t, &tm_buffer);
   char time_buffer[64]{};
   if (show_microseconds) {
     auto microseconds = microseconds_ % kMicroSecondPerSecond;
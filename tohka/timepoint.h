@@ -27,7 +27,7 @@ class TimePoint {
   bool operator==(const TimePoint& other) const {
     return this->microseconds_ == other.microseconds_;
   }
-  TimePoint operator+(int32_t delay_ms) const {
+  TimePoint operator+(int64_t delay_ms) const {
     return TimePoint{microseconds_ + delay_ms * kMilliSecondsPerSecond};
   }
 
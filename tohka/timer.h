@@ -27,6 +27,10 @@ class Timer : noncopyable {
   TimePoint GetExpiredTime() const { return expired_time_; }
   int64_t GetTimerId() const { return timer_id_; }
   bool IsRepeat() const { return repeat_; }
+  // where the callback was made, for Watchdog
+  const std::type_info& GetCallbackType() const {
+    return timer_callback_.target_type();
+  }
 
   void Restart(TimePoint now);
 
@@ -6,6 +6,7 @@
 
 #include "timer.h"
 #include "util/log.h"
+#include "util/probes.h"
 using namespace tohka;
 
 TimerId TimerManager::AddTimer(TimePoint when, TimerCallback cb,
@@ -16,6 +17,7 @@ TimerId TimerManager::AddTimer(TimePoint when, TimerCallback cb,
   timer_map_.emplace(when, timer);
   int64_t timer_id = timer->GetTimerId();
   activate_timers_.emplace(timer_id, timer);
+  UpdatePendingGauge();
 
   return {timer, timer_id};
 }
@@ -53,6 +55,12 @@ int64_t TimerManager::GetNextExpiredDuration() {
   }
   return left_time;
 }
+TimePoint TimerManager::GetNextExpiredTime() const {
+  if (timer_map_.empty()) {
+    return {};
+  }
+  return timer_map_.begin()->first;
+}
 void TimerManager::DeleteTimer(const TimerId& timer_id) {
   TimerPrt_t timer = timer_id.timer_.lock();
   if (!timer) {
@@ -67,6 +75,7 @@ void TimerManager::DeleteTimer(const TimerId& timer_id) {
       if (i->second == it->second) {
         activate_timers_.erase(it);
         timer_map_.erase(i);
+        UpdatePendingGauge();
         break;
       }
     }
@@ -76,18 +85,41 @@ void TimerManager::DeleteTimer(const TimerId& timer_id) {
   assert(timer_map_.size() == activate_timers_.size());
 }
 TimerManager::TimerManager()
-    : timer_map_(), activate_timers_(), calling_expired_timers_(false) {}
+    : timer_map_(),
+      activate_timers_(),
+      calling_expired_timers_(false),
+      watchdog_(nullptr),
+      pending_timers_(MetricsRegistry::Get()->AddGauge(
+          "tohka_timers_pending", "Timers waiting to fire.")),
+      reported_pending_(0) {}
+TimerManager::~TimerManager() { pending_timers_->Add(-reported_pending_); }
 
-void TimerManager::DoExpiredTimers() {
+size_t TimerManager::DoExpiredTimers() {
   auto expired_timers = GetExpiredTimers();
 
   calling_expired_timers_ = true;
   cancel_timers_.clear();
   for (const auto& expired_timer : expired_timers) {
-    expired_timer->run();
+    int64_t start = TOHKA_PROBE_START(timer_fire);
+    if (watchdog_ != nullptr) {
+      static const std::string kName = "timer";
+      TimePoint callback_start = TimePoint::now();
+      expired_timer->run();
+      watchdog_->OnCallbackDone(callback_start,
+                                expired_timer->GetCallbackType(), -1, kName);
+    } else {
+      expired_timer->run();
+    }
+    TOHKA_PROBE3(
+        timer_fire, expired_timer->GetTimerId(),
+        start != 0 ? start - expired_timer->GetExpiredTime().GetMicroSeconds()
+                   : 0,
+        TOHKA_PROBE_ELAPSED(start));
   }
   calling_expired_timers_ = false;
   Reset(expired_timers);
+  UpdatePendingGauge();
+  return expired_timers.size();
 }
 void TimerManager::Reset(ExpiredTimers& expired_timers) {
   auto now = TimePoint::now();
@@ -103,3 +135,10 @@ void TimerManager::Reset(ExpiredTimers& expired_timers) {
     }
   }
 }
+void TimerManager::UpdatePendingGauge() {
+  auto pending = (int64_t)timer_map_.size();
+  if (pending != reported_pending_) {
+    pending_timers_->Add(pending - reported_pending_);
+    reported_pending_ = pending;
+  }
+}
@@ -5,26 +5,36 @@
 #ifndef TOHKA_TOHKA_TIMERMANAGER_H
 #define TOHKA_TOHKA_TIMERMANAGER_H
 
+#include "metrics.h"
 #include "noncopyable.h"
 #include "timepoint.h"
 #include "tohka.h"
 #include "timerid.h"
+#include "watchdog.h"
 
 namespace tohka {
 class TimerManager : noncopyable {
  public:
   TimerManager();
+  ~TimerManager();
   static constexpr int64_t kDefaultTimeOutMs = 10000;
 
   TimerId AddTimer(TimePoint when, TimerCallback cb, int32_t interval);
   void DeleteTimer(const TimerId& timer_id);
 
   int64_t GetNextExpiredDuration();
-  void DoExpiredTimers();
+  // invalid if there is no timer
+  TimePoint GetNextExpiredTime() const;
+  // returns the number of timers run
+  size_t DoExpiredTimers();
+  // times the timer callbacks, nullptr is off
+  void SetWatchdog(Watchdog* watchdog) { watchdog_ = watchdog; }
 
  private:
   ExpiredTimers GetExpiredTimers();
   void Reset(ExpiredTimers& expired);
+  // move the pending timers gauge to the size of timer_map_
+  void UpdatePendingGauge();
 
   // for sort
   using TimerMap = std::multimap<TimePoint, TimerPrt_t>;
@@ -33,6 +43,10 @@ class TimerManager : noncopyable {
   ActivateTimers activate_timers_;
   ActivateTimers cancel_timers_;
   bool calling_expired_timers_;
+  Watchdog* watchdog_;
+  Gauge* pending_timers_;
+  // what this manager added to the gauge
+  int64_t reported_pending_;
 };
 }  // namespace tohka
 #endif  // TOHKA_TOHKA_TIMERMANAGER_H
@@ -18,10 +18,14 @@ class TimePoint;
 class Socket;
 class NetAddress;
 class Timer;
+class Resolver;
+class TrafficShaper;
 
 // typedef
 using TimerPrt_t = std::shared_ptr<Timer>;
 using TcpEventPrt_t = std::shared_ptr<TcpEvent>;
+// immutable bytes that may be queued on several connections at once
+using SharedBufPrt_t = std::shared_ptr<const std::string>;
 
 using EventList = std::vector<IoEvent*>;
 using ExpiredTimers = std::vector<TimerPrt_t>;
@@ -33,8 +37,13 @@ using NormalCallback = std::function<void()>;
 // for acceptor
 using OnAcceptCallback =
     std::function<void(int conn_fd, NetAddress& peer_address)>;
+using AcceptedList = std::vector<std::pair<int, NetAddress>>;
+using OnAcceptBatchCallback = std::function<void(AcceptedList& accepted)>;
 // for connector
 using OnConnectCallback = std::function<void(int sock_fd)>;
+// for resolver
+using OnResolveCallback =
+    std::function<void(const std::vector<NetAddress>& addresses)>;
 
 // for tcpserver
 using OnConnectionCallback = std::function<void(const TcpEventPrt_t& conn)>;
@@ -44,6 +53,7 @@ using OnWriteDoneCallback = std::function<void(const TcpEventPrt_t& conn)>;
 
 using OnCloseCallback = std::function<void(const TcpEventPrt_t& conn)>;
 using OnHighWaterMark = std::function<void(const TcpEventPrt_t& conn)>;
+using OnLowWaterMark = std::function<void(const TcpEventPrt_t& conn)>;
 
 // for tcp event
 void DefaultOnConnection(const TcpEventPrt_t& conn);
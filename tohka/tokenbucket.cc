@@ -0,0 +1,57 @@
+//
+// Created by li on 2022/6/14.
+//
+
+#include "tokenbucket.h"
+
+using namespace tohka;
+
+TokenBucket::TokenBucket(double rate, double burst)
+    : rate_(rate), burst_(burst), tokens_(burst), last_refill_() {}
+
+void TokenBucket::SetRate(double rate, double burst) {
+  rate_ = rate;
+  burst_ = burst;
+  tokens_ = std::min(tokens_, burst_);
+}
+void TokenBucket::Refill(TimePoint now) {
+  if (last_refill_.GetMicroSeconds() < 0) {
+    last_refill_ = now;
+    return;
+  }
+  int64_t elapsed = now.GetMicroSeconds() - last_refill_.GetMicroSeconds();
+  if (elapsed > 0) {
+    tokens_ = std::min(
+        burst_,
+        tokens_ + rate_ * (double)elapsed / TimePoint::kMicroSecondPerSecond);
+    last_refill_ = now;
+  }
+}
+double TokenBucket::GetTokens(TimePoint now) {
+  Refill(now);
+  return tokens_;
+}
+bool TokenBucket::TryConsume(double n, TimePoint now) {
+  Refill(now);
+  if (tokens_ < n) {
+    return false;
+  }
+  tokens_ -= n;
+  return true;
+}
+void TokenBucket::Consume(double n, TimePoint now) {
+  Refill(now);
+  tokens_ -= n;
+}
+int64_t TokenBucket::GetWaitMs(double n, TimePoint now) {
+  Refill(now);
+  if (tokens_ >= n) {
+    return 0;
+  }
+  if (rate_ <= 0) {
+    return INT32_MAX;
+  }
+  double wait_ms = (n - tokens_) / rate_ * TimePoint::kMilliSecondsPerSecond;
+  // round up, or the timer wakes up one tick early
+  return (int64_t)wait_ms + 1;
+}
@@ -0,0 +1,38 @@
+//
+// Created by li on 2022/6/14.
+//
+
+#ifndef TOHKA_TOHKA_TOKENBUCKET_H
+#define TOHKA_TOHKA_TOKENBUCKET_H
+
+#include "timepoint.h"
+
+namespace tohka {
+// Token bucket refilled lazily from the loop clock, no timer needed.
+// rate is tokens per second, burst is the bucket capacity.
+class TokenBucket {
+ public:
+  TokenBucket(double rate, double burst);
+
+  void SetRate(double rate, double burst);
+  double GetRate() const { return rate_; }
+  double GetBurst() const { return burst_; }
+
+  // available tokens at now
+  double GetTokens(TimePoint now);
+  // take n tokens if available
+  bool TryConsume(double n, TimePoint now);
+  // take n tokens even if the bucket goes negative (debt)
+  void Consume(double n, TimePoint now);
+  // milliseconds until n tokens are available, 0 if already available
+  int64_t GetWaitMs(double n, TimePoint now);
+
+ private:
+  void Refill(TimePoint now);
+  double rate_;
+  double burst_;
+  double tokens_;
+  TimePoint last_refill_;
+};
+}  // namespace tohka
+#endif  // TOHKA_TOHKA_TOKENBUCKET_H
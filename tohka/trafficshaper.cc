@@ -0,0 +1,58 @@
+//
+// Created by li on 2022/6/28.
+//
+
+#include "trafficshaper.h"
+
+#include "ioloop.h"
+#include "tcpevent.h"
+using namespace tohka;
+
+TrafficShaper::TrafficShaper(IoLoop* loop) : loop_(loop) {}
+TrafficShaper::~TrafficShaper() {
+  if (timer_.GetId() != 0) {
+    loop_->DeleteTimer(timer_);
+  }
+}
+
+void TrafficShaper::Park(const TcpEventPrt_t& conn, int64_t wait_ms) {
+  // round up to the tick, the connections of one tick wake up together
+  int64_t tick_us = kTickMs * TimePoint::kMilliSecondsPerSecond;
+  int64_t at = TimePoint::now().GetMicroSeconds() +
+               std::max<int64_t>(wait_ms, 1) * TimePoint::kMilliSecondsPerSecond;
+  at = (at + tick_us - 1) / tick_us * tick_us;
+  parked_.emplace(at, conn);
+  ArmTimer();
+}
+void TrafficShaper::OnTick() {
+  timer_ = TimerId();
+  timer_at_ = TimePoint();
+  // a resumed connection may park again, for a later tick
+  std::vector<std::weak_ptr<TcpEvent>> due;
+  int64_t now = TimePoint::now().GetMicroSeconds();
+  auto end = parked_.upper_bound(now);
+  for (auto it = parked_.begin(); it != end; ++it) {
+    due.push_back(std::move(it->second));
+  }
+  parked_.erase(parked_.begin(), end);
+  for (const auto& weak_conn : due) {
+    if (auto conn = weak_conn.lock()) {
+      conn->ResumeThrottled();
+    }
+  }
+  ArmTimer();
+}
+void TrafficShaper::ArmTimer() {
+  if (parked_.empty()) {
+    return;
+  }
+  TimePoint at(parked_.begin()->first);
+  if (timer_.GetId() != 0) {
+    if (!(at < timer_at_)) {
+      return;
+    }
+    loop_->DeleteTimer(timer_);
+  }
+  timer_at_ = at;
+  timer_ = loop_->CallAt(at, [this] { OnTick(); });
+}
@@ -0,0 +1,41 @@
+//
+// Created by li on 2022/6/28.
+//
+
+#ifndef TOHKA_TOHKA_TRAFFICSHAPER_H
+#define TOHKA_TOHKA_TRAFFICSHAPER_H
+
+#include "noncopyable.h"
+#include "timepoint.h"
+#include "timerid.h"
+#include "tohka.h"
+namespace tohka {
+// Wakes up the connections of one loop that ran out of rate limit tokens.
+//
+// There is one timer for all of them, set to the earliest wake up rounded
+// up to a tick, so connections due within the same tick resume together
+// instead of each having its own timer.
+class TrafficShaper : noncopyable {
+ public:
+  explicit TrafficShaper(IoLoop* loop);
+  ~TrafficShaper();
+
+  // call conn->ResumeThrottled() in about wait_ms
+  void Park(const TcpEventPrt_t& conn, int64_t wait_ms);
+  size_t GetParkedCount() const { return parked_.size(); }
+
+ private:
+  void OnTick();
+  void ArmTimer();
+
+  static constexpr int kTickMs = 10;
+  IoLoop* loop_;
+  // wake up time in microseconds -> connection
+  std::multimap<int64_t, std::weak_ptr<TcpEvent>> parked_;
+  TimerId timer_;
+  // invalid when the timer is not armed
+  TimePoint timer_at_;
+};
+}  // namespace tohka
+
+#endif  // TOHKA_TOHKA_TRAFFICSHAPER_H
@@ -0,0 +1,302 @@
+//
+// Created by li on 2022/6/27.
+//
+
+#include "upstreamgroup.h"
+
+#include "ioloop.h"
+#include "socketutil.h"
+#include "util/log.h"
+using namespace tohka;
+
+namespace {
+// FNV-1a with the splitmix64 finalizer, names differing in the last byte
+// get unrelated hashes. Stable across processes so relays agree on the
+// Maglev table.
+uint64_t Hash(const void* data, size_t len, uint64_t seed) {
+  auto p = static_cast<const unsigned char*>(data);
+  uint64_t h = 14695981039346656037ULL ^ seed;
+  for (size_t i = 0; i < len; ++i) {
+    h ^= p[i];
+    h *= 1099511628211ULL;
+  }
+  h ^= h >> 30;
+  h *= 0xbf58476d1ce4e5b9ULL;
+  h ^= h >> 27;
+  h *= 0x94d049bb133111ebULL;
+  h ^= h >> 31;
+  return h;
+}
+bool IsPrime(size_t n) {
+  if (n < 2) {
+    return false;
+  }
+  for (size_t d = 2; d * d <= n; ++d) {
+    if (n % d == 0) {
+      return false;
+    }
+  }
+  return true;
+}
+}  // namespace
+
+UpstreamGroup::UpstreamGroup(IoLoop* loop, Policy policy)
+    : loop_(loop),
+      policy_(policy),
+      maglev_dirty_(false),
+      rr_cursor_(0),
+      random_(std::random_device{}()),
+      consecutive_failures_(5),
+      base_ejection_ms_(30 * 1000),
+      max_ejection_percent_(50),
+      check_interval_ms_(0),
+      check_timeout_ms_(0),
+      check_rise_(0),
+      check_fall_(0),
+      check_cursor_(0) {}
+UpstreamGroup::~UpstreamGroup() {
+  if (check_timer_.GetId() != 0) {
+    loop_->DeleteTimer(check_timer_);
+  }
+  for (auto& upstream : upstreams_) {
+    if (upstream.checker) {
+      upstream.checker->Stop();
+    }
+  }
+}
+
+void UpstreamGroup::AddUpstream(const NetAddress& address) {
+  all_.push_back(upstreams_.size());
+  upstreams_.emplace_back();
+  upstreams_.back().address = address;
+  Rebuild();
+}
+bool UpstreamGroup::IsAvailable(size_t index) const {
+  const Upstream& upstream = upstreams_[index];
+  return upstream.healthy && !IsEjected(upstream, TimePoint::now());
+}
+
+size_t UpstreamGroup::Acquire(uint64_t hash_key) {
+  if (upstreams_.empty()) {
+    return kNone;
+  }
+  if (next_return_.GetMicroSeconds() >= 0 &&
+      !(TimePoint::now() < next_return_)) {
+    Rebuild();
+  }
+  const auto& candidates = available_.empty() ? all_ : available_;
+  size_t index;
+  switch (policy_) {
+    case kRoundRobin:
+      index = candidates[rr_cursor_++ % candidates.size()];
+      break;
+    case kLeastConnections: {
+      // power of two choices, close to the least loaded without a scan
+      size_t a = candidates[random_() % candidates.size()];
+      size_t b = candidates[random_() % candidates.size()];
+      index = upstreams_[b].active < upstreams_[a].active ? b : a;
+    } break;
+    case kMaglev:
+    default:
+      if (maglev_dirty_) {
+        BuildMaglevTable();
+      }
+      index = available_.empty()
+                  ? candidates[hash_key % candidates.size()]
+                  : maglev_table_[hash_key % maglev_table_.size()];
+      break;
+  }
+  ++upstreams_[index].active;
+  return index;
+}
+void UpstreamGroup::Release(size_t index) {
+  assert(upstreams_[index].active > 0);
+  --upstreams_[index].active;
+}
+
+void UpstreamGroup::ReportConnectSuccess(size_t index) {
+  Upstream& upstream = upstreams_[index];
+  upstream.consecutive_failures = 0;
+  upstream.ejections = 0;
+}
+void UpstreamGroup::ReportConnectFailure(size_t index) {
+  Upstream& upstream = upstreams_[index];
+  auto now = TimePoint::now();
+  if (++upstream.consecutive_failures < consecutive_failures_ ||
+      IsEjected(upstream, now)) {
+    return;
+  }
+  size_t ejected = std::count_if(
+      upstreams_.begin(), upstreams_.end(),
+      [now](const Upstream& u) { return IsEjected(u, now); });
+  size_t max_ejected = std::max<size_t>(
+      1, upstreams_.size() * max_ejection_percent_ / 100);
+  if (ejected >= max_ejected) {
+    return;
+  }
+  upstream.consecutive_failures = 0;
+  upstream.ejections = std::min(upstream.ejections + 1, kMaxEjectionFactor);
+  int ejection_ms = base_ejection_ms_ * upstream.ejections;
+  upstream.ejected_until = now + ejection_ms;
+  log_warn("[UpstreamGroup::ReportConnectFailure]->eject %s for %d ms",
+           upstream.address.GetIpAndPort().c_str(), ejection_ms);
+  Rebuild();
+}
+void UpstreamGroup::SetOutlierDetection(int consecutive_failures,
+                                        int base_ejection_ms,
+                                        int max_ejection_percent) {
+  consecutive_failures_ = consecutive_failures;
+  base_ejection_ms_ = base_ejection_ms;
+  max_ejection_percent_ = max_ejection_percent;
+}
+
+void UpstreamGroup::EnableHealthCheck(int interval_ms, int timeout_ms,
+                                      int rise, int fall) {
+  check_interval_ms_ = interval_ms;
+  check_timeout_ms_ = timeout_ms;
+  check_rise_ = rise;
+  check_fall_ = fall;
+  if (check_timer_.GetId() != 0) {
+    loop_->DeleteTimer(check_timer_);
+  }
+  // one tick per upstream per interval, the probes do not come in bursts
+  int tick_ms = std::max(
+      interval_ms / (int)std::max<size_t>(upstreams_.size(), 1),
+      kMinCheckTickMs);
+  check_timer_ = loop_->CallEvery(tick_ms, [this] { CheckTick(); });
+}
+
+uint64_t UpstreamGroup::HashAddress(const NetAddress& address) {
+  const sockaddr* sa = address.GetAddress();
+  if (sa->sa_family == AF_INET6) {
+    const auto* in6 = reinterpret_cast<const sockaddr_in6*>(sa);
+    return Hash(&in6->sin6_addr, sizeof(in6->sin6_addr), 0);
+  }
+  const auto* in4 = reinterpret_cast<const sockaddr_in*>(sa);
+  return Hash(&in4->sin_addr, sizeof(in4->sin_addr), 0);
+}
+
+bool UpstreamGroup::IsEjected(const Upstream& upstream, TimePoint now) {
+  return upstream.ejected_until.GetMicroSeconds() >= 0 &&
+         now < upstream.ejected_until;
+}
+void UpstreamGroup::Rebuild() {
+  auto now = TimePoint::now();
+  available_.clear();
+  next_return_ = TimePoint();
+  for (size_t i = 0; i < upstreams_.size(); ++i) {
+    Upstream& upstream = upstreams_[i];
+    if (IsEjected(upstream, now)) {
+      if (next_return_.GetMicroSeconds() < 0 ||
+          upstream.ejected_until < next_return_) {
+        next_return_ = upstream.ejected_until;
+      }
+      continue;
+    }
+    upstream.ejected_until = TimePoint();
+    if (upstream.healthy) {
+      available_.push_back(i);
+    }
+  }
+  if (available_.empty() && !upstreams_.empty()) {
+    log_error("[UpstreamGroup::Rebuild]->no upstream available, panic");
+  }
+  // built by the next Acquire, adding many upstreams builds it once
+  maglev_dirty_ = true;
+}
+void UpstreamGroup::BuildMaglevTable() {
+  size_t n = available_.size();
+  if (n == 0) {
+    maglev_dirty_ = false;
+    maglev_table_.clear();
+    return;
+  }
+  // about 100 entries per upstream keeps the shares within 1% of each
+  // other. Sized by all upstreams, an ejection must not resize the table
+  // or every key would move.
+  size_t size = std::max(kMinMaglevSize, upstreams_.size() * 100);
+  while (!IsPrime(size)) {
+    ++size;
+  }
+  std::vector<uint64_t> offset(n);
+  std::vector<uint64_t> skip(n);
+  std::vector<uint64_t> next(n, 0);
+  for (size_t i = 0; i < n; ++i) {
+    std::string name = upstreams_[available_[i]].address.GetIpAndPort();
+    offset[i] = Hash(name.data(), name.size(), 0) % size;
+    skip[i] = Hash(name.data(), name.size(), 1) % (size - 1) + 1;
+  }
+  maglev_dirty_ = false;
+  maglev_table_.assign(size, UINT32_MAX);
+  size_t filled = 0;
+  while (true) {
+    for (size_t i = 0; i < n; ++i) {
+      // next free slot in the preference list of upstream i
+      uint64_t slot = (offset[i] + next[i] * skip[i]) % size;
+      while (maglev_table_[slot] != UINT32_MAX) {
+        ++next[i];
+        slot = (offset[i] + next[i] * skip[i]) % size;
+      }
+      maglev_table_[slot] = (uint32_t)available_[i];
+      ++next[i];
+      if (++filled == size) {
+        return;
+      }
+    }
+  }
+}
+void UpstreamGroup::CheckTick() {
+  if (upstreams_.empty()) {
+    return;
+  }
+  int tick_ms = std::max(check_interval_ms_ / (int)upstreams_.size(),
+                         kMinCheckTickMs);
+  // upstreams added since EnableHealthCheck make the batches bigger
+  size_t batch = std::max<size_t>(
+      1, (upstreams_.size() * tick_ms + check_interval_ms_ - 1) /
+             check_interval_ms_);
+  for (size_t i = 0; i < batch && i < upstreams_.size(); ++i) {
+    StartCheck(check_cursor_++ % upstreams_.size());
+  }
+}
+void UpstreamGroup::StartCheck(size_t index) {
+  Upstream& upstream = upstreams_[index];
+  if (upstream.checking) {
+    return;
+  }
+  if (!upstream.checker) {
+    upstream.checker = std::make_unique<Connector>(loop_, upstream.address);
+    upstream.checker->SetRetry(false);
+    upstream.checker->EnableConnectTimeout(true);
+    upstream.checker->SetConnectTimeout(check_timeout_ms_);
+    upstream.checker->SetOnConnect([this, index](int sock_fd) {
+      SockUtil::Close_(sock_fd);
+      OnCheckResult(index, true);
+    });
+    upstream.checker->SetOnConnectFailed(
+        [this, index] { OnCheckResult(index, false); });
+  }
+  upstream.checking = true;
+  upstream.checker->Restart();
+}
+void UpstreamGroup::OnCheckResult(size_t index, bool pass) {
+  Upstream& upstream = upstreams_[index];
+  upstream.checking = false;
+  if (pass) {
+    upstream.check_failures = 0;
+    if (++upstream.check_passes >= check_rise_ && !upstream.healthy) {
+      log_info("[UpstreamGroup::OnCheckResult]->%s is healthy",
+               upstream.address.GetIpAndPort().c_str());
+      upstream.healthy = true;
+      Rebuild();
+    }
+  } else {
+    upstream.check_passes = 0;
+    if (++upstream.check_failures >= check_fall_ && upstream.healthy) {
+      log_warn("[UpstreamGroup::OnCheckResult]->%s is unhealthy",
+               upstream.address.GetIpAndPort().c_str());
+      upstream.healthy = false;
+      Rebuild();
+    }
+  }
+}
@@ -0,0 +1,119 @@
+//
+// Created by li on 2022/6/27.
+//
+
+#ifndef TOHKA_TOHKA_UPSTREAMGROUP_H
+#define TOHKA_TOHKA_UPSTREAMGROUP_H
+
+#include <random>
+
+#include "connector.h"
+#include "netaddress.h"
+#include "noncopyable.h"
+#include "timepoint.h"
+#include "timerid.h"
+#include "tohka.h"
+namespace tohka {
+// Upstreams of one loop to spread new connections over.
+//
+// An upstream is available while its active health check passes and it is
+// not ejected for failing connects in a row. Picking is O(1) for every
+// policy: round robin walks the available list, least connections takes
+// the less loaded of two random upstreams, Maglev looks the hash key up in
+// a table that is only rebuilt when the available set changed since the
+// last pick. When no
+// upstream is available every upstream is picked from again (panic mode)
+// instead of failing all connections.
+class UpstreamGroup : noncopyable {
+ public:
+  enum Policy { kRoundRobin, kLeastConnections, kMaglev };
+  static constexpr size_t kNone = SIZE_MAX;
+
+  UpstreamGroup(IoLoop* loop, Policy policy);
+  ~UpstreamGroup();
+
+  void AddUpstream(const NetAddress& address);
+  size_t Size() const { return upstreams_.size(); }
+  const NetAddress& GetAddress(size_t index) const {
+    return upstreams_[index].address;
+  }
+  bool IsAvailable(size_t index) const;
+  size_t GetActiveConnections(size_t index) const {
+    return upstreams_[index].active;
+  }
+
+  // upstream for a new connection, kNone if the group is empty. It counts
+  // as active until Release. Maglev maps hash_key (e.g. HashAddress of the
+  // client) to the same upstream while the available set stays the same,
+  // and moves few keys when it changes.
+  size_t Acquire(uint64_t hash_key = 0);
+  void Release(size_t index);
+
+  // passive outlier detection, fed by the users' connect results
+  void ReportConnectSuccess(size_t index);
+  void ReportConnectFailure(size_t index);
+  // eject after consecutive_failures connect failures, for base_ejection_ms
+  // times the number of ejections in a row, never more than
+  // max_ejection_percent of the upstreams at once
+  void SetOutlierDetection(int consecutive_failures, int base_ejection_ms,
+                           int max_ejection_percent);
+
+  // tcp connect to every upstream each interval_ms, spread over the
+  // interval. rise passes in a row make an upstream healthy again, fall
+  // failures in a row unhealthy.
+  void EnableHealthCheck(int interval_ms, int timeout_ms, int rise, int fall);
+
+  // hash of the ip only, for client affinity
+  static uint64_t HashAddress(const NetAddress& address);
+
+ private:
+  struct Upstream {
+    NetAddress address;
+    size_t active = 0;
+    // active health check
+    bool healthy = true;
+    bool checking = false;
+    int check_passes = 0;
+    int check_failures = 0;
+    std::unique_ptr<Connector> checker;
+    // passive outlier detection
+    int consecutive_failures = 0;
+    int ejections = 0;
+    // invalid when not ejected
+    TimePoint ejected_until;
+  };
+  static bool IsEjected(const Upstream& upstream, TimePoint now);
+  void Rebuild();
+  void BuildMaglevTable();
+  void CheckTick();
+  void StartCheck(size_t index);
+  void OnCheckResult(size_t index, bool pass);
+
+  static constexpr size_t kMinMaglevSize = 65537;
+  static constexpr int kMaxEjectionFactor = 10;
+  static constexpr int kMinCheckTickMs = 10;
+  IoLoop* loop_;
+  Policy policy_;
+  std::vector<Upstream> upstreams_;
+  std::vector<size_t> all_;
+  std::vector<size_t> available_;
+  // Maglev lookup table over available_, size is a prime
+  std::vector<uint32_t> maglev_table_;
+  bool maglev_dirty_;
+  // earliest end of an ejection, Acquire rebuilds then
+  TimePoint next_return_;
+  size_t rr_cursor_;
+  std::mt19937 random_;
+  int consecutive_failures_;
+  int base_ejection_ms_;
+  int max_ejection_percent_;
+  int check_interval_ms_;
+  int check_timeout_ms_;
+  int check_rise_;
+  int check_fall_;
+  size_t check_cursor_;
+  TimerId check_timer_;
+};
+}  // namespace tohka
+
+#endif  // TOHKA_TOHKA_UPSTREAMGROUP_H
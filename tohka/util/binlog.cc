@@ -0,0 +1,352 @@
+//
+// Created by li on 2022/7/6.
+//
+
+#include "binlog.h"
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+using namespace tohka;
+
+namespace {
+constexpr auto kWriterWait = std::chrono::milliseconds(10);
+constexpr auto kCalibration = std::chrono::milliseconds(10);
+
+struct SiteEntry {
+  BinLog::Site site;
+  const char* types;
+};
+using RingPtr = std::shared_ptr<LogRing>;
+
+struct Writer {
+  std::atomic<bool> running{false};
+  FILE* fp = nullptr;
+  size_t ring_size = 0;
+  bool text = false;
+  std::thread thread;
+  std::mutex mutex;
+  std::condition_variable wake;
+  // guarded by mutex
+  std::deque<SiteEntry> sites;
+  std::vector<RingPtr> rings;
+  bool stop = false;
+  // level set by SetLevel, applies while running
+  int level = LOG_TRACE;
+  // ticks to microseconds, the rate is measured from start on and the
+  // anchor moves to the latest wake up of the writer
+  int64_t start_ticks = 0;
+  int64_t start_us = 0;
+  int64_t anchor_ticks = 0;
+  int64_t anchor_us = 0;
+  double ticks_per_us = 1;
+} W;
+
+int64_t NowUs() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+             std::chrono::system_clock::now().time_since_epoch())
+      .count();
+}
+
+void Calibrate(int64_t ticks, int64_t us) {
+  W.anchor_ticks = ticks;
+  W.anchor_us = us;
+  if (us > W.start_us) {
+    W.ticks_per_us = (double)(ticks - W.start_ticks) / (us - W.start_us);
+  }
+}
+
+int64_t TicksToUs(int64_t ticks) {
+  return W.anchor_us + (int64_t)((ticks - W.anchor_ticks) / W.ticks_per_us);
+}
+
+struct RingHolder {
+  RingPtr ring;
+  ~RingHolder() {
+    if (ring) {
+      ring->Close();
+    }
+  }
+};
+thread_local RingHolder t_ring;
+
+const char* const kLevelNames[] = {"TRACE", "DEBUG", "INFO",
+                                   "WARN",  "ERROR", "FATAL"};
+
+void AppendFrame(std::string& out, uint8_t kind, const char* data,
+                 uint32_t len) {
+  out.push_back((char)kind);
+  out.append(reinterpret_cast<const char*>(&len), sizeof(len));
+  out.append(data, len);
+}
+
+// site frames for the sites from index from on
+void AppendSites(std::string& out, const std::vector<SiteEntry>& sites,
+                 size_t from) {
+  for (size_t i = from; i < sites.size(); ++i) {
+    const SiteEntry& entry = sites[i];
+    std::string payload;
+    uint32_t id = (uint32_t)i + 1;
+    int32_t level = entry.site.level;
+    int32_t line = entry.site.line;
+    payload.append(reinterpret_cast<const char*>(&id), sizeof(id));
+    payload.append(reinterpret_cast<const char*>(&level), sizeof(level));
+    payload.append(reinterpret_cast<const char*>(&line), sizeof(line));
+    payload.append(entry.site.file).push_back('\0');
+    payload.append(entry.site.fmt).push_back('\0');
+    payload.append(entry.types).push_back('\0');
+    AppendFrame(out, BinLog::kSiteFrame, payload.data(),
+                (uint32_t)payload.size());
+  }
+}
+
+void WriterMain() {
+  std::string out;
+  std::vector<RingPtr> rings;
+  // copy of the registry, grows when a record of a new site shows up
+  std::vector<SiteEntry> sites;
+  size_t written_sites = 0;
+  auto on_record = [&](const char* data, uint32_t len) {
+    uint32_t id;
+    memcpy(&id, data, sizeof(id));
+    if (id > sites.size()) {
+      std::lock_guard<std::mutex> guard(W.mutex);
+      sites.assign(W.sites.begin(), W.sites.end());
+    }
+    int64_t time;
+    memcpy(&time, data + sizeof(id), sizeof(time));
+    time = TicksToUs(time);
+    size_t header = sizeof(id) + sizeof(time);
+    if (W.text) {
+      const BinLog::Site& site = sites[id - 1].site;
+      BinLog::FormatRecord(site.level, site.file, site.line, site.fmt,
+                           sites[id - 1].types, time, data + header,
+                           len - header, out);
+      return;
+    }
+    if (written_sites < sites.size()) {
+      AppendSites(out, sites, written_sites);
+      written_sites = sites.size();
+    }
+    AppendFrame(out, BinLog::kRecordFrame, data, len);
+    memcpy(&out[out.size() - len + sizeof(id)], &time, sizeof(time));
+  };
+  while (true) {
+    bool stop;
+    {
+      std::unique_lock<std::mutex> guard(W.mutex);
+      W.wake.wait_for(guard, kWriterWait);
+      stop = W.stop;
+      Calibrate(BinLog::GetTicks(), NowUs());
+      W.rings.erase(std::remove_if(W.rings.begin(), W.rings.end(),
+                                   [](const RingPtr& ring) {
+                                     return ring->IsClosed() && ring->Empty();
+                                   }),
+                    W.rings.end());
+      rings = W.rings;
+    }
+    bool more = true;
+    while (more) {
+      more = false;
+      for (const auto& ring : rings) {
+        more |= ring->Drain(on_record);
+      }
+      if (!out.empty()) {
+        fwrite(out.data(), 1, out.size(), W.fp);
+        out.clear();
+      }
+    }
+    fflush(W.fp);
+    if (stop) {
+      return;
+    }
+  }
+}
+
+// "20220704 12:00:00:123456", like TimePoint::ToFormatString
+void AppendTime(int64_t time, std::string& out) {
+  static thread_local time_t last_second = -1;
+  static thread_local char prefix[64];
+  time_t second = (time_t)(time / 1000000);
+  if (second != last_second) {
+    struct tm tm;
+    localtime_r(&second, &tm);
+    snprintf(prefix, sizeof(prefix), "%d%02d%02d %02d:%02d:%02d:",
+             tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour,
+             tm.tm_min, tm.tm_sec);
+    last_second = second;
+  }
+  char micro[8];
+  snprintf(micro, sizeof(micro), "%06d", (int)(time % 1000000));
+  out.append(prefix).append(micro);
+}
+
+template <typename T>
+void AppendFormatted(std::string& out, const std::string& spec, T value) {
+  char buf[256];
+  int n = snprintf(buf, sizeof(buf), spec.c_str(), value);
+  if (n < 0) {
+    return;
+  }
+  if ((size_t)n < sizeof(buf)) {
+    out.append(buf, n);
+    return;
+  }
+  // long strings
+  size_t size = out.size();
+  out.resize(size + n + 1);
+  snprintf(&out[size], n + 1, spec.c_str(), value);
+  out.resize(size + n);
+}
+}  // namespace
+
+int BinLog::level_ = LOG_NONE;
+std::atomic<uint64_t> BinLog::dropped_{0};
+
+int BinLog::Start(FILE* fp, size_t ring_size, bool text) {
+  if (W.running || ring_size < 2 * (kMaxString + 64)) {
+    return -1;
+  }
+  W.fp = fp;
+  W.ring_size = ring_size;
+  W.text = text;
+  W.stop = false;
+  W.start_ticks = GetTicks();
+  W.start_us = NowUs();
+  std::this_thread::sleep_for(kCalibration);
+  Calibrate(GetTicks(), NowUs());
+  W.thread = std::thread(WriterMain);
+  W.running = true;
+  level_ = W.level;
+  return 0;
+}
+
+void BinLog::Stop() {
+  if (!W.running) {
+    return;
+  }
+  level_ = LOG_NONE;
+  W.running = false;
+  {
+    std::lock_guard<std::mutex> guard(W.mutex);
+    W.stop = true;
+  }
+  W.wake.notify_one();
+  W.thread.join();
+}
+
+void BinLog::SetLevel(int level) {
+  W.level = level;
+  if (W.running) {
+    level_ = level;
+  }
+}
+
+uint32_t BinLog::Register(const Site& site, std::atomic<uint32_t>& id,
+                          const char* types) {
+  std::lock_guard<std::mutex> guard(W.mutex);
+  // another thread may have got here first
+  uint32_t site_id = id.load(std::memory_order_relaxed);
+  if (site_id == 0) {
+    W.sites.push_back({site, types});
+    site_id = (uint32_t)W.sites.size();
+    id.store(site_id, std::memory_order_release);
+  }
+  return site_id;
+}
+
+LogRing* BinLog::GetRing() {
+  if (!W.running) {
+    return nullptr;
+  }
+  if (!t_ring.ring || t_ring.ring->Size() != W.ring_size) {
+    if (t_ring.ring) {
+      t_ring.ring->Close();
+    }
+    t_ring.ring = std::make_shared<LogRing>(W.ring_size);
+    std::lock_guard<std::mutex> guard(W.mutex);
+    W.rings.push_back(t_ring.ring);
+  }
+  return t_ring.ring.get();
+}
+
+void BinLog::FormatRecord(int level, const char* file, int line,
+                          const char* fmt, const char* types, int64_t time,
+                          const char* args, size_t len, std::string& out) {
+  AppendTime(time, out);
+  char header[64];
+  snprintf(header, sizeof(header), " %-5s ",
+           level >= LOG_TRACE && level <= LOG_FATAL ? kLevelNames[level] : "?");
+  out.append(header).append(file).append(":").append(std::to_string(line));
+  out.append(": ");
+
+  const char* end = args + len;
+  for (const char* p = fmt; *p; ++p) {
+    if (*p != '%') {
+      out.push_back(*p);
+      continue;
+    }
+    if (p[1] == '%') {
+      out.push_back('%');
+      ++p;
+      continue;
+    }
+    // flags, width and precision are kept, the length is ours
+    std::string spec = "%";
+    const char* q = p + 1;
+    while (*q && strchr("-+ #0123456789.", *q)) {
+      spec.push_back(*q++);
+    }
+    while (*q && strchr("hlzjtLq", *q)) {
+      ++q;
+    }
+    char conversion = *q;
+    if (conversion == '\0' || *types == '\0') {
+      // malformed or more conversions than arguments
+      out.append(p, *q ? q + 1 - p : q - p);
+      break;
+    }
+    p = q;
+    char type = *types++;
+    if (type == 's') {
+      uint32_t size = 0;
+      if (end - args >= (ptrdiff_t)sizeof(size)) {
+        memcpy(&size, args, sizeof(size));
+      }
+      args += sizeof(size);
+      size = std::min<uint32_t>(size, end > args ? end - args : 0);
+      std::string value(args, size);
+      args += size;
+      AppendFormatted(out, spec + "s", value.c_str());
+      continue;
+    }
+    uint64_t value = 0;
+    if (end - args >= (ptrdiff_t)sizeof(value)) {
+      memcpy(&value, args, sizeof(value));
+    }
+    args += sizeof(value);
+    if (type == 'f') {
+      double d;
+      memcpy(&d, &value, sizeof(d));
+      AppendFormatted(out, spec + (strchr("eEfFgGaA", conversion)
+                                       ? std::string(1, conversion)
+                                       : std::string("g")),
+                      d);
+    } else if (conversion == 'p' || type == 'p') {
+      AppendFormatted(out, spec + "p", (void*)(uintptr_t)value);
+    } else if (conversion == 'c') {
+      AppendFormatted(out, spec + "c", (int)value);
+    } else if (strchr("ouxX", conversion)) {
+      AppendFormatted(out, spec + "ll" + conversion,
+                      (unsigned long long)value);
+    } else if (type == 'u') {
+      AppendFormatted(out, spec + "llu", (unsigned long long)value);
+    } else {
+      AppendFormatted(out, spec + "lld", (long long)value);
+    }
+  }
+  out.push_back('\n');
+}
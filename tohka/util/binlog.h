@@ -0,0 +1,214 @@
+//
+// Created by li on 2022/7/6.
+//
+
+#ifndef TOHKA_TOHKA_UTIL_BINLOG_H
+#define TOHKA_TOHKA_UTIL_BINLOG_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "log.h"
+#include "logring.h"
+
+namespace tohka {
+// Binary logging for hot paths.
+//
+// A statement records the id of its call site and its arguments as they
+// are into a ring of the calling thread, the format string is only applied
+// later: by the writer thread in text mode, or offline by binlogdump on the
+// file the writer wrote in binary mode. Integers, floating point numbers,
+// pointers and strings (copied, at most kMaxString bytes) can be logged.
+// When the ring is full the record is dropped and counted.
+//
+//   BinLog::Start(fp, 1 << 20, false);
+//   binlog_trace("fd = %d events=0x%x", fd, events);
+//
+// The file is a sequence of frames [uint8 kind][uint32 length][payload]:
+//   kSiteFrame   [uint32 id][int32 level][int32 line][file\0][fmt\0][types\0]
+//   kRecordFrame [uint32 id][int64 microseconds][arguments]
+// A site frame comes before the first record of the site.
+//
+// Records are stamped with the cpu tick counter where there is one, reading
+// the clock would cost more than the rest of the record. The writer turns
+// ticks into microseconds since the epoch, Start takes 10ms to measure the
+// tick rate.
+class BinLog {
+ public:
+  struct Site {
+    int level;
+    const char* file;
+    int line;
+    const char* fmt;
+  };
+  enum Frame : uint8_t { kSiteFrame = 1, kRecordFrame = 2 };
+  static constexpr uint32_t kMaxString = 1024;
+
+  // start the writer thread, records are written to fp as they are, or
+  // formatted to lines if text is set
+  static int Start(FILE* fp, size_t ring_size, bool text);
+  // write what is queued and stop the writer thread
+  static void Stop();
+  // statements below level are skipped, LOG_TRACE once started
+  static void SetLevel(int level);
+  static bool Enabled(int level) { return level >= level_; }
+  static uint64_t GetDropped() { return dropped_; }
+
+  template <typename... Args>
+  static void Write(const Site& site, std::atomic<uint32_t>& id,
+                    const Args&... args) {
+    uint32_t site_id = id.load(std::memory_order_acquire);
+    if (site_id == 0) {
+      site_id = Register(site, id, kTypes<Args...>);
+    }
+    LogRing* ring = GetRing();
+    if (ring == nullptr) {
+      return;
+    }
+    size_t len = sizeof(uint32_t) + sizeof(int64_t) + (0 + ... + Size(args));
+    char* p = ring->Reserve((uint32_t)len);
+    if (p == nullptr) {
+      dropped_.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    int64_t now = GetTicks();
+    memcpy(p, &site_id, sizeof(site_id));
+    memcpy(p + sizeof(site_id), &now, sizeof(now));
+    p += sizeof(site_id) + sizeof(now);
+    ((p = Encode(p, args)), ...);
+    ring->Commit();
+  }
+
+  // cpu ticks, or microseconds where there is no tick counter
+  static int64_t GetTicks() {
+#if defined(__x86_64__) || defined(__i386__)
+    return (int64_t)__rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::system_clock::now().time_since_epoch())
+        .count();
+#endif
+  }
+
+  // Format the arguments of a record of a site with the given types, see
+  // kTypes. Used by the writer in text mode and by binlogdump.
+  static void FormatRecord(int level, const char* file, int line,
+                           const char* fmt, const char* types, int64_t time,
+                           const char* args, size_t len, std::string& out);
+
+ private:
+  // one character per argument: 'i' signed, 'u' unsigned, 'f' double,
+  // 'p' pointer, 's' string
+  template <typename T>
+  static constexpr char TypeOf() {
+    using U = std::decay_t<T>;
+    if constexpr (std::is_same_v<U, char*> || std::is_same_v<U, const char*> ||
+                  std::is_same_v<U, std::string>) {
+      return 's';
+    } else if constexpr (std::is_floating_point_v<U>) {
+      return 'f';
+    } else if constexpr (std::is_pointer_v<U>) {
+      return 'p';
+    } else if constexpr (std::is_enum_v<U>) {
+      return std::is_signed_v<std::underlying_type_t<U>> ? 'i' : 'u';
+    } else {
+      static_assert(std::is_integral_v<U>, "type can not be binary logged");
+      return std::is_signed_v<U> ? 'i' : 'u';
+    }
+  }
+  template <typename... Args>
+  static constexpr char kTypes[] = {TypeOf<Args>()..., '\0'};
+
+  static uint32_t StringSize(const char* s) {
+    size_t len = s ? strlen(s) : 0;
+    return len < kMaxString ? (uint32_t)len : kMaxString;
+  }
+  template <typename T>
+  static size_t Size(const T& arg) {
+    constexpr char type = TypeOf<T>();
+    if constexpr (type != 's') {
+      return sizeof(uint64_t);
+    } else if constexpr (std::is_same_v<T, std::string>) {
+      return sizeof(uint32_t) + std::min<size_t>(arg.size(), kMaxString);
+    } else {
+      return sizeof(uint32_t) + StringSize(arg);
+    }
+  }
+  // every scalar takes 8 bytes, strings [uint32 length][bytes]
+  template <typename T>
+  static char* Encode(char* p, const T& arg) {
+    constexpr char type = TypeOf<T>();
+    if constexpr (type == 's') {
+      const char* s;
+      uint32_t len;
+      if constexpr (std::is_same_v<T, std::string>) {
+        s = arg.data();
+        len = (uint32_t)std::min<size_t>(arg.size(), kMaxString);
+      } else {
+        s = arg;
+        len = StringSize(arg);
+      }
+      memcpy(p, &len, sizeof(len));
+      memcpy(p + sizeof(len), s, len);
+      return p + sizeof(len) + len;
+    } else {
+      uint64_t value;
+      if constexpr (type == 'f') {
+        double d = arg;
+        memcpy(&value, &d, sizeof(value));
+      } else if constexpr (type == 'p') {
+        value = (uint64_t)(uintptr_t)arg;
+      } else if constexpr (type == 'i') {
+        value = (uint64_t)(int64_t)arg;
+      } else {
+        value = (uint64_t)arg;
+      }
+      memcpy(p, &value, sizeof(value));
+      return p + sizeof(value);
+    }
+  }
+
+  static uint32_t Register(const Site& site, std::atomic<uint32_t>& id,
+                           const char* types);
+  // ring of this thread, nullptr while stopped
+  static LogRing* GetRing();
+
+  static int level_;
+  static std::atomic<uint64_t> dropped_;
+};
+}  // namespace tohka
+
+// Like log_trace, but binary. Statements below LOG_LEVEL_MIN are compiled
+// out too.
+#define binlog_at(level, fmt, ...)                                         \
+  do {                                                                     \
+    if ((level) >= LOG_LEVEL_MIN && tohka::BinLog::Enabled(level)) {       \
+      static constexpr tohka::BinLog::Site binlog_site_{(level), __FILE__, \
+                                                        __LINE__, (fmt)};  \
+      static std::atomic<uint32_t> binlog_id_{0};                          \
+      tohka::BinLog::Write(binlog_site_, binlog_id_, ##__VA_ARGS__);       \
+    }                                                                      \
+  } while (0)
+
+#define binlog_trace(...) binlog_at(LOG_TRACE, __VA_ARGS__)
+#define binlog_debug(...) binlog_at(LOG_DEBUG, __VA_ARGS__)
+#define binlog_info(...) binlog_at(LOG_INFO, __VA_ARGS__)
+
+// a trace of the text log too, for statements that were log_trace before:
+// log_set_level(LOG_TRACE) keeps printing them without a BinLog
+#define binlog_log_trace(...)  \
+  do {                         \
+    log_trace(__VA_ARGS__);    \
+    binlog_trace(__VA_ARGS__); \
+  } while (0)
+
+#endif  // TOHKA_TOHKA_UTIL_BINLOG_H
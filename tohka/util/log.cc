@@ -22,6 +22,20 @@
 
 #include "log.h"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "logfile.h"
+#include "logring.h"
+
 #define MAX_CALLBACKS 32
 
 typedef struct {
@@ -35,9 +49,50 @@ static struct {
   log_LockFn lock;
   int level;
   bool quiet;
+  bool utc;
   Callback callbacks[MAX_CALLBACKS];
 } L;
 
+/*
+ * Timestamps are cached per thread. The date and time of day are only
+ * formatted again when the second changes, each line just writes its
+ * microseconds after them.
+ */
+typedef struct {
+  time_t second;
+  bool utc;
+  struct tm tm;
+  // "%Y%m%d %H:%M:%S:" then 6 digits of microseconds
+  char text[32];
+  int prefix_len;
+} TimeCache;
+
+static thread_local TimeCache t_time = {.second = -1};
+
+static void update_time(void) {
+  auto now = std::chrono::system_clock::now().time_since_epoch();
+  int64_t us = std::chrono::duration_cast<std::chrono::microseconds>(now)
+                   .count();
+  time_t second = (time_t)(us / 1000000);
+  bool utc = L.utc;
+  if (second != t_time.second || utc != t_time.utc) {
+    t_time.second = second;
+    t_time.utc = utc;
+    utc ? gmtime_r(&second, &t_time.tm) : localtime_r(&second, &t_time.tm);
+    t_time.prefix_len = snprintf(
+        t_time.text, sizeof(t_time.text) - 6, "%d%02d%02d %02d:%02d:%02d:",
+        t_time.tm.tm_year + 1900, t_time.tm.tm_mon + 1, t_time.tm.tm_mday,
+        t_time.tm.tm_hour, t_time.tm.tm_min, t_time.tm.tm_sec);
+  }
+  int micro = (int)(us % 1000000);
+  char* p = t_time.text + t_time.prefix_len;
+  for (int i = 5; i >= 0; i--) {
+    p[i] = (char)('0' + micro % 10);
+    micro /= 10;
+  }
+  p[6] = '\0';
+}
+
 static const char* level_strings[] = {"TRACE", "DEBUG", "INFO",
                                       "WARN",  "ERROR", "FATAL"};
 
@@ -47,15 +102,13 @@ static const char* level_colors[] = {"\x1b[94m", "\x1b[36m", "\x1b[32m",
 #endif
 
 static void stdout_callback(log_Event* ev) {
-  char buf[16];
-  buf[strftime(buf, sizeof(buf), "%H:%M:%S", ev->time)] = '\0';
 #ifdef LOG_USE_COLOR
   ::fprintf(static_cast<FILE*>(ev->udata),
-            "%s %s%-5s\x1b[0m \x1b[90m%s:%d:\x1b[0m ", buf,
+            "%s %s%-5s\x1b[0m \x1b[90m%s:%d:\x1b[0m ", ev->timestamp,
             level_colors[ev->level], level_strings[ev->level], ev->file,
             ev->line);
 #else
-  fprintf(static_cast<FILE*>(ev->udata), "%s %-5s %s:%d: ", buf,
+  fprintf(static_cast<FILE*>(ev->udata), "%s %-5s %s:%d: ", ev->timestamp,
           level_strings[ev->level], ev->file, ev->line);
 #endif
   ::vfprintf(static_cast<FILE*>(ev->udata), ev->fmt, ev->ap);
@@ -64,9 +117,7 @@ static void stdout_callback(log_Event* ev) {
 }
 
 static void file_callback(log_Event* ev) {
-  char buf[64];
-  buf[strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", ev->time)] = '\0';
-  ::fprintf(static_cast<FILE*>(ev->udata), "%s %-5s %s:%d: ", buf,
+  ::fprintf(static_cast<FILE*>(ev->udata), "%s %-5s %s:%d: ", ev->timestamp,
             level_strings[ev->level], ev->file, ev->line);
   ::vfprintf(static_cast<FILE*>(ev->udata), ev->fmt, ev->ap);
   ::fprintf(static_cast<FILE*>(ev->udata), "\n");
@@ -92,14 +143,35 @@ void log_set_lock(log_LockFn fn, void* udata) {
   L.udata = udata;
 }
 
-void log_set_level(int level) { L.level = level; }
+int log_active_level = LOG_TRACE;
+
+static void update_active_level(void) {
+  int level = L.quiet ? LOG_NONE : L.level;
+  for (int i = 0; i < MAX_CALLBACKS && L.callbacks[i].fn; i++) {
+    if (L.callbacks[i].level < level) {
+      level = L.callbacks[i].level;
+    }
+  }
+  log_active_level = level;
+}
+
+void log_set_level(int level) {
+  L.level = level;
+  update_active_level();
+}
+
+void log_set_quiet(bool enable) {
+  L.quiet = enable;
+  update_active_level();
+}
 
-void log_set_quiet(bool enable) { L.quiet = enable; }
+void log_set_utc(bool enable) { L.utc = enable; }
 
 int log_add_callback(log_LogFn fn, void* udata, int level) {
   for (int i = 0; i < MAX_CALLBACKS; i++) {
     if (!L.callbacks[i].fn) {
       L.callbacks[i] = (Callback){fn, udata, level};
+      update_active_level();
       return 0;
     }
   }
@@ -110,15 +182,198 @@ int log_add_fp(FILE* fp, int level) {
   return log_add_callback(file_callback, fp, level);
 }
 
+/*
+ * Asynchronous mode.
+ *
+ * Each logging thread formats its lines into a LogRing of its own. The
+ * writer thread drains all rings into one buffer and writes it with one
+ * fwrite.
+ */
+namespace {
+constexpr size_t kMaxLine = 4096;
+constexpr auto kWriterWait = std::chrono::milliseconds(10);
+
+using RingPtr = std::shared_ptr<tohka::LogRing>;
+
+struct Async {
+  std::atomic<bool> running{false};
+  // one of them
+  FILE* fp = nullptr;
+  std::unique_ptr<tohka::LogFile> file;
+  size_t ring_size = 0;
+  int full_policy = LOG_FULL_BLOCK;
+  std::atomic<unsigned long long> dropped{0};
+  std::thread writer;
+  std::mutex mutex;
+  std::condition_variable wake;
+  // guarded by mutex
+  std::vector<RingPtr> rings;
+  bool stop = false;
+} A;
+
+struct RingHolder {
+  RingPtr ring;
+  ~RingHolder() {
+    if (ring) {
+      ring->Close();
+    }
+  }
+};
+thread_local RingHolder t_ring;
+
+tohka::LogRing* get_ring() {
+  if (!t_ring.ring || t_ring.ring->Size() != A.ring_size) {
+    if (t_ring.ring) {
+      t_ring.ring->Close();
+    }
+    t_ring.ring = std::make_shared<tohka::LogRing>(A.ring_size);
+    std::lock_guard<std::mutex> guard(A.mutex);
+    A.rings.push_back(t_ring.ring);
+  }
+  return t_ring.ring.get();
+}
+
+void writer_main() {
+  std::string out;
+  std::vector<RingPtr> rings;
+  while (true) {
+    bool stop;
+    {
+      std::unique_lock<std::mutex> guard(A.mutex);
+      A.wake.wait_for(guard, kWriterWait);
+      stop = A.stop;
+      // forget rings of exited threads once drained
+      A.rings.erase(std::remove_if(A.rings.begin(), A.rings.end(),
+                                   [](const RingPtr& ring) {
+                                     return ring->IsClosed() && ring->Empty();
+                                   }),
+                    A.rings.end());
+      rings = A.rings;
+    }
+    // keep draining while there is something, blocked producers wait
+    bool more = true;
+    while (more) {
+      more = false;
+      for (const auto& ring : rings) {
+        more |= ring->Drain([&out](const char* data, uint32_t len) {
+          out.append(data, len);
+        });
+      }
+      if (!out.empty()) {
+        if (A.file) {
+          A.file->Append(out.data(), out.size());
+        } else {
+          fwrite(out.data(), 1, out.size(), A.fp);
+        }
+        out.clear();
+      }
+    }
+    if (A.file) {
+      A.file->Flush();
+    } else {
+      fflush(A.fp);
+    }
+    if (stop) {
+      return;
+    }
+  }
+}
+
+void async_log(log_Event* ev) {
+  char line[kMaxLine];
+  int n = snprintf(line, sizeof(line), "%s %-5s %s:%d: ", ev->timestamp,
+                   level_strings[ev->level], ev->file, ev->line);
+  if (n < 0) {
+    return;
+  }
+  size_t len = std::min((size_t)n, sizeof(line) - 1);
+  n = vsnprintf(line + len, sizeof(line) - len, ev->fmt, ev->ap);
+  if (n > 0) {
+    // longer lines are cut
+    len = std::min(len + n, sizeof(line) - 2);
+  }
+  line[len++] = '\n';
+
+  tohka::LogRing* ring = get_ring();
+  while (!ring->Push(line, (uint32_t)len)) {
+    if (A.full_policy == LOG_FULL_DROP) {
+      A.dropped.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    A.wake.notify_one();
+    std::this_thread::yield();
+  }
+  // the writer wakes up on its own often enough unless the ring fills fast
+  size_t used = ring->GetUsed();
+  if (used > ring->Size() / 2 &&
+      used - len - sizeof(uint32_t) <= ring->Size() / 2) {
+    A.wake.notify_one();
+  }
+}
+}  // namespace
+
+static int start_writer(size_t ring_size, int full_policy) {
+  A.ring_size = ring_size;
+  A.full_policy = full_policy;
+  A.stop = false;
+  A.writer = std::thread(writer_main);
+  A.running = true;
+  return 0;
+}
+
+int log_start_async(FILE* fp, size_t ring_size, int full_policy) {
+  if (A.running || ring_size < 2 * kMaxLine) {
+    return -1;
+  }
+  A.fp = fp;
+  return start_writer(ring_size, full_policy);
+}
+
+int log_start_async_file(const char* path, size_t max_size,
+                         int rotate_interval, int max_files, size_t ring_size,
+                         int full_policy) {
+  if (A.running || ring_size < 2 * kMaxLine) {
+    return -1;
+  }
+  A.file = std::make_unique<tohka::LogFile>(path, max_size, rotate_interval,
+                                            max_files);
+  if (!A.file->IsOpen()) {
+    A.file.reset();
+    return -1;
+  }
+  return start_writer(ring_size, full_policy);
+}
+
+void log_stop_async(void) {
+  if (!A.running) {
+    return;
+  }
+  A.running = false;
+  {
+    std::lock_guard<std::mutex> guard(A.mutex);
+    A.stop = true;
+  }
+  A.wake.notify_one();
+  A.writer.join();
+  A.file.reset();
+  A.fp = nullptr;
+}
+
+unsigned long long log_get_dropped(void) { return A.dropped; }
+
 static void init_event(log_Event* ev, void* udata) {
   if (!ev->time) {
-    time_t t = time(NULL);
-    ev->time = localtime(&t);
+    update_time();
+    ev->time = &t_time.tm;
+    ev->timestamp = t_time.text;
   }
   ev->udata = udata;
 }
 
 void log_log(int level, const char* file, int line, const char* fmt, ...) {
+  if (!log_enabled(level)) {
+    return;
+  }
   log_Event ev = {
       .fmt = fmt,
       .file = file,
@@ -126,9 +381,21 @@ void log_log(int level, const char* file, int line, const char* fmt, ...) {
       .level = level,
   };
 
+  if (A.running) {
+    if (!L.quiet && level >= L.level) {
+      init_event(&ev, NULL);
+      va_start(ev.ap, fmt);
+      async_log(&ev);
+      va_end(ev.ap);
+    }
+    if (!L.callbacks[0].fn) {
+      return;
+    }
+  }
+
   lock();
 
-  if (!L.quiet && level >= L.level) {
+  if (!A.running && !L.quiet && level >= L.level) {
     init_event(&ev, stderr);
     va_start(ev.ap, fmt);
     stdout_callback(&ev);
@@ -23,6 +23,8 @@ typedef struct {
   const char* fmt;
   const char* file;
   struct tm* time;
+  // "20220704 12:00:00:123456", like TimePoint::ToFormatString
+  const char* timestamp;
   void* udata;
   int line;
   int level;
@@ -41,20 +43,59 @@ enum {
   LOG_NONE
 };
 
-#define log_trace(...) log_log(LOG_TRACE, __FILE__, __LINE__, __VA_ARGS__)
-#define log_debug(...) log_log(LOG_DEBUG, __FILE__, __LINE__, __VA_ARGS__)
-#define log_info(...) log_log(LOG_INFO, __FILE__, __LINE__, __VA_ARGS__)
-#define log_warn(...) log_log(LOG_WARN, __FILE__, __LINE__, __VA_ARGS__)
-#define log_error(...) log_log(LOG_ERROR, __FILE__, __LINE__, __VA_ARGS__)
-#define log_fatal(...) log_log(LOG_FATAL, __FILE__, __LINE__, __VA_ARGS__)
+// Statements below LOG_LEVEL_MIN are compiled out, set it with the
+// TOHKA_LOG_LEVEL cmake option. It is a number because the preprocessor can
+// not compare the enum: 0 is LOG_TRACE ... 6 is LOG_NONE.
+#ifndef LOG_LEVEL_MIN
+#define LOG_LEVEL_MIN 0
+#endif
+
+// Lowest level any output takes, kept up to date by the setters below.
+// A statement below it costs one compare and evaluates no argument.
+extern int log_active_level;
+static inline bool log_enabled(int level) { return level >= log_active_level; }
+
+#define log_at(level, ...)                                       \
+  do {                                                           \
+    if ((level) >= LOG_LEVEL_MIN && log_enabled(level)) {        \
+      log_log((level), __FILE__, __LINE__, __VA_ARGS__);         \
+    }                                                            \
+  } while (0)
+
+#define log_trace(...) log_at(LOG_TRACE, __VA_ARGS__)
+#define log_debug(...) log_at(LOG_DEBUG, __VA_ARGS__)
+#define log_info(...) log_at(LOG_INFO, __VA_ARGS__)
+#define log_warn(...) log_at(LOG_WARN, __VA_ARGS__)
+#define log_error(...) log_at(LOG_ERROR, __VA_ARGS__)
+#define log_fatal(...) log_at(LOG_FATAL, __VA_ARGS__)
 
 const char* log_level_string(int level);
 void log_set_lock(log_LockFn fn, void* udata);
 void log_set_level(int level);
 void log_set_quiet(bool enable);
+// timestamps in UTC instead of local time, which also skips the timezone
+void log_set_utc(bool enable);
 int log_add_callback(log_LogFn fn, void* udata, int level);
 int log_add_fp(FILE* fp, int level);
 
+// Asynchronous mode: instead of stderr, lines at or above the level are
+// formatted by the calling thread into a ring of its own (ring_size bytes)
+// and written to fp in batches by a background thread. Callbacks stay
+// synchronous. When a ring is full the caller waits for the writer
+// (LOG_FULL_BLOCK) or the line is dropped and counted (LOG_FULL_DROP).
+enum { LOG_FULL_BLOCK, LOG_FULL_DROP };
+int log_start_async(FILE* fp, size_t ring_size, int full_policy);
+// Asynchronous mode writing to a file the writer thread rotates, see
+// tohka::LogFile. Rotation happens before the file grows past max_size
+// bytes or every rotate_interval seconds (0 for neither), max_files rotated
+// files are kept as path.1 ... path.max_files.
+int log_start_async_file(const char* path, size_t max_size,
+                         int rotate_interval, int max_files, size_t ring_size,
+                         int full_policy);
+// write what is queued and stop the writer thread
+void log_stop_async(void);
+unsigned long long log_get_dropped(void);
+
 void log_log(int level, const char* file, int line, const char* fmt, ...);
 
 #endif
@@ -0,0 +1,148 @@
+//
+// Created by li on 2022/7/8.
+//
+
+#include "logfile.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+using namespace tohka;
+
+LogFile::LogFile(const std::string& path, size_t max_size,
+                 int rotate_interval, int max_files)
+    : path_(path),
+      max_size_(max_size),
+      rotate_interval_(rotate_interval),
+      max_files_(max_files),
+      fd_(-1),
+      file_size_(0),
+      next_rotate_(0),
+      buffer_(kBufferSize),
+      buffered_(0),
+      rotate_failed_(false) {
+  Open();
+}
+LogFile::~LogFile() {
+  Flush();
+  if (fd_ >= 0) {
+    ::close(fd_);
+  }
+}
+
+void LogFile::Append(const char* data, size_t len) {
+  if (rotate_interval_ > 0 && time(nullptr) >= next_rotate_) {
+    Rotate();
+  }
+  // the writer appends many lines at once, split them between files
+  while (max_size_ > 0 && file_size_ + buffered_ + len > max_size_) {
+    size_t room = max_size_ - std::min(max_size_, file_size_ + buffered_);
+    const char* end = static_cast<const char*>(memrchr(data, '\n', room));
+    if (end != nullptr) {
+      size_t part = end + 1 - data;
+      Buffer(data, part);
+      data += part;
+      len -= part;
+    } else if (file_size_ + buffered_ == 0) {
+      // one line longer than max_size
+      end = static_cast<const char*>(memchr(data, '\n', len));
+      size_t part = end ? end + 1 - data : len;
+      Buffer(data, part);
+      data += part;
+      len -= part;
+    }
+    if (!Rotate()) {
+      // rotating again would not make room, append past max_size
+      break;
+    }
+  }
+  Buffer(data, len);
+}
+void LogFile::Buffer(const char* data, size_t len) {
+  if (buffered_ + len > buffer_.size()) {
+    Flush();
+  }
+  if (len > buffer_.size()) {
+    WriteAll(data, len);
+    return;
+  }
+  memcpy(&buffer_[buffered_], data, len);
+  buffered_ += len;
+}
+void LogFile::Flush() {
+  if (buffered_ > 0) {
+    WriteAll(buffer_.data(), buffered_);
+    buffered_ = 0;
+  }
+}
+
+void LogFile::Open() {
+  fd_ = ::open(path_.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+  if (fd_ < 0) {
+    fprintf(stderr, "LogFile::Open %s failed: %s\n", path_.c_str(),
+            strerror(errno));
+    file_size_ = 0;
+  } else {
+    struct stat st {};
+    file_size_ = fstat(fd_, &st) == 0 ? (size_t)st.st_size : 0;
+  }
+  next_rotate_ = GetNextRotate(time(nullptr));
+}
+bool LogFile::Rotate() {
+  Flush();
+  if (fd_ >= 0) {
+    ::close(fd_);
+    fd_ = -1;
+  }
+  bool moved;
+  if (max_files_ <= 0) {
+    moved = ::unlink(path_.c_str()) == 0 || errno == ENOENT;
+  } else {
+    std::string oldest = path_ + "." + std::to_string(max_files_);
+    ::unlink(oldest.c_str());
+    for (int i = max_files_ - 1; i >= 1; --i) {
+      std::string from = path_ + "." + std::to_string(i);
+      std::string to = path_ + "." + std::to_string(i + 1);
+      ::rename(from.c_str(), to.c_str());
+    }
+    moved = ::rename(path_.c_str(), (path_ + ".1").c_str()) == 0 ||
+            errno == ENOENT;
+  }
+  if (!moved && !rotate_failed_) {
+    fprintf(stderr, "LogFile::Rotate %s failed: %s\n", path_.c_str(),
+            strerror(errno));
+  }
+  rotate_failed_ = !moved;
+  Open();
+  return moved;
+}
+void LogFile::WriteAll(const char* data, size_t len) {
+  if (fd_ < 0) {
+    return;
+  }
+  while (len > 0) {
+    ssize_t n = ::write(fd_, data, len);
+    if (n < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      // disk full and the like, the lines are lost
+      return;
+    }
+    data += n;
+    len -= n;
+    file_size_ += n;
+  }
+}
+time_t LogFile::GetNextRotate(time_t now) const {
+  if (rotate_interval_ <= 0) {
+    return 0;
+  }
+  // on interval boundaries, daily files start at midnight utc
+  return (now / rotate_interval_ + 1) * rotate_interval_;
+}
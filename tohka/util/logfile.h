@@ -0,0 +1,60 @@
+//
+// Created by li on 2022/7/8.
+//
+
+#ifndef TOHKA_TOHKA_UTIL_LOGFILE_H
+#define TOHKA_TOHKA_UTIL_LOGFILE_H
+
+#include <cstddef>
+#include <ctime>
+#include <string>
+#include <vector>
+
+namespace tohka {
+// Log file rotated by size and time, used by the log writer thread only.
+//
+// Appends go to a buffer allocated once and reach the file in large
+// writes. The file is rotated before it would grow past max_size bytes,
+// or when a rotate_interval seconds boundary is crossed: path is renamed
+// to path.1, path.1 to path.2 and so on, and the oldest one beyond
+// max_files is removed. The file is never truncated in place, tools can
+// keep reading a rotated file.
+class LogFile {
+ public:
+  // 0 turns off max_size or rotate_interval
+  LogFile(const std::string& path, size_t max_size, int rotate_interval,
+          int max_files);
+  ~LogFile();
+  LogFile(const LogFile&) = delete;
+  LogFile& operator=(const LogFile&) = delete;
+
+  bool IsOpen() const { return fd_ >= 0; }
+  void Append(const char* data, size_t len);
+  void Flush();
+
+  static constexpr size_t kBufferSize = 1024 * 1024;
+
+ private:
+  void Buffer(const char* data, size_t len);
+  void Open();
+  // false if path could not be moved away, the file did not shrink then
+  bool Rotate();
+  void WriteAll(const char* data, size_t len);
+  time_t GetNextRotate(time_t now) const;
+
+  std::string path_;
+  size_t max_size_;
+  int rotate_interval_;
+  int max_files_;
+  int fd_;
+  // bytes in the file, buffered ones not counted
+  size_t file_size_;
+  time_t next_rotate_;
+  std::vector<char> buffer_;
+  size_t buffered_;
+  // reported once until a rotation succeeds again
+  bool rotate_failed_;
+};
+}  // namespace tohka
+
+#endif  // TOHKA_TOHKA_UTIL_LOGFILE_H
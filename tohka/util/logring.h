@@ -0,0 +1,128 @@
+//
+// Created by li on 2022/7/6.
+//
+
+#ifndef TOHKA_TOHKA_UTIL_LOGRING_H
+#define TOHKA_TOHKA_UTIL_LOGRING_H
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace tohka {
+// Single producer single consumer ring of [uint32 length][bytes] records,
+// one per logging thread, drained by the log writer thread.
+//
+// A record never wraps, a length of kWrapMark (or less than a length left
+// before the end) tells the consumer to go on at the start.
+class LogRing {
+ public:
+  explicit LogRing(size_t size)
+      : data_(size),
+        head_(0),
+        next_head_(0),
+        cached_tail_(0),
+        tail_(0),
+        closed_(false) {}
+  LogRing(const LogRing&) = delete;
+  LogRing& operator=(const LogRing&) = delete;
+
+  size_t Size() const { return data_.size(); }
+  size_t GetUsed() const {
+    return head_.load(std::memory_order_relaxed) -
+           tail_.load(std::memory_order_relaxed);
+  }
+  bool Empty() const {
+    return head_.load(std::memory_order_acquire) ==
+           tail_.load(std::memory_order_acquire);
+  }
+
+  // producer: room for a record of len bytes, nullptr if the ring is full.
+  // The consumer sees the record after Commit.
+  char* Reserve(uint32_t len) {
+    size_t size = data_.size();
+    size_t need = sizeof(uint32_t) + len;
+    size_t head = head_.load(std::memory_order_relaxed);
+    size_t offset = head % size;
+    size_t to_end = size - offset;
+    // the record does not fit before the end, skip the rest of the ring
+    size_t skip = to_end < need ? to_end : 0;
+    // the consumer's position is only read again when the ring looks full,
+    // it lives on another cache line
+    if (size - (head - cached_tail_) < skip + need) {
+      cached_tail_ = tail_.load(std::memory_order_acquire);
+      if (size - (head - cached_tail_) < skip + need) {
+        return nullptr;
+      }
+    }
+    if (skip) {
+      if (to_end >= sizeof(uint32_t)) {
+        memcpy(&data_[offset], &kWrapMark, sizeof(uint32_t));
+      }
+      offset = 0;
+    }
+    memcpy(&data_[offset], &len, sizeof(uint32_t));
+    next_head_ = head + skip + need;
+    return &data_[offset + sizeof(uint32_t)];
+  }
+  void Commit() { head_.store(next_head_, std::memory_order_release); }
+  bool Push(const char* data, uint32_t len) {
+    char* p = Reserve(len);
+    if (p == nullptr) {
+      return false;
+    }
+    memcpy(p, data, len);
+    Commit();
+    return true;
+  }
+
+  // consumer: call on_record(data, len) for each record, returns whether
+  // there was any
+  template <typename OnRecord>
+  bool Drain(OnRecord&& on_record) {
+    size_t size = data_.size();
+    size_t head = head_.load(std::memory_order_acquire);
+    size_t tail = tail_.load(std::memory_order_relaxed);
+    if (head == tail) {
+      return false;
+    }
+    while (tail != head) {
+      size_t offset = tail % size;
+      size_t to_end = size - offset;
+      uint32_t len = kWrapMark;
+      if (to_end >= sizeof(uint32_t)) {
+        memcpy(&len, &data_[offset], sizeof(uint32_t));
+      }
+      if (len == kWrapMark) {
+        tail += to_end;
+        continue;
+      }
+      on_record(&data_[offset + sizeof(uint32_t)], len);
+      tail += sizeof(uint32_t) + len;
+    }
+    tail_.store(tail, std::memory_order_release);
+    return true;
+  }
+
+  // the producing thread exited, the ring goes away once drained
+  void Close() { closed_ = true; }
+  bool IsClosed() const { return closed_; }
+
+ private:
+  static constexpr uint32_t kWrapMark = 0xffffffff;
+  static constexpr size_t kCacheLine = 64;
+  std::vector<char> data_;
+  // bytes ever written, by the producer
+  alignas(kCacheLine) std::atomic<size_t> head_;
+  // head after the reserved record
+  size_t next_head_;
+  // tail_ as the producer last saw it
+  size_t cached_tail_;
+  // bytes ever read, by the consumer
+  alignas(kCacheLine) std::atomic<size_t> tail_;
+  std::atomic<bool> closed_;
+};
+}  // namespace tohka
+
+#endif  // TOHKA_TOHKA_UTIL_LOGRING_H
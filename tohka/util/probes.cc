@@ -0,0 +1,15 @@
+//
+// Created by li on 2022/7/13.
+//
+
+#include "probes.h"
+
+#if defined(TOHKA_HAVE_SDT)
+// the tracer finds them by name in the .probes section
+#define TOHKA_PROBE_DEFINE_SEMAPHORE(name)                  \
+  volatile unsigned short tohka_##name##_semaphore         \
+      __attribute__((unused, section(".probes"))) = 0;
+extern "C" {
+TOHKA_PROBES(TOHKA_PROBE_DEFINE_SEMAPHORE)
+}
+#endif
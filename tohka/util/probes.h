@@ -0,0 +1,78 @@
+//
+// Created by li on 2022/7/13.
+//
+
+#ifndef TOHKA_TOHKA_UTIL_PROBES_H
+#define TOHKA_TOHKA_UTIL_PROBES_H
+
+// USDT probes of provider "tohka", for bpftrace and friends:
+//
+//   accept(listen_fd, conn_fd)
+//   read(fd, bytes, on_message_us)      bytes <= 0 on close or error
+//   write(fd, bytes, left)              from HandleWrite
+//   send(fd, len, written)              written at once, the rest is queued
+//   close(fd, unsent)
+//   loop_start(poll_timeout_ms)
+//   loop_end(ready_events, timers_fired, iteration_us)
+//   timer_fire(timer_id, lag_us, callback_us)
+//
+// Durations are measured only while a tracer is attached to the probe,
+// they are 0 otherwise. Built with sys/sdt.h when cmake finds it (option
+// TOHKA_USDT), the probes compile to nothing without it.
+
+#include "tohka/timepoint.h"
+
+#if defined(TOHKA_HAVE_SDT)
+// a probe's semaphore is non zero while a tracer is attached to it
+#define _SDT_HAS_SEMAPHORES 1
+#include <sys/sdt.h>
+
+#define TOHKA_PROBES(X) \
+  X(accept)             \
+  X(read)               \
+  X(write)              \
+  X(send)               \
+  X(close)              \
+  X(loop_start)         \
+  X(loop_end)           \
+  X(timer_fire)
+
+#define TOHKA_PROBE_DECLARE_SEMAPHORE(name) \
+  extern volatile unsigned short tohka_##name##_semaphore;
+extern "C" {
+TOHKA_PROBES(TOHKA_PROBE_DECLARE_SEMAPHORE)
+}
+
+#define TOHKA_PROBE_ENABLED(name) \
+  __builtin_expect(tohka_##name##_semaphore != 0, 0)
+#define TOHKA_PROBE1(name, a) DTRACE_PROBE1(tohka, name, a)
+#define TOHKA_PROBE2(name, a, b) DTRACE_PROBE2(tohka, name, a, b)
+#define TOHKA_PROBE3(name, a, b, c) DTRACE_PROBE3(tohka, name, a, b, c)
+#else
+// the arguments are not evaluated, but count as used
+#define TOHKA_PROBE_ENABLED(name) false
+#define TOHKA_PROBE1(name, a) \
+  do {                        \
+    (void)sizeof(a);          \
+  } while (0)
+#define TOHKA_PROBE2(name, a, b) \
+  do {                           \
+    (void)sizeof(a);             \
+    (void)sizeof(b);             \
+  } while (0)
+#define TOHKA_PROBE3(name, a, b, c) \
+  do {                              \
+    (void)sizeof(a);                \
+    (void)sizeof(b);                \
+    (void)sizeof(c);                \
+  } while (0)
+#endif
+
+// microseconds now if the probe is traced, otherwise 0
+#define TOHKA_PROBE_START(name) \
+  (TOHKA_PROBE_ENABLED(name) ? tohka::TimePoint::now().GetMicroSeconds() : 0)
+// microseconds since a TOHKA_PROBE_START, 0 if that was not traced
+#define TOHKA_PROBE_ELAPSED(start) \
+  ((start) != 0 ? tohka::TimePoint::now().GetMicroSeconds() - (start) : 0)
+
+#endif  // TOHKA_TOHKA_UTIL_PROBES_H
@@ -0,0 +1,149 @@
+//
+// Created by li on 2022/7/14.
+//
+
+#include "watchdog.h"
+
+#include <csignal>
+#include <cxxabi.h>
+#if __has_include(<execinfo.h>)
+#include <execinfo.h>
+#define TOHKA_HAVE_BACKTRACE 1
+#endif
+#include <unistd.h>
+
+#include "metrics.h"
+#include "util/log.h"
+using namespace tohka;
+
+namespace {
+// not used by the library, sockets only raise it with F_SETOWN
+constexpr int kDumpSignal = SIGURG;
+
+void DumpStack(int) {
+#if defined(TOHKA_HAVE_BACKTRACE)
+  void* frames[64];
+  int size = backtrace(frames, 64);
+  const char header[] = "[Watchdog]->stack of the stuck loop thread:\n";
+  ssize_t n = ::write(STDERR_FILENO, header, sizeof(header) - 1);
+  (void)n;
+  backtrace_symbols_fd(frames, size, STDERR_FILENO);
+#endif
+}
+void InstallDumpHandler() {
+  static std::once_flag once;
+  std::call_once(once, [] {
+#if defined(TOHKA_HAVE_BACKTRACE)
+    // the first backtrace loads libgcc, not in the signal handler then
+    void* frame;
+    backtrace(&frame, 1);
+#endif
+    struct sigaction action {};
+    action.sa_handler = DumpStack;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(kDumpSignal, &action, nullptr);
+  });
+}
+
+// "Foo::Foo(int, std::string)::{lambda()#1}" to "Foo::Foo::{lambda()#1}",
+// the enclosing function's parameters are too long to log
+std::string GetSiteName(const std::type_info& site) {
+  int status = 0;
+  char* demangled =
+      abi::__cxa_demangle(site.name(), nullptr, nullptr, &status);
+  std::string name = status == 0 ? demangled : site.name();
+  free(demangled);
+  std::string result;
+  size_t i = 0;
+  while (i < name.size()) {
+    if (name[i] == '(') {
+      int depth = 0;
+      size_t end = i;
+      for (; end < name.size(); ++end) {
+        if (name[end] == '(') {
+          ++depth;
+        } else if (name[end] == ')' && --depth == 0) {
+          break;
+        }
+      }
+      if (name.compare(end + 1, 2, "::") == 0) {
+        i = end + 1;
+        continue;
+      }
+    }
+    result += name[i];
+    ++i;
+  }
+  return result;
+}
+}  // namespace
+
+Watchdog::Watchdog(IoLoop* loop)
+    : loop_(loop),
+      loop_thread_(pthread_self()),
+      slow_callback_us_(0),
+      slow_callbacks_total_(MetricsRegistry::Get()->AddCounter(
+          "tohka_loop_slow_callbacks_total",
+          "Io and timer callbacks over the slow callback threshold.")),
+      busy_since_us_(0),
+      stuck_count_(0),
+      stuck_us_(0),
+      stopping_(false) {}
+Watchdog::~Watchdog() { StopDetector(); }
+
+void Watchdog::OnSlowCallback(int64_t elapsed_us, const std::type_info& site,
+                              int fd, const std::string& name) {
+  std::string site_name = GetSiteName(site);
+  int64_t count = ++slow_callbacks_[site_name];
+  slow_callbacks_total_->Inc();
+  log_warn(
+      "[Watchdog]->slow callback %.3f ms fd = %d name = %s site = %s, %lld "
+      "times",
+      (double)elapsed_us / 1000, fd, name.empty() ? "-" : name.c_str(),
+      site_name.c_str(), (long long)count);
+}
+
+void Watchdog::SetStuckThreshold(int stuck_ms) {
+  StopDetector();
+  stuck_us_ = (int64_t)stuck_ms * 1000;
+  if (stuck_ms <= 0) {
+    return;
+  }
+  InstallDumpHandler();
+  stopping_ = false;
+  detector_ = std::thread([this] { DetectStuck(); });
+}
+void Watchdog::StopDetector() {
+  if (!detector_.joinable()) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  wake_.notify_one();
+  detector_.join();
+}
+void Watchdog::DetectStuck() {
+  // a stuck iteration is found at most a quarter threshold late
+  auto interval =
+      std::chrono::microseconds(std::max<int64_t>(stuck_us_ / 4, 1000));
+  int64_t reported = 0;
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (!wake_.wait_for(lock, interval, [this] { return stopping_; })) {
+    int64_t busy_since = busy_since_us_.load(std::memory_order_relaxed);
+    if (busy_since == 0 || busy_since == reported) {
+      continue;
+    }
+    int64_t busy = TimePoint::now().GetMicroSeconds() - busy_since;
+    if (busy < stuck_us_) {
+      continue;
+    }
+    reported = busy_since;
+    stuck_count_.fetch_add(1, std::memory_order_relaxed);
+    log_error("[Watchdog]->loop %p stuck in callbacks for %lld ms", loop_,
+              (long long)(busy / 1000));
+    pthread_kill(loop_thread_, kDumpSignal);
+  }
+}
@@ -0,0 +1,96 @@
+//
+// Created by li on 2022/7/14.
+//
+
+#ifndef TOHKA_TOHKA_WATCHDOG_H
+#define TOHKA_TOHKA_WATCHDOG_H
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <typeinfo>
+
+#include <pthread.h>
+
+#include "noncopyable.h"
+#include "timepoint.h"
+#include "tohka.h"
+namespace tohka {
+class Counter;
+// Finds what blocks a loop, see IoLoop::GetWatchdog. Create it on the
+// loop's thread, all but the stuck detector run there.
+//
+// Slow callbacks: io and timer callbacks running longer than a threshold
+// are logged with the fd, the connection name and the callback site, and
+// counted per site. The site is the demangled type of the callback, for
+// a lambda that names the function it was written in.
+//
+// Stuck loop: a thread checks that no iteration runs callbacks longer than
+// a threshold, if one does it logs it and dumps the stack of the loop
+// thread to stderr, once per stuck iteration. Link with -rdynamic for
+// function names in the stack. The dump is made by SIGURG sent to the loop
+// thread, it cuts a sleep of the stuck callback short.
+class Watchdog : noncopyable {
+ public:
+  explicit Watchdog(IoLoop* loop);
+  ~Watchdog();
+
+  // 0 turns it off
+  void SetSlowCallbackThreshold(int slow_callback_ms) {
+    slow_callback_us_ = (int64_t)slow_callback_ms * 1000;
+  }
+  bool IsTimingCallbacks() const { return slow_callback_us_ > 0; }
+  // slow callbacks seen per site
+  const std::map<std::string, int64_t>& GetSlowCallbacks() const {
+    return slow_callbacks_;
+  }
+
+  // starts the detector thread, 0 stops it
+  void SetStuckThreshold(int stuck_ms);
+  int64_t GetStuckCount() const {
+    return stuck_count_.load(std::memory_order_relaxed);
+  }
+
+  /// Internal use only, called by IoLoop when it polls and when it runs
+  /// callbacks.
+  void OnIdle() { busy_since_us_.store(0, std::memory_order_relaxed); }
+  void OnBusy() {
+    busy_since_us_.store(TimePoint::now().GetMicroSeconds(),
+                         std::memory_order_relaxed);
+  }
+  /// Internal use only, called after a callback that started at start.
+  /// name may be empty.
+  void OnCallbackDone(TimePoint start, const std::type_info& site, int fd,
+                      const std::string& name) {
+    int64_t elapsed =
+        TimePoint::now().GetMicroSeconds() - start.GetMicroSeconds();
+    if (elapsed >= slow_callback_us_) {
+      OnSlowCallback(elapsed, site, fd, name);
+    }
+  }
+
+ private:
+  void OnSlowCallback(int64_t elapsed_us, const std::type_info& site, int fd,
+                      const std::string& name);
+  void DetectStuck();
+  void StopDetector();
+
+  IoLoop* loop_;
+  pthread_t loop_thread_;
+  int64_t slow_callback_us_;
+  std::map<std::string, int64_t> slow_callbacks_;
+  Counter* slow_callbacks_total_;
+
+  // start of the callbacks of this iteration, 0 while polling
+  std::atomic<int64_t> busy_since_us_;
+  std::atomic<int64_t> stuck_count_;
+  int64_t stuck_us_;
+  std::thread detector_;
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  bool stopping_;
+};
+}  // namespace tohka
+
+#endif  // TOHKA_TOHKA_WATCHDOG_H